@@ -0,0 +1,232 @@
+#pragma once
+#ifdef _WIN32
+#include <Windows.h>
+#include <malloc.h>
+#else
+typedef void* HWND;
+#endif
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <format>
+#include <unordered_map>
+
+// set WMTS_ALLOC_TRACKING to 1 (cmake -DWMTS_ALLOC_TRACKING=ON) to replace the global operator new/delete
+// with versions that count allocations in total and per window
+#ifndef WMTS_ALLOC_TRACKING
+#define WMTS_ALLOC_TRACKING 0
+#endif
+
+// set WMTS_ALLOC_STRICT to 1 to abort on any allocation inside a NoAllocScope
+// meant for test runs that must keep the steady state allocation free
+#ifndef WMTS_ALLOC_STRICT
+#define WMTS_ALLOC_STRICT 0
+#endif
+
+namespace WMTS {
+	struct AllocCounters {
+		std::atomic<uint64_t> mAllocations{ 0 };
+		std::atomic<uint64_t> mFrees{ 0 };
+		std::atomic<uint64_t> mBytes{ 0 };
+
+		// allocations made inside a NoAllocScope
+		std::atomic<uint64_t> mViolations{ 0 };
+
+		std::wstring Report() const {
+			return std::format(L"allocations={} frees={} bytes={} steady state violations={}",
+				mAllocations.load(std::memory_order_relaxed),
+				mFrees.load(std::memory_order_relaxed),
+				mBytes.load(std::memory_order_relaxed),
+				mViolations.load(std::memory_order_relaxed));
+		}
+	};
+
+	// the counters of the window the calling thread works for, nullptr if it is not attached
+	inline thread_local AllocCounters* tlWindowAllocCounters = nullptr;
+
+	// > 0 while the calling thread is inside a NoAllocScope
+	inline thread_local int tlNoAllocDepth = 0;
+
+	class AllocTracking {
+	public:
+		static AllocCounters& Global() {
+			static AllocCounters counters;
+			return counters;
+		}
+
+		static void SetStrict(bool strict) {
+			Strict().store(strict, std::memory_order_relaxed);
+		}
+
+		static std::atomic<bool>& Strict() {
+			static std::atomic<bool> strict{ WMTS_ALLOC_STRICT != 0 };
+			return strict;
+		}
+
+		// called by the replacement operator new, must not allocate
+		static void OnAllocate(size_t size) {
+			AllocCounters& global = Global();
+			global.mAllocations.fetch_add(1, std::memory_order_relaxed);
+			global.mBytes.fetch_add(size, std::memory_order_relaxed);
+
+			AllocCounters* window = tlWindowAllocCounters;
+			if (window) {
+				window->mAllocations.fetch_add(1, std::memory_order_relaxed);
+				window->mBytes.fetch_add(size, std::memory_order_relaxed);
+			}
+
+			if (tlNoAllocDepth > 0) {
+				global.mViolations.fetch_add(1, std::memory_order_relaxed);
+				if (window) window->mViolations.fetch_add(1, std::memory_order_relaxed);
+
+				if (Strict().load(std::memory_order_relaxed)) {
+					// no logger here, it would allocate
+					std::fputs("WMTS: allocation in a steady state NoAllocScope, aborting (WMTS_ALLOC_STRICT)\n", stderr);
+					std::abort();
+				}
+			}
+		}
+
+		// called by the replacement operator delete, must not allocate
+		static void OnFree() {
+			Global().mFrees.fetch_add(1, std::memory_order_relaxed);
+
+			AllocCounters* window = tlWindowAllocCounters;
+			if (window) window->mFrees.fetch_add(1, std::memory_order_relaxed);
+		}
+	};
+
+	// marks a steady state region that must not allocate
+	// allocations inside are counted as violations, or abort in strict mode
+	class NoAllocScope {
+	public:
+		NoAllocScope() { ++tlNoAllocDepth; }
+		~NoAllocScope() { --tlNoAllocDepth; }
+
+		NoAllocScope(const NoAllocScope&) = delete;
+		NoAllocScope& operator=(const NoAllocScope&) = delete;
+	};
+
+	// lifts an enclosing NoAllocScope for work that is expected to allocate,
+	// such as creating a new window from a menu command
+	class AllocAllowedScope {
+	public:
+		AllocAllowedScope() :mSavedDepth(tlNoAllocDepth) { tlNoAllocDepth = 0; }
+		~AllocAllowedScope() { tlNoAllocDepth = mSavedDepth; }
+
+		AllocAllowedScope(const AllocAllowedScope&) = delete;
+		AllocAllowedScope& operator=(const AllocAllowedScope&) = delete;
+
+	private:
+		int mSavedDepth;
+	};
+
+	// per window allocation counters, every thread that works for a window attaches to it
+	class WindowAllocRegistry {
+	public:
+		// attaches the calling thread, its allocations count towards WindowHandle until Detach()
+		std::shared_ptr<AllocCounters> AttachCurrentThread(HWND WindowHandle) {
+			std::shared_ptr<AllocCounters> counters;
+			{
+				std::lock_guard<std::mutex> local_lock(mWindows_mtx);
+				auto& entry = mWindows[WindowHandle];
+				if (!entry.mCounters) entry.mCounters = std::make_shared<AllocCounters>();
+				entry.mThreads++;
+				counters = entry.mCounters;
+			}
+			tlWindowAllocCounters = counters.get();
+			return counters;
+		}
+
+		// call from the attached thread, the window's counters are retired with its last thread
+		void DetachCurrentThread(HWND WindowHandle) {
+			tlWindowAllocCounters = nullptr;
+			std::lock_guard<std::mutex> local_lock(mWindows_mtx);
+			auto found = mWindows.find(WindowHandle);
+			if (found == mWindows.end()) return;
+			if (--found->second.mThreads == 0) {
+				const auto& closed = *found->second.mCounters;
+				mClosed.mAllocations.fetch_add(closed.mAllocations.load(std::memory_order_relaxed), std::memory_order_relaxed);
+				mClosed.mFrees.fetch_add(closed.mFrees.load(std::memory_order_relaxed), std::memory_order_relaxed);
+				mClosed.mBytes.fetch_add(closed.mBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+				mClosed.mViolations.fetch_add(closed.mViolations.load(std::memory_order_relaxed), std::memory_order_relaxed);
+				mWindows.erase(found);
+			}
+		}
+
+		std::wstring Report() {
+			std::lock_guard<std::mutex> local_lock(mWindows_mtx);
+			std::wstring report = L"Allocations:\n  total: " + AllocTracking::Global().Report() + L"\n";
+			for (const auto& [handle, entry] : mWindows) {
+				report += std::format(L"  window {}: ", (const void*)handle) + entry.mCounters->Report() + L"\n";
+			}
+			report += L"  closed windows: " + mClosed.Report() + L"\n";
+			return report;
+		}
+
+	private:
+		struct Entry {
+			std::shared_ptr<AllocCounters> mCounters;
+			int mThreads{};
+		};
+
+		std::mutex mWindows_mtx;
+		std::unordered_map<HWND, Entry> mWindows;
+		AllocCounters mClosed;
+	};
+}
+
+#if WMTS_ALLOC_TRACKING
+// replacement global allocation functions
+// they are defined in this header because the window system is header only and
+// compiled into a single translation unit, include it from exactly one .cpp file
+// the array, nothrow and sized forms are left to the standard library which forwards them here
+
+void* operator new(size_t size) {
+	WMTS::AllocTracking::OnAllocate(size);
+	void* p = std::malloc(size ? size : 1);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept {
+	if (!p) return;
+	WMTS::AllocTracking::OnFree();
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	::operator delete(p);
+}
+
+void* operator new(size_t size, std::align_val_t align) {
+	WMTS::AllocTracking::OnAllocate(size);
+	size_t alignment = (size_t)align;
+#ifdef _WIN32
+	void* p = _aligned_malloc(size ? size : 1, alignment);
+#else
+	// aligned_alloc wants a size that is a multiple of the alignment
+	void* p = std::aligned_alloc(alignment, ((size ? size : 1) + alignment - 1) / alignment * alignment);
+#endif
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+	if (!p) return;
+	WMTS::AllocTracking::OnFree();
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	std::free(p);
+#endif
+}
+
+void operator delete(void* p, size_t, std::align_val_t align) noexcept {
+	::operator delete(p, align);
+}
+#endif
@@ -0,0 +1,525 @@
+#pragma once
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <format>
+#include <filesystem>
+#include <type_traits>
+#include <algorithm>
+#include "Framebuffer.hpp"
+#include "Histogram.hpp"
+#include "LockStats.hpp"
+
+// set WMTS_CAPTURE to 1 (cmake -DWMTS_CAPTURE=ON) to record what every window showed into a memory mapped
+// ring file, WMTScapture.bin next to WMTSlog.txt, extract the frames offline with the WMTSCapture tool
+#ifndef WMTS_CAPTURE
+#define WMTS_CAPTURE 0
+#endif
+
+namespace WMTS {
+	// the layout below is read by WMTSCapture, bump the version on any change
+	constexpr uint32_t CaptureMagic = 0x43544d57; // "WMTC"
+	constexpr uint32_t CaptureRecordMagic = 0x46544d57; // "WMTF"
+	constexpr uint32_t CaptureVersion = 1;
+
+	// records start on this boundary, a reader looking for the oldest record steps through the ring by it
+	constexpr uint64_t CaptureAlign = 64;
+
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "the capture file needs address free 64 bit atomics");
+
+	enum class CaptureKind : uint32_t {
+		// the whole frame, one rectangle covering it
+		KEY = 1,
+		// only the rectangles that changed since mBaseFrame of the same window
+		DELTA = 2
+	};
+
+	// the start of the file, the ring of records follows it
+	struct alignas(CaptureAlign) CaptureFileHeader {
+		uint32_t mMagic;
+		uint32_t mVersion;
+		uint32_t mHeaderSize;
+		uint32_t mRecordHeaderSize;
+
+		// bytes of the ring after this header
+		uint64_t mCapacity;
+
+		uint32_t mPid;
+		uint32_t mReserved;
+
+		// steady clock nanoseconds when the file was created, record times count from it
+		uint64_t mStartNs;
+
+		// bytes ever reserved, the next record goes at mHead % mCapacity
+		// records that started before mHead - mCapacity have been written over
+		std::atomic<uint64_t> mHead;
+
+		// records committed since the file was created, including overwritten ones
+		std::atomic<uint64_t> mRecords;
+	};
+
+	// one captured frame, followed by mRectCount PixelRects and then the pixels of each rectangle,
+	// row by row with no padding, the record is padded to CaptureAlign
+	struct CaptureRecordHeader {
+		// written last, a record without it was still being written when the process stopped
+		uint32_t mMagic;
+		CaptureKind mKind;
+
+		// mHead when the record was reserved, tells a live record from an older lap's leftovers
+		uint64_t mPosition;
+
+		// the whole record including this header and the padding
+		uint64_t mSize;
+
+		uint64_t mWindowHandle;
+		uint64_t mFrame;
+
+		// the frame a DELTA applies on, 0 for a KEY
+		uint64_t mBaseFrame;
+
+		// nanoseconds since CaptureFileHeader::mStartNs
+		uint64_t mTimeNs;
+
+		// the whole window from WindowDimensions, and the frame which covers its client area
+		uint32_t mWindowWidth;
+		uint32_t mWindowHeight;
+		uint32_t mWidth;
+		uint32_t mHeight;
+
+		uint32_t mRectCount;
+		uint32_t mReserved;
+	};
+
+	static_assert(std::is_standard_layout_v<CaptureFileHeader>, "CaptureFileHeader is read by other programs");
+	static_assert(std::is_standard_layout_v<CaptureRecordHeader>, "CaptureRecordHeader is read by other programs");
+
+	struct CaptureConfig {
+		// relative paths are relative to the working directory, like WMTSlog.txt
+		std::filesystem::path mPath{ L"WMTScapture.bin" };
+
+		// allocated up front, the oldest frames are written over once it is full
+		uint64_t mCapacityBytes{ 256ull * 1024 * 1024 };
+
+		// a window writes a whole frame at least this often, so a reader can start soon after the oldest record
+		uint32_t mKeyframeEvery{ 60 };
+	};
+
+	// a copy of the capture counters
+	struct CaptureStats {
+		uint64_t mKeyframes{};
+		uint64_t mDeltas{};
+		uint64_t mBytes{};
+
+		// frames larger than the whole ring, never written
+		uint64_t mDropped{};
+
+		// times the ring started over at its beginning
+		uint64_t mWraps{};
+
+		// reserving and copying one frame into the mapping
+		LatencyHistogram::Snapshot mWriteTime;
+
+		std::wstring Report() const {
+			uint64_t frames = mKeyframes + mDeltas;
+			return std::format(L"Capture: frames={} keyframes={} deltas={} dropped={} wraps={} bytes per frame={}\n"
+				L"  write {}\n",
+				frames, mKeyframes, mDeltas, mDropped, mWraps, frames ? mBytes / frames : 0, mWriteTime.Summary());
+		}
+	};
+
+	// a preallocated file mapped into memory and used as a ring of CaptureRecords
+	// writers reserve space under a short lock and then copy straight into the mapping without it,
+	// so windows capture in parallel and the OS writes the pages back to the file in its own time
+	// a record is only torn if the ring laps it while it is being copied, keep the capacity many frames large
+	class CaptureRing {
+	public:
+		CaptureRing() = default;
+
+		~CaptureRing() {
+			Close();
+		}
+
+		CaptureRing(const CaptureRing&) = delete;
+		CaptureRing& operator=(const CaptureRing&) = delete;
+
+		// creates or truncates the file and allocates all of it, returns false if the OS refuses
+		bool Create(const std::filesystem::path& path, uint64_t CapacityBytes, uint32_t pid) {
+			Close();
+			uint64_t capacity = std::max<uint64_t>(CapacityBytes / CaptureAlign * CaptureAlign, CaptureAlign);
+			mBytes = sizeof(CaptureFileHeader) + capacity;
+			mWritable = true;
+			if (!Map(path, true)) return false;
+
+			CaptureFileHeader& header = *mHeader;
+			header.mVersion = CaptureVersion;
+			header.mHeaderSize = sizeof(CaptureFileHeader);
+			header.mRecordHeaderSize = sizeof(CaptureRecordHeader);
+			header.mCapacity = capacity;
+			header.mPid = pid;
+			header.mStartNs = SteadyNs();
+			header.mHead.store(0, std::memory_order_relaxed);
+			header.mRecords.store(0, std::memory_order_relaxed);
+
+			// the magic goes last so a reader never trusts a half written header
+			std::atomic_thread_fence(std::memory_order_release);
+			header.mMagic = CaptureMagic;
+			return true;
+		}
+
+		// maps an existing capture file read only, returns false if it is missing, truncated or another layout
+		bool Open(const std::filesystem::path& path) {
+			Close();
+			mWritable = false;
+			if (!Map(path, false)) return false;
+
+			const CaptureFileHeader& header = *mHeader;
+			if (mBytes < sizeof(CaptureFileHeader) || header.mMagic != CaptureMagic || header.mVersion != CaptureVersion ||
+				header.mHeaderSize != sizeof(CaptureFileHeader) || header.mRecordHeaderSize != sizeof(CaptureRecordHeader) ||
+				header.mCapacity > mBytes - sizeof(CaptureFileHeader)) {
+				Close();
+				return false;
+			}
+			return true;
+		}
+
+		void Close() {
+#ifdef _WIN32
+			if (mHeader) UnmapViewOfFile(mHeader);
+			if (mMapping) CloseHandle(mMapping);
+			if (mFile != INVALID_HANDLE_VALUE) CloseHandle(mFile);
+			mMapping = nullptr;
+			mFile = INVALID_HANDLE_VALUE;
+#else
+			if (mHeader) munmap(mHeader, mBytes);
+#endif
+			mHeader = nullptr;
+		}
+
+		bool IsOpen() const { return mHeader != nullptr; }
+
+		const CaptureFileHeader* Header() const { return mHeader; }
+
+		// nanoseconds since the file was created
+		uint64_t NowNs() const {
+			return mHeader ? SteadyNs() - mHeader->mStartNs : 0;
+		}
+
+		// writer side, space for a record of Bytes bytes, CaptureAlign aligned, with mPosition and mSize filled in
+		// nullptr if the ring is not open for writing or smaller than the record
+		// a record never wraps, one that does not fit before the end starts the next lap instead
+		CaptureRecordHeader* Reserve(uint64_t Bytes) {
+			if (!mHeader || !mWritable) return nullptr;
+			uint64_t capacity = mHeader->mCapacity;
+			if (Bytes > capacity) {
+				mDropped.fetch_add(1, std::memory_order_relaxed);
+				return nullptr;
+			}
+
+			uint64_t position;
+			{
+				std::lock_guard<ProfiledMutex> local_lock(mReserve_mtx);
+				position = mHeader->mHead.load(std::memory_order_relaxed);
+				uint64_t offset = position % capacity;
+				if (offset + Bytes > capacity) {
+					// the reader steps over the rest of this lap, none of it carries this lap's positions
+					position += capacity - offset;
+					mWraps.fetch_add(1, std::memory_order_relaxed);
+				}
+				mHeader->mHead.store(position + Bytes, std::memory_order_relaxed);
+
+				// an older record may be left at this offset, the reader must not take it for a new one
+				// while the new one is still being copied
+				RecordAt(position % capacity)->mMagic = 0;
+			}
+
+			CaptureRecordHeader* record = RecordAt(position % capacity);
+			record->mPosition = position;
+			record->mSize = Bytes;
+			return record;
+		}
+
+		// writer side, makes a record from Reserve() visible to readers
+		void Commit(CaptureRecordHeader* record, uint64_t StartNs) {
+			if (record->mKind == CaptureKind::KEY) mKeyframes.fetch_add(1, std::memory_order_relaxed);
+			else mDeltas.fetch_add(1, std::memory_order_relaxed);
+			mWrittenBytes.fetch_add(record->mSize, std::memory_order_relaxed);
+
+			std::atomic_thread_fence(std::memory_order_release);
+			record->mMagic = CaptureRecordMagic;
+			mHeader->mRecords.fetch_add(1, std::memory_order_relaxed);
+			mWriteTime.Record(SteadyNs() - StartNs);
+		}
+
+		// reader side, calls f(const CaptureRecordHeader&) for every complete record still in the ring, oldest first
+		// meant for a file whose writer has stopped, records are checked but not copied
+		template<class F>
+		size_t ForEachRecord(F&& f) const {
+			if (!mHeader) return 0;
+			uint64_t capacity = mHeader->mCapacity;
+			uint64_t head = mHeader->mHead.load(std::memory_order_acquire);
+			uint64_t position = head > capacity ? head - capacity : 0;
+			// the oldest live record starts on an aligned position at or after the lap boundary
+			position = (position + CaptureAlign - 1) / CaptureAlign * CaptureAlign;
+
+			size_t visited = 0;
+			while (position < head) {
+				const CaptureRecordHeader* record = RecordAt(position % capacity);
+				uint64_t offset = position % capacity;
+				bool valid = capacity - offset >= sizeof(CaptureRecordHeader) &&
+					record->mMagic == CaptureRecordMagic && record->mPosition == position &&
+					record->mSize >= sizeof(CaptureRecordHeader) && record->mSize % CaptureAlign == 0 &&
+					offset + record->mSize <= capacity && position + record->mSize <= head &&
+					RecordBytes(record->mRectCount, 0) <= record->mSize;
+				if (!valid) {
+					position += CaptureAlign;
+					continue;
+				}
+				f(*record);
+				visited++;
+				position += record->mSize;
+			}
+			return visited;
+		}
+
+		// the rectangles after a record's header
+		static const PixelRect* Rects(const CaptureRecordHeader& record) {
+			return reinterpret_cast<const PixelRect*>(reinterpret_cast<const uint8_t*>(&record) + sizeof(CaptureRecordHeader));
+		}
+
+		// the pixels after a record's rectangles
+		static const uint32_t* Pixels(const CaptureRecordHeader& record) {
+			return reinterpret_cast<const uint32_t*>(reinterpret_cast<const uint8_t*>(Rects(record)) + record.mRectCount * sizeof(PixelRect));
+		}
+
+		// the aligned size of a record with RectCount rectangles covering Pixels pixels
+		static uint64_t RecordBytes(uint64_t RectCount, uint64_t Pixels) {
+			uint64_t bytes = sizeof(CaptureRecordHeader) + RectCount * sizeof(PixelRect) + Pixels * sizeof(uint32_t);
+			return (bytes + CaptureAlign - 1) / CaptureAlign * CaptureAlign;
+		}
+
+		// safe to call from any thread
+		CaptureStats Read() const {
+			CaptureStats stats;
+			stats.mKeyframes = mKeyframes.load(std::memory_order_relaxed);
+			stats.mDeltas = mDeltas.load(std::memory_order_relaxed);
+			stats.mBytes = mWrittenBytes.load(std::memory_order_relaxed);
+			stats.mDropped = mDropped.load(std::memory_order_relaxed);
+			stats.mWraps = mWraps.load(std::memory_order_relaxed);
+			stats.mWriteTime = mWriteTime.Read();
+			return stats;
+		}
+
+		static uint64_t SteadyNs() {
+			return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+	private:
+		CaptureRecordHeader* RecordAt(uint64_t offset) const {
+			return reinterpret_cast<CaptureRecordHeader*>(reinterpret_cast<uint8_t*>(mHeader) + sizeof(CaptureFileHeader) + offset);
+		}
+
+		// maps mBytes of a new file, or all of an existing one, mHeader is nullptr on failure
+		bool Map(const std::filesystem::path& path, bool create) {
+#ifdef _WIN32
+			mFile = CreateFileW(path.wstring().c_str(), create ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+				FILE_SHARE_READ | (create ? 0 : FILE_SHARE_WRITE), nullptr, create ? CREATE_ALWAYS : OPEN_EXISTING,
+				FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (mFile == INVALID_HANDLE_VALUE) return false;
+			if (!create) {
+				LARGE_INTEGER size{};
+				if (!GetFileSizeEx(mFile, &size)) {
+					Close();
+					return false;
+				}
+				mBytes = (uint64_t)size.QuadPart;
+			}
+			if (mBytes < sizeof(CaptureFileHeader)) {
+				Close();
+				return false;
+			}
+			// mapping a new file at this size extends it on disk, so later writes never run out of space
+			mMapping = CreateFileMappingW(mFile, nullptr, create ? PAGE_READWRITE : PAGE_READONLY,
+				(DWORD)(mBytes >> 32), (DWORD)(mBytes & 0xFFFFFFFF), nullptr);
+			if (!mMapping) {
+				Close();
+				return false;
+			}
+			mHeader = (CaptureFileHeader*)MapViewOfFile(mMapping, create ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, (SIZE_T)mBytes);
+#else
+			int fd = create ? open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644) : open(path.c_str(), O_RDONLY);
+			if (fd < 0) return false;
+			if (create) {
+				// allocated now rather than sparse, so a full disk fails here and not as SIGBUS mid frame
+				if (posix_fallocate(fd, 0, (off_t)mBytes) != 0) {
+					close(fd);
+					return false;
+				}
+			}
+			else {
+				struct stat info {};
+				if (fstat(fd, &info) != 0 || (uint64_t)info.st_size < sizeof(CaptureFileHeader)) {
+					close(fd);
+					return false;
+				}
+				mBytes = (uint64_t)info.st_size;
+			}
+			void* view = mmap(nullptr, mBytes, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+			close(fd);
+			mHeader = view == MAP_FAILED ? nullptr : (CaptureFileHeader*)view;
+#endif
+			if (!mHeader) {
+				Close();
+				return false;
+			}
+			return true;
+		}
+
+		CaptureFileHeader* mHeader{ nullptr };
+		uint64_t mBytes{};
+		bool mWritable{ false };
+#ifdef _WIN32
+		HANDLE mFile{ INVALID_HANDLE_VALUE };
+		HANDLE mMapping{ nullptr };
+#endif
+
+		ProfiledMutex mReserve_mtx{ L"CaptureRing::mReserve_mtx" };
+
+		std::atomic<uint64_t> mKeyframes{ 0 };
+		std::atomic<uint64_t> mDeltas{ 0 };
+		std::atomic<uint64_t> mWrittenBytes{ 0 };
+		std::atomic<uint64_t> mDropped{ 0 };
+		std::atomic<uint64_t> mWraps{ 0 };
+		LatencyHistogram mWriteTime;
+	};
+
+	// Reserve() returns this when the frame gets no record
+	constexpr uint64_t NoCaptureRecord = UINT64_MAX;
+
+	// one window's side of the capture, used by the window's logic thread for every frame it publishes
+	// a frame that directly follows the last one captured is written as the rectangles that changed,
+	// anything else, a frame after a dropped one, a new size or every mKeyframeEvery-th frame, is written whole
+	class WindowCapture {
+	public:
+		void Attach(CaptureRing* ring, uint64_t WindowHandle, uint32_t KeyframeEvery) {
+			mRing = ring;
+			mWindowHandle = WindowHandle;
+			mKeyframeEvery = std::max<uint32_t>(KeyframeEvery, 1);
+			mLastFrame = 0;
+		}
+
+		bool Attached() const { return mRing != nullptr; }
+
+		// reserves frame Number's record and fills in its header and rectangles, Damage is what changed since
+		// frame Number - 1, DamageFull means everything changed, the window size comes from WindowDimensions
+		// returns the record's position in the ring, or NoCaptureRecord if the frame is not captured
+		// the pixels are copied by Commit(), frame must not change in between
+		uint64_t Reserve(const Framebuffer& frame, uint64_t Number, const PixelRect* Damage, size_t DamageCount, bool DamageFull,
+			uint32_t WindowWidth, uint32_t WindowHeight) {
+			mPending = nullptr;
+			if (!mRing || frame.Empty()) return NoCaptureRecord;
+			uint64_t start = CaptureRing::SteadyNs();
+
+			bool delta = mLastFrame != 0 && Number == mLastFrame + 1 && !DamageFull &&
+				frame.Width() == mLastWidth && frame.Height() == mLastHeight && mSinceKeyframe + 1 < mKeyframeEvery;
+
+			PixelRect whole = frame.Area();
+			std::array<PixelRect, MaxRects> rects;
+			size_t count = 0;
+			uint64_t pixels = 0;
+			if (delta) {
+				for (size_t i{}; i < DamageCount && count < MaxRects; i++) {
+					PixelRect clipped = Damage[i].Intersect(whole);
+					if (clipped.Empty()) continue;
+					rects[count++] = clipped;
+					pixels += Area(clipped);
+				}
+			}
+			else {
+				rects[count++] = whole;
+				pixels = Area(whole);
+			}
+
+			CaptureRecordHeader* record = mRing->Reserve(CaptureRing::RecordBytes(count, pixels));
+			if (!record) {
+				// the next frame has nothing to build on
+				mLastFrame = 0;
+				return NoCaptureRecord;
+			}
+			record->mKind = delta ? CaptureKind::DELTA : CaptureKind::KEY;
+			record->mWindowHandle = mWindowHandle;
+			record->mFrame = Number;
+			record->mBaseFrame = delta ? mLastFrame : 0;
+			record->mTimeNs = mRing->NowNs();
+			record->mWindowWidth = WindowWidth;
+			record->mWindowHeight = WindowHeight;
+			record->mWidth = frame.Width();
+			record->mHeight = frame.Height();
+			record->mRectCount = (uint32_t)count;
+			record->mReserved = 0;
+			std::copy_n(rects.begin(), count, const_cast<PixelRect*>(CaptureRing::Rects(*record)));
+
+			mPending = record;
+			mPendingStart = start;
+			mSinceKeyframe = delta ? mSinceKeyframe + 1 : 0;
+			mLastFrame = Number;
+			mLastWidth = frame.Width();
+			mLastHeight = frame.Height();
+			return record->mPosition;
+		}
+
+		// copies the pixels of the record the last Reserve() returned and makes it visible to readers
+		void Commit(const Framebuffer& frame) {
+			CaptureRecordHeader* record = mPending;
+			if (!record) return;
+			mPending = nullptr;
+
+			// straight from the framebuffer into the mapped pages, row by row
+			const PixelRect* rects = CaptureRing::Rects(*record);
+			uint32_t* out = const_cast<uint32_t*>(CaptureRing::Pixels(*record));
+			for (uint32_t i{}; i < record->mRectCount; i++) {
+				size_t width = (size_t)(rects[i].mRight - rects[i].mLeft);
+				for (int32_t y = rects[i].mTop; y < rects[i].mBottom; y++) {
+					std::memcpy(out, frame.Row((uint32_t)y) + rects[i].mLeft, width * sizeof(uint32_t));
+					out += width;
+				}
+			}
+			mRing->Commit(record, mPendingStart);
+		}
+
+	private:
+		// the most rectangles a delta carries, more than DamageRegion ever reports
+		static constexpr size_t MaxRects = 16;
+
+		static uint64_t Area(const PixelRect& rect) {
+			return (uint64_t)(rect.mRight - rect.mLeft) * (uint64_t)(rect.mBottom - rect.mTop);
+		}
+
+		CaptureRing* mRing{ nullptr };
+		uint64_t mWindowHandle{};
+		uint32_t mKeyframeEvery{ 60 };
+
+		// the last frame written and its size, 0 when the next one must be a KEY
+		uint64_t mLastFrame{};
+		uint32_t mLastWidth{};
+		uint32_t mLastHeight{};
+		uint32_t mSinceKeyframe{};
+
+		// reserved and waiting for Commit()
+		CaptureRecordHeader* mPending{ nullptr };
+		uint64_t mPendingStart{};
+	};
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <Windows.h>
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+#include <string>
+#include <format>
+
+// set WMTS_COALESCE to 1 (cmake -DWMTS_COALESCE=ON) to coalesce size bursts in the message loop
+#ifndef WMTS_COALESCE
+#define WMTS_COALESCE 0
+#endif
+
+namespace WMTS {
+	// a plain copy of a window's coalescing counters
+	struct CoalesceSnapshot {
+		// WM_SIZE and WM_SIZING received, and the dimension updates they turned into
+		uint64_t mSizeEvents{};
+		uint64_t mSizeUpdates{};
+
+		CoalesceSnapshot& operator+=(const CoalesceSnapshot& other) {
+			mSizeEvents += other.mSizeEvents;
+			mSizeUpdates += other.mSizeUpdates;
+			return *this;
+		}
+
+		// share of the events that did not need their own handler run, in percent
+		static double Reduction(uint64_t events, uint64_t handled) {
+			return events ? 100.0 * (double)(events - std::min(events, handled)) / (double)events : 0.0;
+		}
+
+		std::wstring Report() const {
+			return std::format(L"size events={} updates={} ({:.1f}% coalesced)", mSizeEvents, mSizeUpdates, Reduction(mSizeEvents, mSizeUpdates));
+		}
+	};
+
+	// coalescing state of one window
+	// the UI thread marks size changes, TakeSize() can run on the UI thread
+	// after each dispatch or on the logic thread once per tick, whichever comes first takes the pending size
+	class WindowCoalescer {
+	public:
+		// a WM_SIZE or WM_SIZING arrived, the dimensions will be refreshed by the next flush
+		void MarkSize() {
+			mSizeEvents.fetch_add(1, std::memory_order_relaxed);
+			mSizeDirty.store(true, std::memory_order_release);
+		}
+
+		// true once per burst of size events, the caller then refreshes the dimensions
+		bool TakeSize() {
+			if (!mSizeDirty.load(std::memory_order_relaxed)) return false;
+			if (!mSizeDirty.exchange(false, std::memory_order_acq_rel)) return false;
+			mSizeUpdates.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		CoalesceSnapshot Read() const {
+			CoalesceSnapshot snapshot;
+			snapshot.mSizeEvents = mSizeEvents.load(std::memory_order_relaxed);
+			snapshot.mSizeUpdates = mSizeUpdates.load(std::memory_order_relaxed);
+			return snapshot;
+		}
+
+	private:
+		std::atomic<bool> mSizeDirty{ false };
+
+		std::atomic<uint64_t> mSizeEvents{ 0 };
+		std::atomic<uint64_t> mSizeUpdates{ 0 };
+	};
+
+	// the coalescer of the window the calling UI thread serves, nullptr when coalescing is off
+	inline thread_local WindowCoalescer* tlWindowCoalescer = nullptr;
+}
@@ -0,0 +1,293 @@
+#pragma once
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#include <sys/resource.h>
+typedef void* HWND;
+#endif
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <string>
+#include <format>
+#include <algorithm>
+
+// set WMTS_CPU_ACCOUNTING to 1 (cmake -DWMTS_CPU_ACCOUNTING=ON) to attribute thread CPU time to windows
+#ifndef WMTS_CPU_ACCOUNTING
+#define WMTS_CPU_ACCOUNTING 0
+#endif
+
+namespace WMTS {
+	enum class ThreadRole {
+		// runs the window's message loop
+		UI,
+
+		// runs RunLogic() for the window
+		LOGIC
+	};
+
+	// reads the user + kernel CPU time of one thread from any thread
+	class ThreadCpuClock {
+	public:
+		// a clock for the calling thread
+		static ThreadCpuClock ForCurrentThread() {
+			ThreadCpuClock clock;
+#ifdef _WIN32
+			// GetCurrentThread() is a pseudo handle that means "the caller" wherever it is used
+			// so it is duplicated into a real handle other threads can read
+			DuplicateHandle(GetCurrentProcess(), GetCurrentThread(), GetCurrentProcess(), &clock.mThread, 0, FALSE, DUPLICATE_SAME_ACCESS);
+#else
+			if (pthread_getcpuclockid(pthread_self(), &clock.mClock) == 0) {
+				clock.mValid = true;
+			}
+#endif
+			return clock;
+		}
+
+		ThreadCpuClock() = default;
+
+		ThreadCpuClock(ThreadCpuClock&& other) noexcept {
+			*this = std::move(other);
+		}
+
+		ThreadCpuClock& operator=(ThreadCpuClock&& other) noexcept {
+#ifdef _WIN32
+			std::swap(mThread, other.mThread);
+#else
+			std::swap(mClock, other.mClock);
+			std::swap(mValid, other.mValid);
+#endif
+			return *this;
+		}
+
+		ThreadCpuClock(const ThreadCpuClock&) = delete;
+		ThreadCpuClock& operator=(const ThreadCpuClock&) = delete;
+
+		~ThreadCpuClock() {
+#ifdef _WIN32
+			if (mThread) CloseHandle(mThread);
+#endif
+		}
+
+		// total CPU time in nanoseconds, 0 if the clock could not be read
+		// on Linux the clock is only valid while the thread is alive
+		uint64_t ReadNs() const {
+#ifdef _WIN32
+			FILETIME creation{}, exit{}, kernel{}, user{};
+			if (!mThread || !GetThreadTimes(mThread, &creation, &exit, &kernel, &user)) return 0;
+
+			// FILETIME counts 100 ns intervals
+			auto to_ns = [](const FILETIME& ft) {
+				return ((((uint64_t)ft.dwHighDateTime) << 32) | ft.dwLowDateTime) * 100;
+			};
+			return to_ns(kernel) + to_ns(user);
+#else
+			timespec ts{};
+			if (!mValid || clock_gettime(mClock, &ts) != 0) return 0;
+			return (uint64_t)ts.tv_sec * 1'000'000'000ull + (uint64_t)ts.tv_nsec;
+#endif
+		}
+
+	private:
+#ifdef _WIN32
+		HANDLE mThread{ nullptr };
+#else
+		clockid_t mClock{};
+		bool mValid{ false };
+#endif
+	};
+
+	// CPU time of one window's threads
+	struct WindowCpuTime {
+		HWND mWindowHandle{};
+		uint64_t mUiNs{};
+		uint64_t mLogicNs{};
+		uint32_t mThreads{};
+
+		uint64_t TotalNs() const { return mUiNs + mLogicNs; }
+	};
+
+	// one registered thread
+	struct ThreadCpuEntry {
+		HWND mWindowHandle;
+		ThreadRole mRole;
+		ThreadCpuClock mClock;
+
+		// the reading taken by the last Sample()
+		std::atomic<uint64_t> mLastNs{ 0 };
+	};
+
+	// attributes the CPU time of UI and logic threads to their windows
+	// threads register themselves, Sample() reads every registered thread from any thread
+	class CpuAccounting {
+	public:
+		~CpuAccounting() {
+			StopPeriodicSummary();
+		}
+
+		// call from the thread that is being registered
+		std::shared_ptr<ThreadCpuEntry> RegisterCurrentThread(HWND WindowHandle, ThreadRole role) {
+			auto entry = std::make_shared<ThreadCpuEntry>(WindowHandle, role, ThreadCpuClock::ForCurrentThread());
+			std::lock_guard<std::mutex> local_lock(mEntries_mtx);
+			mEntries.push_back(entry);
+			return entry;
+		}
+
+		// call from the registered thread before it exits
+		// the final reading is folded into the window's retired total so summaries stay monotonic
+		void Unregister(const std::shared_ptr<ThreadCpuEntry>& entry) {
+			uint64_t final_ns = entry->mClock.ReadNs();
+			std::lock_guard<std::mutex> local_lock(mEntries_mtx);
+			auto found = std::find(mEntries.begin(), mEntries.end(), entry);
+			if (found != mEntries.end()) {
+				mEntries.erase(found);
+			}
+
+			// the window is gone once its last thread unregisters
+			bool window_alive = std::any_of(mEntries.begin(), mEntries.end(), [&entry](const auto& other) {
+				return other->mWindowHandle == entry->mWindowHandle;
+			});
+			if (!window_alive) {
+				mRetired.erase(entry->mWindowHandle);
+				return;
+			}
+
+			auto& retired = mRetired[entry->mWindowHandle];
+			retired.mWindowHandle = entry->mWindowHandle;
+			(entry->mRole == ThreadRole::UI ? retired.mUiNs : retired.mLogicNs) += final_ns;
+		}
+
+		// reads every live thread, one entry per window with at least one live thread
+		std::vector<WindowCpuTime> Sample() {
+			std::lock_guard<std::mutex> local_lock(mEntries_mtx);
+			std::unordered_map<HWND, WindowCpuTime> windows;
+			for (auto& entry : mEntries) {
+				uint64_t ns = entry->mClock.ReadNs();
+				entry->mLastNs.store(ns, std::memory_order_relaxed);
+
+				auto& window = windows[entry->mWindowHandle];
+				window.mWindowHandle = entry->mWindowHandle;
+				(entry->mRole == ThreadRole::UI ? window.mUiNs : window.mLogicNs) += ns;
+				window.mThreads++;
+			}
+
+			std::vector<WindowCpuTime> sample;
+			sample.reserve(windows.size());
+			for (auto& [handle, window] : windows) {
+				auto retired = mRetired.find(handle);
+				if (retired != mRetired.end()) {
+					window.mUiNs += retired->second.mUiNs;
+					window.mLogicNs += retired->second.mLogicNs;
+				}
+				sample.push_back(window);
+			}
+
+			// busiest window first
+			std::sort(sample.begin(), sample.end(), [](const WindowCpuTime& a, const WindowCpuTime& b) {
+				return a.TotalNs() > b.TotalNs();
+			});
+			return sample;
+		}
+
+		// one line per window with its CPU usage since the previous summary
+		std::wstring Summary() {
+			auto sample = Sample();
+			auto now = std::chrono::steady_clock::now();
+
+			std::lock_guard<std::mutex> local_lock(mSummary_mtx);
+			double wall_ns = mLastSummaryAt.time_since_epoch().count() == 0 ? 0.0 :
+				std::chrono::duration<double, std::nano>(now - mLastSummaryAt).count();
+
+			std::wstring summary{ L"CPU time per window:\n" };
+			std::unordered_map<HWND, uint64_t> totals;
+			for (const auto& window : sample) {
+				uint64_t previous = 0;
+				auto found = mLastTotals.find(window.mWindowHandle);
+				if (found != mLastTotals.end()) previous = found->second;
+
+				double percent = wall_ns > 0.0 ? 100.0 * (double)(window.TotalNs() - std::min(previous, window.TotalNs())) / wall_ns : 0.0;
+				summary += std::format(L"  window {} threads={} ui={:.1f}ms logic={:.1f}ms recent={:.1f}% of a core\n",
+					(const void*)window.mWindowHandle, window.mThreads,
+					window.mUiNs / 1e6, window.mLogicNs / 1e6, percent);
+
+				totals[window.mWindowHandle] = window.TotalNs();
+			}
+
+			mLastTotals = std::move(totals);
+			mLastSummaryAt = now;
+			return summary;
+		}
+
+		// calls report with Summary() every interval on a background thread
+		void StartPeriodicSummary(std::chrono::milliseconds interval, std::function<void(const std::wstring&)> report) {
+			StopPeriodicSummary();
+			std::lock_guard<std::mutex> local_lock(mPeriodic_mtx);
+			mStopPeriodic = false;
+			mPeriodicThread = std::thread([this, interval, report]() {
+				std::unique_lock<std::mutex> periodic_lock(mPeriodic_mtx);
+				while (!mStopPeriodic) {
+					if (mPeriodic_cv.wait_for(periodic_lock, interval, [this] { return mStopPeriodic; })) break;
+					periodic_lock.unlock();
+					report(Summary());
+					periodic_lock.lock();
+				}
+			});
+		}
+
+		void StopPeriodicSummary() {
+			{
+				std::lock_guard<std::mutex> local_lock(mPeriodic_mtx);
+				mStopPeriodic = true;
+			}
+			mPeriodic_cv.notify_one();
+			if (mPeriodicThread.joinable()) mPeriodicThread.join();
+		}
+
+		// CPU time of the calling thread only, for per tick use: no handle is duplicated or closed
+		// uses getrusage(RUSAGE_THREAD) on Linux and GetThreadTimes on the pseudo handle on Windows
+		static uint64_t CurrentThreadNs() {
+#ifdef _WIN32
+			FILETIME creation{}, exit{}, kernel{}, user{};
+			if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) return 0;
+
+			// FILETIME counts 100 ns intervals
+			auto to_ns = [](const FILETIME& ft) {
+				return ((((uint64_t)ft.dwHighDateTime) << 32) | ft.dwLowDateTime) * 100;
+			};
+			return to_ns(kernel) + to_ns(user);
+#else
+			rusage usage{};
+			if (getrusage(RUSAGE_THREAD, &usage) != 0) return 0;
+			auto to_ns = [](const timeval& tv) {
+				return (uint64_t)tv.tv_sec * 1'000'000'000ull + (uint64_t)tv.tv_usec * 1000ull;
+			};
+			return to_ns(usage.ru_utime) + to_ns(usage.ru_stime);
+#endif
+		}
+
+	private:
+		std::mutex mEntries_mtx;
+		std::vector<std::shared_ptr<ThreadCpuEntry>> mEntries;
+
+		// CPU time of threads that already exited, by window
+		std::unordered_map<HWND, WindowCpuTime> mRetired;
+
+		// the previous summary, used to work out recent usage
+		std::mutex mSummary_mtx;
+		std::unordered_map<HWND, uint64_t> mLastTotals;
+		std::chrono::steady_clock::time_point mLastSummaryAt{};
+
+		std::mutex mPeriodic_mtx;
+		std::condition_variable mPeriodic_cv;
+		bool mStopPeriodic{ false };
+		std::thread mPeriodicThread;
+	};
+}
@@ -0,0 +1,186 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include "Framebuffer.hpp"
+#include "TiledRaster.hpp"
+
+namespace WMTS {
+	// a set of at most MaxRects rectangles that covers every changed pixel, possibly more
+	// a rectangle that would go over the limit is merged with the one whose union grows the covered area least
+	class DamageRegion {
+	public:
+		static constexpr size_t MaxRects = 8;
+
+		void Reset(uint32_t width, uint32_t height) {
+			mFrame = PixelRect{ 0, 0, (int32_t)width, (int32_t)height };
+			mCount = 0;
+			mFull = false;
+		}
+
+		void Add(const PixelRect& rect) {
+			if (mFull) return;
+			PixelRect clipped = rect.Intersect(mFrame);
+			if (clipped.Empty()) return;
+
+			for (size_t i{}; i < mCount; i++) {
+				if (Contains(mRects[i], clipped)) return;
+			}
+			mRects[mCount++] = clipped;
+			if (mCount > MaxRects) MergeCheapestPair();
+
+			// past half the frame a single full rectangle costs about the same and keeps the blits simple
+			if (Area() * 2 > AreaOf(mFrame)) AddAll();
+		}
+
+		void AddAll() {
+			mFull = true;
+			mCount = 0;
+			if (!mFrame.Empty()) mRects[mCount++] = mFrame;
+		}
+
+		void Add(const DamageRegion& other) {
+			if (other.mFull) {
+				AddAll();
+				return;
+			}
+			for (size_t i{}; i < other.mCount; i++) Add(other.mRects[i]);
+		}
+
+		bool Empty() const { return mCount == 0; }
+		bool Full() const { return mFull; }
+		size_t Count() const { return mCount; }
+		const PixelRect& operator[](size_t index) const { return mRects[index]; }
+
+		// the rectangles themselves, for APIs that take an array
+		const PixelRect* Rects() const { return mRects.data(); }
+
+		// pixels covered, counted twice where a merge left rectangles overlapping
+		uint64_t Area() const {
+			uint64_t area = 0;
+			for (size_t i{}; i < mCount; i++) area += AreaOf(mRects[i]);
+			return area;
+		}
+
+		static uint64_t AreaOf(const PixelRect& rect) {
+			return rect.Empty() ? 0 : (uint64_t)(rect.mRight - rect.mLeft) * (uint64_t)(rect.mBottom - rect.mTop);
+		}
+
+	private:
+		static bool Contains(const PixelRect& outer, const PixelRect& inner) {
+			return outer.mLeft <= inner.mLeft && outer.mTop <= inner.mTop && outer.mRight >= inner.mRight && outer.mBottom >= inner.mBottom;
+		}
+
+		static PixelRect Union(const PixelRect& a, const PixelRect& b) {
+			return PixelRect{ std::min(a.mLeft, b.mLeft), std::min(a.mTop, b.mTop), std::max(a.mRight, b.mRight), std::max(a.mBottom, b.mBottom) };
+		}
+
+		void MergeCheapestPair() {
+			size_t best_a = 0, best_b = 1;
+			uint64_t best_growth = UINT64_MAX;
+			for (size_t a{}; a < mCount; a++) {
+				for (size_t b = a + 1; b < mCount; b++) {
+					uint64_t merged = AreaOf(Union(mRects[a], mRects[b]));
+					uint64_t separate = AreaOf(mRects[a]) + AreaOf(mRects[b]);
+					uint64_t growth = merged > separate ? merged - separate : 0;
+					if (growth < best_growth) {
+						best_growth = growth;
+						best_a = a;
+						best_b = b;
+					}
+				}
+			}
+			mRects[best_a] = Union(mRects[best_a], mRects[best_b]);
+			mRects[best_b] = mRects[--mCount];
+		}
+
+		PixelRect mFrame{};
+		// one spare slot for the rectangle that triggers a merge
+		std::array<PixelRect, MaxRects + 1> mRects{};
+		size_t mCount{};
+		bool mFull{ false };
+	};
+
+	// finds what changed between a window's frames
+	// a frame's damage is every command that differs from the previous frame's command at the same position
+	// (both the old and the new rectangle), plus whatever the frame marked with DrawList::Invalidate()
+	// a back buffer that is several frames old needs the damage of each of those frames,
+	// so the damage of the last few published frames is kept
+	class DamageTracker {
+	public:
+		static constexpr size_t History = 4;
+
+		// this frame's damage against the previous list, stores list as the new previous list
+		const DamageRegion& Compute(const DrawList& list) {
+			mCurrent.Reset(list.Width(), list.Height());
+
+			if (list.Width() != mWidth || list.Height() != mHeight || list.InvalidatedAll()) {
+				mCurrent.AddAll();
+			}
+			else {
+				const auto& commands = list.Commands();
+				size_t common = std::min(commands.size(), mPrevious.size());
+				for (size_t i{}; i < common && !mCurrent.Full(); i++) {
+					if (!Same(commands[i], mPrevious[i])) {
+						mCurrent.Add(commands[i].mRect);
+						mCurrent.Add(mPrevious[i].mRect);
+					}
+				}
+				for (size_t i = common; i < commands.size(); i++) mCurrent.Add(commands[i].mRect);
+				for (size_t i = common; i < mPrevious.size(); i++) mCurrent.Add(mPrevious[i].mRect);
+				for (const PixelRect& rect : list.Invalidated()) mCurrent.Add(rect);
+			}
+
+			mWidth = list.Width();
+			mHeight = list.Height();
+			mPrevious.clear();
+			for (const DrawCommand& command : list.Commands()) {
+				detail::GrowIfFull(mPrevious);
+				mPrevious.push_back(command);
+			}
+			return mCurrent;
+		}
+
+		// records the damage of the frame just computed as published frame number FrameNumber
+		void Publish(uint64_t FrameNumber) {
+			mHistory[FrameNumber % History] = mCurrent;
+			mHistoryFrame[FrameNumber % History] = FrameNumber;
+		}
+
+		// what a buffer holding published frame ContentFrame must redraw to become frame FrameNumber
+		// full when the buffer holds nothing or is older than the history
+		void Accumulate(uint64_t ContentFrame, uint64_t FrameNumber, DamageRegion& region) const {
+			region.Reset(mWidth, mHeight);
+			if (ContentFrame == 0 || FrameNumber <= ContentFrame || FrameNumber - ContentFrame > History) {
+				region.AddAll();
+				return;
+			}
+			region.Add(mCurrent);
+			for (uint64_t frame = ContentFrame + 1; frame < FrameNumber; frame++) {
+				if (mHistoryFrame[frame % History] != frame) {
+					region.AddAll();
+					return;
+				}
+				region.Add(mHistory[frame % History]);
+			}
+		}
+
+	private:
+		static bool Same(const DrawCommand& a, const DrawCommand& b) {
+			return a.mOp == b.mOp && a.mColor == b.mColor && a.mSource == b.mSource &&
+				a.mSourceX == b.mSourceX && a.mSourceY == b.mSourceY &&
+				a.mRect.mLeft == b.mRect.mLeft && a.mRect.mTop == b.mRect.mTop &&
+				a.mRect.mRight == b.mRect.mRight && a.mRect.mBottom == b.mRect.mBottom;
+		}
+
+		uint32_t mWidth{};
+		uint32_t mHeight{};
+		std::vector<DrawCommand> mPrevious;
+		DamageRegion mCurrent;
+
+		std::array<DamageRegion, History> mHistory{};
+		std::array<uint64_t, History> mHistoryFrame{};
+	};
+}
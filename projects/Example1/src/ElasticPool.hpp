@@ -0,0 +1,327 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <string>
+#include <format>
+#include <algorithm>
+#include "Histogram.hpp"
+#include "Trace.hpp"
+
+namespace WMTS {
+	struct ElasticPoolConfig {
+		// workers kept alive even when idle, started up front by Start()
+		size_t mMinWorkers{ 0 };
+
+		// a request that finds no idle worker gets a new one right away up to this many workers
+		size_t mSoftMaxWorkers{ std::max(2u, std::thread::hardware_concurrency()) - 1 };
+
+		// past the soft limit a request waits, and only gets a new worker once it has waited mGrowAfter
+		// at the hard limit requests wait for a worker to become free
+		size_t mMaxWorkers{ 64 };
+
+		// requests that may wait at the hard limit, one more is rejected, 0 rejects there right away
+		size_t mMaxPending{ 64 };
+
+		std::chrono::milliseconds mGrowAfter{ 100 };
+
+		// an idle worker above mMinWorkers exits after this long without work
+		std::chrono::milliseconds mIdleTimeout{ 30000 };
+	};
+
+	// a copy of the pool's state and of every decision it made
+	struct ElasticPoolMetrics {
+		size_t mWorkers{};
+		size_t mIdleWorkers{};
+		size_t mBusyWorkers{};
+		size_t mPending{};
+		size_t mPeakWorkers{};
+
+		// every Submit() and what it led to
+		uint64_t mRequests{};
+		uint64_t mHandedToIdle{};
+		uint64_t mSpawned{};
+		uint64_t mQueued{};
+
+		// after Shutdown(), or at the hard limit with mMaxPending requests already waiting
+		uint64_t mRejected{};
+
+		// workers started for requests that waited past mGrowAfter
+		uint64_t mSpawnedOnDelay{};
+
+		// idle workers that exited after mIdleTimeout
+		uint64_t mRetired{};
+
+		// the spawn callback threw, the request stays queued
+		uint64_t mSpawnFailures{};
+
+		// time from Submit() until a worker picked the request up
+		LatencyHistogram::Snapshot mQueueDelay;
+
+		std::wstring Report() const {
+			return std::format(L"Window thread pool:\n"
+				L"  workers={} idle={} busy={} pending={} peak={}\n"
+				L"  requests={} to idle worker={} new worker={} queued={} rejected={}\n"
+				L"  grown on queue delay={} retired idle={} spawn failures={}\n"
+				L"  queue delay {}\n",
+				mWorkers, mIdleWorkers, mBusyWorkers, mPending, mPeakWorkers,
+				mRequests, mHandedToIdle, mSpawned, mQueued, mRejected,
+				mSpawnedOnDelay, mRetired, mSpawnFailures,
+				mQueueDelay.Summary());
+		}
+	};
+
+	// what Submit() did with a job
+	enum class SubmitResult {
+		// an idle or a new worker took it
+		ACCEPTED,
+
+		// it waits, for a new worker after mGrowAfter or at the hard limit for a worker to become free
+		QUEUED,
+
+		// Shutdown() was called
+		STOPPED,
+
+		// every worker is busy at mMaxWorkers and mMaxPending requests are already waiting
+		FULL
+	};
+
+	// runs jobs on a set of worker threads that grows with load and shrinks when idle
+	// the pool does not create threads itself, Start() is given a callback that must start
+	// a thread running the function it is passed, so the owner decides stack size, placement and bookkeeping
+	class ElasticPool {
+	public:
+		using Job = std::function<void()>;
+		using SpawnWorker = std::function<void(std::function<void()> worker)>;
+
+		explicit ElasticPool(const ElasticPoolConfig& config = {}) {
+			SetConfig(config);
+		}
+
+		~ElasticPool() {
+			Shutdown();
+		}
+
+		ElasticPool(const ElasticPool&) = delete;
+		ElasticPool& operator=(const ElasticPool&) = delete;
+
+		// call before Start()
+		void SetConfig(const ElasticPoolConfig& config) {
+			std::lock_guard<std::mutex> local_lock(mPool_mtx);
+			mConfig = config;
+			mConfig.mMaxWorkers = std::max<size_t>(mConfig.mMaxWorkers, 1);
+			mConfig.mSoftMaxWorkers = std::min(mConfig.mSoftMaxWorkers, mConfig.mMaxWorkers);
+			mConfig.mMinWorkers = std::min(mConfig.mMinWorkers, mConfig.mMaxWorkers);
+		}
+
+		// starts mMinWorkers workers and the thread that grows the pool on queueing delay
+		void Start(SpawnWorker spawn) {
+			std::lock_guard<std::mutex> local_lock(mPool_mtx);
+			mSpawn = std::move(spawn);
+			mStopping = false;
+			while (mWorkers < mConfig.mMinWorkers) {
+				if (!SpawnLocked()) break;
+			}
+			mManager = std::thread(&ElasticPool::ManagerLoop, this);
+		}
+
+		// hands a job to an idle or new worker, or queues it
+		SubmitResult Submit(Job job) {
+			std::lock_guard<std::mutex> local_lock(mPool_mtx);
+			if (mStopping) {
+				mRejected++;
+				return SubmitResult::STOPPED;
+			}
+
+			mRequests++;
+			mPending.push_back(Request{ std::move(job), std::chrono::steady_clock::now() });
+
+			if (mPending.size() <= mIdle) {
+				mHandedToIdle++;
+				mWork_cv.notify_one();
+				WMTS_TRACE_INSTANT("pool: to idle worker");
+			}
+			else if (mWorkers < mConfig.mSoftMaxWorkers && SpawnLocked()) {
+				mSpawned++;
+				WMTS_TRACE_INSTANT("pool: new worker");
+			}
+			else if (mWorkers >= mConfig.mMaxWorkers && mPending.size() - mIdle > mConfig.mMaxPending) {
+				mPending.pop_back();
+				mRejected++;
+				WMTS_TRACE_INSTANT("pool: rejected at the hard limit");
+				return SubmitResult::FULL;
+			}
+			else {
+				mQueued++;
+				mManager_cv.notify_one();
+				WMTS_TRACE_INSTANT("pool: queued");
+				return SubmitResult::QUEUED;
+			}
+			return SubmitResult::ACCEPTED;
+		}
+
+		// true when no job is running or waiting
+		bool Idle() {
+			std::lock_guard<std::mutex> local_lock(mPool_mtx);
+			return mBusy == 0 && mPending.empty();
+		}
+
+		// blocks until no job is running or waiting
+		void WaitIdle() {
+			std::unique_lock<std::mutex> pool_lock(mPool_mtx);
+			mIdle_cv.wait(pool_lock, [this] { return mBusy == 0 && mPending.empty(); });
+		}
+
+		// rejects new jobs and tells idle workers to exit, busy workers exit after their job
+		// jobs still waiting are dropped, call it once Idle() is true to run everything
+		// does not wait for the workers, the owner tracks its threads
+		void Shutdown() {
+			{
+				std::lock_guard<std::mutex> local_lock(mPool_mtx);
+				mStopping = true;
+			}
+			mWork_cv.notify_all();
+			mManager_cv.notify_all();
+			if (mManager.joinable()) mManager.join();
+		}
+
+		// safe to call from any thread
+		ElasticPoolMetrics Metrics() {
+			std::lock_guard<std::mutex> local_lock(mPool_mtx);
+			ElasticPoolMetrics metrics;
+			metrics.mWorkers = mWorkers;
+			metrics.mIdleWorkers = mIdle;
+			metrics.mBusyWorkers = mBusy;
+			metrics.mPending = mPending.size();
+			metrics.mPeakWorkers = mPeakWorkers;
+			metrics.mRequests = mRequests;
+			metrics.mHandedToIdle = mHandedToIdle;
+			metrics.mSpawned = mSpawned;
+			metrics.mQueued = mQueued;
+			metrics.mRejected = mRejected;
+			metrics.mSpawnedOnDelay = mSpawnedOnDelay;
+			metrics.mRetired = mRetired;
+			metrics.mSpawnFailures = mSpawnFailures;
+			metrics.mQueueDelay = mQueueDelay.Read();
+			return metrics;
+		}
+
+	private:
+		struct Request {
+			Job mJob;
+			std::chrono::steady_clock::time_point mSubmitted;
+		};
+
+		// mPool_mtx must be held
+		// the new worker blocks on mPool_mtx until the caller releases it, so the spawn callback
+		// can finish its bookkeeping before the worker takes a job
+		bool SpawnLocked() {
+			if (!mSpawn) return false;
+			mWorkers++;
+			try {
+				mSpawn([this] { WorkerLoop(); });
+			}
+			catch (...) {
+				mWorkers--;
+				mSpawnFailures++;
+				return false;
+			}
+			mPeakWorkers = std::max(mPeakWorkers, mWorkers);
+			return true;
+		}
+
+		void WorkerLoop() {
+			std::unique_lock<std::mutex> pool_lock(mPool_mtx);
+			while (true) {
+				mIdle++;
+				bool woken = mWork_cv.wait_for(pool_lock, mConfig.mIdleTimeout, [this] { return mStopping || !mPending.empty(); });
+				mIdle--;
+
+				if (!mPending.empty() && !mStopping) {
+					Request request = std::move(mPending.front());
+					mPending.pop_front();
+					mQueueDelay.Record((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+						std::chrono::steady_clock::now() - request.mSubmitted).count());
+
+					mBusy++;
+					pool_lock.unlock();
+					request.mJob();
+					request.mJob = nullptr;
+					pool_lock.lock();
+					mBusy--;
+					if (mBusy == 0 && mPending.empty()) mIdle_cv.notify_all();
+					continue;
+				}
+
+				if (mStopping || (!woken && mWorkers > mConfig.mMinWorkers)) {
+					if (!mStopping) {
+						mRetired++;
+						WMTS_TRACE_INSTANT("pool: retired idle worker");
+					}
+					mWorkers--;
+					return;
+				}
+			}
+		}
+
+		// grows the pool past the soft limit for requests that waited longer than mGrowAfter
+		void ManagerLoop() {
+			std::unique_lock<std::mutex> pool_lock(mPool_mtx);
+			while (!mStopping) {
+				if (mPending.size() <= mIdle) {
+					mManager_cv.wait(pool_lock, [this] { return mStopping || mPending.size() > mIdle; });
+					continue;
+				}
+
+				// the oldest request is at the front
+				auto due = mPending.front().mSubmitted + mConfig.mGrowAfter;
+				if (std::chrono::steady_clock::now() < due) {
+					mManager_cv.wait_until(pool_lock, due);
+					continue;
+				}
+
+				if (mWorkers < mConfig.mMaxWorkers && SpawnLocked()) {
+					mSpawnedOnDelay++;
+					WMTS_TRACE_INSTANT("pool: grown on queue delay");
+
+					// let the new worker take the request before looking again
+					mManager_cv.wait_for(pool_lock, mConfig.mGrowAfter);
+				}
+				else {
+					// at the hard limit, or the spawn failed, a finishing job or a retry frees a worker
+					mManager_cv.wait_for(pool_lock, mConfig.mGrowAfter);
+				}
+			}
+		}
+
+		std::mutex mPool_mtx;
+		std::condition_variable mWork_cv;
+		std::condition_variable mManager_cv;
+		std::condition_variable mIdle_cv;
+
+		ElasticPoolConfig mConfig;
+		SpawnWorker mSpawn;
+		std::thread mManager;
+		bool mStopping{ false };
+
+		std::deque<Request> mPending;
+		size_t mWorkers{};
+		size_t mIdle{};
+		size_t mBusy{};
+		size_t mPeakWorkers{};
+
+		uint64_t mRequests{};
+		uint64_t mHandedToIdle{};
+		uint64_t mSpawned{};
+		uint64_t mQueued{};
+		uint64_t mRejected{};
+		uint64_t mSpawnedOnDelay{};
+		uint64_t mRetired{};
+		uint64_t mSpawnFailures{};
+		LatencyHistogram mQueueDelay;
+	};
+}
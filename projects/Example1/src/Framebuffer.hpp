@@ -0,0 +1,223 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <climits>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <filesystem>
+#include "RasterKernels.hpp"
+#include "SurfacePool.hpp"
+
+namespace WMTS {
+	// 0x00RRGGBB, in memory the bytes are B, G, R, X which is what a 32 bit DIB expects
+	constexpr uint32_t PackColor(uint8_t r, uint8_t g, uint8_t b) {
+		return ((uint32_t)r << 16) | ((uint32_t)g << 8) | (uint32_t)b;
+	}
+
+	// a rectangle in pixels, right and bottom are exclusive
+	struct PixelRect {
+		int32_t mLeft{};
+		int32_t mTop{};
+		int32_t mRight{};
+		int32_t mBottom{};
+
+		bool Empty() const { return mLeft >= mRight || mTop >= mBottom; }
+
+		PixelRect Intersect(const PixelRect& other) const {
+			return PixelRect{ std::max(mLeft, other.mLeft), std::max(mTop, other.mTop),
+				std::min(mRight, other.mRight), std::min(mBottom, other.mBottom) };
+		}
+
+		// the rectangle at x, y with the given size, saturated so huge sizes do not wrap
+		static PixelRect FromSize(int32_t x, int32_t y, int32_t width, int32_t height) {
+			return PixelRect{ x, y,
+				(int32_t)std::clamp<int64_t>((int64_t)x + width, INT32_MIN, INT32_MAX),
+				(int32_t)std::clamp<int64_t>((int64_t)y + height, INT32_MIN, INT32_MAX) };
+		}
+
+		// no clipping beyond the buffer's own edges
+		static constexpr PixelRect Everything() {
+			return PixelRect{ INT32_MIN, INT32_MIN, INT32_MAX, INT32_MAX };
+		}
+	};
+
+	// a CPU pixel buffer of 32 bit pixels, rows top to bottom with no padding
+	// the pixels live in a block from the SurfacePool, so resizing rarely allocates
+	// drawing calls clip to the buffer and to an optional Bounds rectangle, a tile when rendering in parallel,
+	// and run on the RasterKernels picked for this CPU, nothing here touches the OS
+	class Framebuffer {
+	public:
+		Framebuffer() = default;
+
+		// changes the size, keeps the block when the new size fits in it
+		// a larger block comes with the pool's slack, so a window dragged larger only allocates every few steps
+		// the pixels are undefined afterwards, the next frame is expected to clear them
+		// returns true if a new block was taken
+		bool Resize(uint32_t width, uint32_t height) {
+			if (width == mWidth && height == mHeight) return false;
+			SurfacePool::Get().CountResize();
+			mWidth = width;
+			mHeight = height;
+			size_t needed = (size_t)width * height;
+			if (needed <= mPixels.Capacity()) return false;
+			// give the old block back first so the pool can hand it to another window
+			mPixels = PixelBlock{};
+			mPixels = PixelBlock(needed);
+			return true;
+		}
+
+		// moves the pixels to a block without the growth slack, call it once the size has settled
+		// the pixels are kept, returns true if the buffer moved
+		bool Trim() {
+			size_t needed = (size_t)mWidth * mHeight;
+			if (mPixels.Capacity() <= SurfacePool::Get().SettledCapacity(needed)) return false;
+			PixelBlock smaller(needed, true);
+			if (needed) std::memcpy(smaller.Data(), mPixels.Data(), needed * sizeof(uint32_t));
+			mPixels = std::move(smaller);
+			SurfacePool::Get().CountShrink();
+			return true;
+		}
+
+		// pixels the block holds, at least Width() * Height()
+		size_t Capacity() const { return mPixels.Capacity(); }
+
+		uint32_t Width() const { return mWidth; }
+		uint32_t Height() const { return mHeight; }
+
+		// pixels per row
+		uint32_t Stride() const { return mWidth; }
+
+		bool Empty() const { return mWidth == 0 || mHeight == 0; }
+
+		// the whole buffer as a rectangle
+		PixelRect Area() const { return PixelRect{ 0, 0, (int32_t)mWidth, (int32_t)mHeight }; }
+
+		uint32_t* Pixels() { return mPixels.Data(); }
+		const uint32_t* Pixels() const { return mPixels.Data(); }
+
+		uint32_t* Row(uint32_t y) { return mPixels.Data() + (size_t)y * Stride(); }
+		const uint32_t* Row(uint32_t y) const { return mPixels.Data() + (size_t)y * Stride(); }
+
+		// bytes in use, not the allocation
+		size_t Bytes() const { return (size_t)mWidth * mHeight * sizeof(uint32_t); }
+
+		void Clear(uint32_t color) {
+			RasterKernels::Get().Fill(mPixels.Data(), (size_t)mWidth * mHeight, color);
+		}
+
+		// fills the rectangle at x, y, clipped to the buffer
+		void FillRect(int32_t x, int32_t y, int32_t width, int32_t height, uint32_t color, const PixelRect& Bounds = PixelRect::Everything()) {
+			PixelRect clip = ClipTo(x, y, width, height, Bounds);
+			if (clip.Empty()) return;
+
+			const RasterKernelTable& kernels = RasterKernels::Get();
+			for (int32_t row = clip.mTop; row < clip.mBottom; row++) {
+				kernels.Fill(Row(row) + clip.mLeft, (size_t)(clip.mRight - clip.mLeft), color);
+			}
+		}
+
+		// copies source with its top left corner at x, y, clipped to the buffer
+		void Blit(const Framebuffer& source, int32_t x, int32_t y, const PixelRect& Bounds = PixelRect::Everything()) {
+			Blit(source, source.Area(), x, y, Bounds);
+		}
+
+		// copies the SourceRect part of source with its top left corner at x, y, an atlas entry for example
+		void Blit(const Framebuffer& source, const PixelRect& SourceRect, int32_t x, int32_t y, const PixelRect& Bounds = PixelRect::Everything()) {
+			PixelRect part = SourceRect.Intersect(source.Area());
+			x += part.mLeft - SourceRect.mLeft;
+			y += part.mTop - SourceRect.mTop;
+			PixelRect clip = ClipTo(x, y, part.mRight - part.mLeft, part.mBottom - part.mTop, Bounds);
+			if (part.Empty() || clip.Empty()) return;
+
+			const RasterKernelTable& kernels = RasterKernels::Get();
+			for (int32_t row = clip.mTop; row < clip.mBottom; row++) {
+				kernels.Copy(Row(row) + clip.mLeft, source.Row(row - y + part.mTop) + (clip.mLeft - x + part.mLeft), (size_t)(clip.mRight - clip.mLeft));
+			}
+		}
+
+		// composites premultiplied source over this buffer with its top left corner at x, y
+		void BlendOver(const Framebuffer& source, int32_t x, int32_t y, const PixelRect& Bounds = PixelRect::Everything()) {
+			BlendOver(source, source.Area(), x, y, Bounds);
+		}
+
+		// composites the SourceRect part of premultiplied source over this buffer with its top left corner at x, y
+		void BlendOver(const Framebuffer& source, const PixelRect& SourceRect, int32_t x, int32_t y, const PixelRect& Bounds = PixelRect::Everything()) {
+			PixelRect part = SourceRect.Intersect(source.Area());
+			x += part.mLeft - SourceRect.mLeft;
+			y += part.mTop - SourceRect.mTop;
+			PixelRect clip = ClipTo(x, y, part.mRight - part.mLeft, part.mBottom - part.mTop, Bounds);
+			if (part.Empty() || clip.Empty()) return;
+
+			const RasterKernelTable& kernels = RasterKernels::Get();
+			for (int32_t row = clip.mTop; row < clip.mBottom; row++) {
+				kernels.Blend(Row(row) + clip.mLeft, source.Row(row - y + part.mTop) + (clip.mLeft - x + part.mLeft), (size_t)(clip.mRight - clip.mLeft));
+			}
+		}
+
+		// stretches source onto the rectangle at x, y with nearest neighbour sampling
+		// source sides are limited to 32767 pixels so the 16.16 positions fit in 32 bits
+		void BlitScaled(const Framebuffer& source, int32_t x, int32_t y, int32_t width, int32_t height, const PixelRect& Bounds = PixelRect::Everything()) {
+			if (source.Empty() || width <= 0 || height <= 0) return;
+			PixelRect clip = ClipTo(x, y, width, height, Bounds);
+			if (clip.Empty()) return;
+
+			uint32_t step_x = (uint32_t)(((uint64_t)std::min<uint32_t>(source.Width(), 32767) << 16) / (uint32_t)width);
+			uint32_t step_y = (uint32_t)(((uint64_t)std::min<uint32_t>(source.Height(), 32767) << 16) / (uint32_t)height);
+			uint32_t start_x = (uint32_t)(clip.mLeft - x) * step_x;
+
+			const RasterKernelTable& kernels = RasterKernels::Get();
+			for (int32_t row = clip.mTop; row < clip.mBottom; row++) {
+				uint32_t source_row = ((uint32_t)(row - y) * step_y) >> 16;
+				kernels.Scale(Row(row) + clip.mLeft, (size_t)(clip.mRight - clip.mLeft), source.Row(source_row), start_x, step_x);
+			}
+		}
+
+	private:
+		PixelRect ClipTo(int32_t x, int32_t y, int32_t width, int32_t height, const PixelRect& Bounds) const {
+			return PixelRect::FromSize(x, y, width, height).Intersect(Area()).Intersect(Bounds);
+		}
+
+		uint32_t mWidth{};
+		uint32_t mHeight{};
+		PixelBlock mPixels;
+	};
+
+	// writes the buffer as a top down 32 bit BMP, returns false if the file could not be written
+	inline bool WriteBmp(const std::filesystem::path& path, const Framebuffer& frame) {
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if (!file) return false;
+
+		auto put16 = [&file](uint16_t value) {
+			char bytes[2] = { (char)(value & 0xFF), (char)(value >> 8) };
+			file.write(bytes, 2);
+		};
+		auto put32 = [&file](uint32_t value) {
+			char bytes[4] = { (char)(value & 0xFF), (char)((value >> 8) & 0xFF), (char)((value >> 16) & 0xFF), (char)(value >> 24) };
+			file.write(bytes, 4);
+		};
+
+		// BITMAPFILEHEADER, 14 bytes
+		uint32_t headers = 14 + 40;
+		put16(0x4D42);
+		put32(headers + (uint32_t)frame.Bytes());
+		put32(0);
+		put32(headers);
+
+		// BITMAPINFOHEADER, 40 bytes, a negative height means rows are stored top to bottom
+		put32(40);
+		put32(frame.Width());
+		put32((uint32_t)-(int32_t)frame.Height());
+		put16(1);
+		put16(32);
+		put32(0);
+		put32((uint32_t)frame.Bytes());
+		put32(2835);
+		put32(2835);
+		put32(0);
+		put32(0);
+
+		file.write(reinterpret_cast<const char*>(frame.Pixels()), (std::streamsize)frame.Bytes());
+		return (bool)file;
+	}
+}
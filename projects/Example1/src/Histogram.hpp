@@ -0,0 +1,127 @@
+#pragma once
+#include <atomic>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <string>
+#include <format>
+#include <algorithm>
+
+namespace WMTS {
+	// a lock free HDR style histogram for nanosecond durations
+	// values are bucketed log-linear: every power of two is split into 4 sub buckets
+	// so the relative error of a reported percentile is at most 25%
+	// Record() can be called from any thread, Snapshot() can be called from any thread
+	class LatencyHistogram {
+	public:
+		// 2 bits of sub bucket precision per power of two
+		static constexpr unsigned SubBucketBits = 2;
+		static constexpr unsigned SubBuckets = 1u << SubBucketBits;
+		static constexpr size_t BucketCount = 64 * SubBuckets;
+
+		// a plain copy of the histogram, safe to inspect without touching the atomics
+		struct Snapshot {
+			std::array<uint64_t, BucketCount> buckets{};
+			uint64_t count{};
+			uint64_t sum{};
+			uint64_t max{};
+
+			// returns the upper bound of the bucket that contains the p-th percentile (0.0 - 100.0)
+			uint64_t Percentile(double p) const {
+				if (count == 0) return 0;
+				p = std::clamp(p, 0.0, 100.0);
+				uint64_t target = (uint64_t)((p / 100.0) * (double)count);
+				if (target == 0) target = 1;
+
+				uint64_t seen = 0;
+				for (size_t i{}; i < BucketCount; i++) {
+					seen += buckets[i];
+					if (seen >= target) {
+						return std::min(BucketUpperBound(i), max);
+					}
+				}
+				return max;
+			}
+
+			uint64_t Mean() const {
+				return count ? sum / count : 0;
+			}
+
+			// adds another histogram's counts, used to total the histograms of closed windows
+			Snapshot& operator+=(const Snapshot& other) {
+				for (size_t i{}; i < BucketCount; i++) {
+					buckets[i] += other.buckets[i];
+				}
+				count += other.count;
+				sum += other.sum;
+				max = std::max(max, other.max);
+				return *this;
+			}
+
+			// short one line summary in microseconds, used by the stats dumps
+			std::wstring Summary() const {
+				return std::format(L"n={} mean={:.2f}us p50={:.2f}us p99={:.2f}us p99.9={:.2f}us max={:.2f}us",
+					count,
+					Mean() / 1000.0,
+					Percentile(50.0) / 1000.0,
+					Percentile(99.0) / 1000.0,
+					Percentile(99.9) / 1000.0,
+					max / 1000.0);
+			}
+		};
+
+		void Record(uint64_t value) {
+			mBuckets[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+			mCount.fetch_add(1, std::memory_order_relaxed);
+			mSum.fetch_add(value, std::memory_order_relaxed);
+
+			uint64_t current = mMax.load(std::memory_order_relaxed);
+			while (value > current && !mMax.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+			}
+		}
+
+		Snapshot Read() const {
+			Snapshot s;
+			for (size_t i{}; i < BucketCount; i++) {
+				s.buckets[i] = mBuckets[i].load(std::memory_order_relaxed);
+			}
+			s.count = mCount.load(std::memory_order_relaxed);
+			s.sum = mSum.load(std::memory_order_relaxed);
+			s.max = mMax.load(std::memory_order_relaxed);
+			return s;
+		}
+
+		void Reset() {
+			for (auto& bucket : mBuckets) {
+				bucket.store(0, std::memory_order_relaxed);
+			}
+			mCount.store(0, std::memory_order_relaxed);
+			mSum.store(0, std::memory_order_relaxed);
+			mMax.store(0, std::memory_order_relaxed);
+		}
+
+		// values below SubBuckets get their own bucket, after that
+		// the bucket is picked by the highest set bit plus the next SubBucketBits bits
+		static constexpr size_t BucketIndex(uint64_t value) {
+			if (value < SubBuckets) return (size_t)value;
+			unsigned msb = 63u - (unsigned)std::countl_zero(value);
+			uint64_t sub = (value >> (msb - SubBucketBits)) & (SubBuckets - 1);
+			return (size_t)((msb - SubBucketBits + 1) * SubBuckets + sub);
+		}
+
+		// largest value that lands in bucket index
+		static constexpr uint64_t BucketUpperBound(size_t index) {
+			if (index < SubBuckets) return index;
+			unsigned msb = (unsigned)(index / SubBuckets) + SubBucketBits - 1;
+			uint64_t sub = index % SubBuckets;
+			uint64_t low = (1ull << msb) | (sub << (msb - SubBucketBits));
+			return low + (1ull << (msb - SubBucketBits)) - 1;
+		}
+
+	private:
+		std::array<std::atomic<uint64_t>, BucketCount> mBuckets{};
+		std::atomic<uint64_t> mCount{ 0 };
+		std::atomic<uint64_t> mSum{ 0 };
+		std::atomic<uint64_t> mMax{ 0 };
+	};
+}
@@ -0,0 +1,172 @@
+#pragma once
+#include <Windows.h>
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <format>
+#include <algorithm>
+#include "Histogram.hpp"
+
+namespace WMTS {
+	// one input message as the logic thread sees it, 24 bytes
+	struct InputEvent {
+		// steady clock nanoseconds when the UI thread pushed the event
+		uint64_t mTimestampNs;
+
+		// WM_KEYDOWN, WM_KEYUP, WM_xBUTTONDOWN, WM_xBUTTONUP or WM_MOUSEMOVE
+		uint32_t mMessage;
+
+		// the virtual key for key messages, the MK_ button and modifier flags for mouse messages
+		uint32_t mKey;
+
+		// client coordinates for mouse messages, 0 for key messages
+		int32_t mX;
+		int32_t mY;
+	};
+
+	// a copy of one ring's counters, or of several added up
+	struct InputRingStats {
+		uint64_t mPushed{};
+		uint64_t mDrained{};
+
+		// events thrown away because the ring was full
+		uint64_t mDropped{};
+
+		// the most events that were waiting at one time, measured against the producer's cached tail so it may overstate
+		uint64_t mHighWater{};
+
+		// time from the UI thread's push to the logic thread's drain, includes the wait for the next tick
+		LatencyHistogram::Snapshot mLatency;
+
+		InputRingStats& operator+=(const InputRingStats& other) {
+			mPushed += other.mPushed;
+			mDrained += other.mDrained;
+			mDropped += other.mDropped;
+			mHighWater = std::max(mHighWater, other.mHighWater);
+			mLatency += other.mLatency;
+			return *this;
+		}
+
+		std::wstring Report() const {
+			return std::format(L"input events pushed={} drained={} dropped={} high water={}, input to logic latency {}",
+				mPushed, mDrained, mDropped, mHighWater, mLatency.Summary());
+		}
+	};
+
+	// a lock free single producer single consumer ring of input events
+	// the window's UI thread is the only producer (Push), its logic thread the only consumer (Drain)
+	// a full ring drops the new event and counts it, the UI thread never waits for the logic thread
+	// Drain() reports how many events were lost since the last drain so the logic side can resync,
+	// for example by reading the key state with GetAsyncKeyState()
+	template<size_t Capacity = 256>
+	class InputRing {
+		static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "InputRing capacity must be a power of two");
+
+	public:
+		// UI thread only, false if the ring is full and the event was dropped
+		bool Push(const InputEvent& event) {
+			uint64_t head = mHead.load(std::memory_order_relaxed);
+			if (head - mCachedTail == Capacity) {
+				// only reload the consumer's index when the cached one says full
+				mCachedTail = mTail.load(std::memory_order_acquire);
+				if (head - mCachedTail == Capacity) {
+					mDropped.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+			}
+
+			mEvents[head & (Capacity - 1)] = event;
+			mHead.store(head + 1, std::memory_order_release);
+
+			uint64_t waiting = head + 1 - mCachedTail;
+			if (waiting > mHighWater.load(std::memory_order_relaxed)) {
+				mHighWater.store(waiting, std::memory_order_relaxed);
+			}
+			return true;
+		}
+
+		// converts a window message and pushes it, UI thread only
+		bool Push(UINT message, WPARAM wParam, LPARAM lParam) {
+			bool mouse = message >= WM_MOUSEFIRST && message <= WM_MOUSELAST;
+			return Push(InputEvent{
+				NowNs(),
+				(uint32_t)message,
+				(uint32_t)wParam,
+				mouse ? (int32_t)(short)LOWORD(lParam) : 0,
+				mouse ? (int32_t)(short)HIWORD(lParam) : 0 });
+		}
+
+		// logic thread only, calls fn(const InputEvent&) for up to MaxEvents waiting events in push order
+		// returns the number handled, lost is set to the events dropped since the last Drain() that handled any
+		// drops seen by an empty Drain() stay pending, so they are reported together with the next delivered event
+		template<class F>
+		size_t Drain(F&& fn, uint64_t& lost, size_t MaxEvents = Capacity) {
+			uint64_t tail = mTail.load(std::memory_order_relaxed);
+			uint64_t head = mHead.load(std::memory_order_acquire);
+			size_t count = (size_t)std::min<uint64_t>(head - tail, MaxEvents);
+			if (count == 0) {
+				lost = 0;
+				return 0;
+			}
+
+			uint64_t dropped = mDropped.load(std::memory_order_relaxed);
+			lost = dropped - mDroppedSeen;
+			mDroppedSeen = dropped;
+
+			uint64_t now = NowNs();
+			for (size_t i{}; i < count; i++) {
+				const InputEvent& event = mEvents[(tail + i) & (Capacity - 1)];
+				mLatency.Record(now > event.mTimestampNs ? now - event.mTimestampNs : 0);
+				fn(event);
+			}
+
+			// the slots are handed back to the producer in one store for the whole batch
+			mTail.store(tail + count, std::memory_order_release);
+			mDrained.fetch_add(count, std::memory_order_relaxed);
+			return count;
+		}
+
+		// safe to call from any thread
+		InputRingStats Read() const {
+			InputRingStats stats;
+			stats.mPushed = mHead.load(std::memory_order_relaxed);
+			stats.mDrained = mDrained.load(std::memory_order_relaxed);
+			stats.mDropped = mDropped.load(std::memory_order_relaxed);
+			stats.mHighWater = mHighWater.load(std::memory_order_relaxed);
+			stats.mLatency = mLatency.Read();
+			return stats;
+		}
+
+		static constexpr size_t Size() {
+			return Capacity;
+		}
+
+	private:
+		static uint64_t NowNs() {
+			return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		// producer and consumer indices on their own cache lines, they only ever grow
+		alignas(64) std::atomic<uint64_t> mHead{ 0 };
+		uint64_t mCachedTail{ 0 };
+		std::atomic<uint64_t> mDropped{ 0 };
+		std::atomic<uint64_t> mHighWater{ 0 };
+
+		alignas(64) std::atomic<uint64_t> mTail{ 0 };
+		uint64_t mDroppedSeen{ 0 };
+		std::atomic<uint64_t> mDrained{ 0 };
+
+		alignas(64) std::array<InputEvent, Capacity> mEvents{};
+
+		LatencyHistogram mLatency;
+	};
+
+	using WindowInputRing = InputRing<>;
+
+	// the input ring of the window the calling UI thread serves, nullptr outside MTPlainWin32Window loops
+	inline thread_local WindowInputRing* tlWindowInputRing = nullptr;
+}
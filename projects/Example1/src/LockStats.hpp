@@ -0,0 +1,166 @@
+#pragma once
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <format>
+#include <algorithm>
+#include "Histogram.hpp"
+
+// set WMTS_LOCK_STATS to 1 (cmake -DWMTS_LOCK_STATS=ON) to record contention on every ProfiledMutex
+// when it is 0 ProfiledMutex is a plain std::mutex with a name tag that costs nothing
+#ifndef WMTS_LOCK_STATS
+#define WMTS_LOCK_STATS 0
+#endif
+
+namespace WMTS {
+	// statistics for one named lock site
+	struct LockSiteStats {
+		explicit LockSiteStats(const wchar_t* name) :mName(name) {}
+
+		const wchar_t* mName;
+
+		// every successful lock()/try_lock()
+		std::atomic<uint64_t> mAcquisitions{ 0 };
+
+		// lock() calls that found the mutex already owned and had to block
+		std::atomic<uint64_t> mContended{ 0 };
+
+		// time spent blocked in lock() for contended acquisitions, in nanoseconds
+		LatencyHistogram mWaitTime;
+
+		// time between acquire and release, in nanoseconds
+		LatencyHistogram mHoldTime;
+
+		std::wstring Report() const {
+			uint64_t acquisitions = mAcquisitions.load(std::memory_order_relaxed);
+			uint64_t contended = mContended.load(std::memory_order_relaxed);
+			double percent = acquisitions ? (100.0 * (double)contended / (double)acquisitions) : 0.0;
+
+			return std::format(L"[{}] acquisitions={} contended={} ({:.2f}%)\n    wait: {}\n    hold: {}",
+				mName, acquisitions, contended, percent,
+				mWaitTime.Read().Summary(),
+				mHoldTime.Read().Summary());
+		}
+	};
+
+	// global list of every live lock site so they can be dumped together
+	class LockStatsRegistry {
+	public:
+		static LockStatsRegistry& Get() {
+			// function local static so it is constructed before any static ProfiledMutex registers
+			static LockStatsRegistry registry;
+			return registry;
+		}
+
+		void Add(LockSiteStats* site) {
+			std::lock_guard<std::mutex> local_lock(mSites_mtx);
+			mSites.push_back(site);
+		}
+
+		// the stats of a removed site are folded into mRetired so a dump at shutdown
+		// still reports locks that belonged to objects that are already destroyed
+		void Remove(LockSiteStats* site) {
+			std::lock_guard<std::mutex> local_lock(mSites_mtx);
+			auto found = std::find(mSites.begin(), mSites.end(), site);
+			if (found != mSites.end()) {
+				mSites.erase(found);
+				mRetired.push_back(site->Report());
+			}
+		}
+
+		// one entry per lock site, live sites first
+		std::wstring Report() {
+			std::lock_guard<std::mutex> local_lock(mSites_mtx);
+			std::wstring report{ L"Lock contention report:\n" };
+			for (auto site : mSites) {
+				report += site->Report() + L"\n";
+			}
+			for (const auto& retired : mRetired) {
+				report += L"(retired) " + retired + L"\n";
+			}
+			return report;
+		}
+
+	private:
+		LockStatsRegistry() = default;
+
+		// the registry lock is a plain mutex, it would be odd to profile the profiler
+		std::mutex mSites_mtx;
+		std::vector<LockSiteStats*> mSites;
+		std::vector<std::wstring> mRetired;
+	};
+
+#if WMTS_LOCK_STATS
+	// a drop in replacement for std::mutex that records acquisitions, contention,
+	// wait time and hold time under the name of the lock site
+	// meets the Lockable requirements so std::lock_guard and std::unique_lock work as usual
+	class ProfiledMutex {
+	public:
+		explicit ProfiledMutex(const wchar_t* name) :mStats(name) {
+			LockStatsRegistry::Get().Add(&mStats);
+		}
+
+		~ProfiledMutex() {
+			LockStatsRegistry::Get().Remove(&mStats);
+		}
+
+		ProfiledMutex(const ProfiledMutex&) = delete;
+		ProfiledMutex& operator=(const ProfiledMutex&) = delete;
+
+		void lock() {
+			// the uncontended path is a single try_lock and a clock read
+			if (!mMutex.try_lock()) {
+				auto wait_start = std::chrono::steady_clock::now();
+				mMutex.lock();
+				mAcquiredAt = std::chrono::steady_clock::now();
+
+				mStats.mContended.fetch_add(1, std::memory_order_relaxed);
+				mStats.mWaitTime.Record((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(mAcquiredAt - wait_start).count());
+			}
+			else {
+				mAcquiredAt = std::chrono::steady_clock::now();
+			}
+			mStats.mAcquisitions.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		bool try_lock() {
+			if (!mMutex.try_lock()) return false;
+			mAcquiredAt = std::chrono::steady_clock::now();
+			mStats.mAcquisitions.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		void unlock() {
+			// mAcquiredAt is only touched by the owning thread so reading it here is safe
+			auto held = std::chrono::steady_clock::now() - mAcquiredAt;
+			mStats.mHoldTime.Record((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(held).count());
+			mMutex.unlock();
+		}
+
+		const LockSiteStats& Stats() const { return mStats; }
+
+	private:
+		std::mutex mMutex;
+		std::chrono::steady_clock::time_point mAcquiredAt;
+		LockSiteStats mStats;
+	};
+#else
+	// lock stats disabled: a plain std::mutex, the name is dropped
+	class ProfiledMutex :public std::mutex {
+	public:
+		explicit ProfiledMutex(const wchar_t*) {}
+	};
+#endif
+
+	// returns the contention report of every lock site
+	// with WMTS_LOCK_STATS off there are no sites and the report says so
+	inline std::wstring LockStatsReport() {
+#if WMTS_LOCK_STATS
+		return LockStatsRegistry::Get().Report();
+#else
+		return L"Lock contention report: disabled, build with WMTS_LOCK_STATS=ON\n";
+#endif
+	}
+}
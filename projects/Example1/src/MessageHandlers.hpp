@@ -0,0 +1,201 @@
+#pragma once
+#include <Windows.h>
+#include <array>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+#include <cstdint>
+#include <type_traits>
+
+namespace WMTS {
+	using MessageHandler = std::function<LRESULT(HWND, UINT, WPARAM, LPARAM)>;
+
+	// message -> handler table registered at run time with on(WM_X, fn)
+	// system messages (below WM_USER) are looked up with one index into a flat 2 KB array,
+	// WM_USER, WM_APP and registered messages go through a small sorted array
+	// register every handler before the window exists, Dispatch() reads the table without a lock
+	// a handler may call on() or off() from inside Dispatch() on the window's thread, for example to remove itself
+	// after one run, a handler that is replaced or removed then is kept until the outermost Dispatch() returns
+	class MessageHandlerTable {
+	public:
+		// handles message with fn, replaces an earlier handler for the same message
+		// fn returns the message result, call DefWindowProc from it to also get the default handling
+		// throws std::length_error if more than MaxHandlers messages would have a handler at once
+		void on(UINT message, MessageHandler fn) {
+			uint16_t existing = Find(message);
+			if (existing && mDispatchDepth == 0) {
+				mHandlers[existing - 1] = std::move(fn);
+				return;
+			}
+
+			// the old handler may be running, it moves to a new slot and the old one is retired
+			uint16_t slot = 0;
+			if (existing) {
+				Retire(existing);
+			}
+
+			// a slot freed by off() first, so on/off churn does not grow the table
+			if (!mFree.empty()) {
+				slot = mFree.back();
+				mFree.pop_back();
+				mHandlers[slot - 1] = std::move(fn);
+			}
+			else {
+				if (mHandlers.size() >= MaxHandlers) {
+					throw std::length_error("MessageHandlerTable: no free handler slot, a slot index would wrap");
+				}
+				// a deque, so a handler running in Dispatch() does not move
+				mHandlers.push_back(std::move(fn));
+				slot = (uint16_t)mHandlers.size();
+			}
+
+			if (message < DirectMessages) {
+				mDirect[message] = slot;
+			}
+			else {
+				auto position = std::lower_bound(mExtended.begin(), mExtended.end(), message,
+					[](const ExtendedEntry& entry, UINT value) { return entry.mMessage < value; });
+				if (existing) {
+					position->mSlot = slot;
+				}
+				else {
+					mExtended.insert(position, ExtendedEntry{ message, slot });
+				}
+			}
+		}
+
+		// removes the handler for message, the message goes back to the normal path
+		// the handler is destroyed here, or once the outermost Dispatch() returns when called from a handler,
+		// and its slot is reused by a later on()
+		void off(UINT message) {
+			uint16_t slot = 0;
+			if (message < DirectMessages) {
+				slot = mDirect[message];
+				mDirect[message] = 0;
+			}
+			else {
+				auto position = std::lower_bound(mExtended.begin(), mExtended.end(), message,
+					[](const ExtendedEntry& entry, UINT value) { return entry.mMessage < value; });
+				if (position != mExtended.end() && position->mMessage == message) {
+					slot = position->mSlot;
+					mExtended.erase(position);
+				}
+			}
+			if (!slot) return;
+			Retire(slot);
+		}
+
+		// runs the message's handler, returns false without touching result if it has none
+		bool Dispatch(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam, LRESULT& result) {
+			uint16_t slot = Find(message);
+			if (!slot) return false;
+			mDispatchDepth++;
+			result = mHandlers[slot - 1](hwnd, message, wParam, lParam);
+			if (--mDispatchDepth == 0 && !mRetired.empty()) {
+				for (uint16_t retired : mRetired) {
+					Retire(retired);
+				}
+				mRetired.clear();
+			}
+			return true;
+		}
+
+		bool Empty() const {
+			return mHandlers.size() == mFree.size() + mRetired.size();
+		}
+
+		// handler slots in use or free, on/off churn keeps this at the most handlers registered at once
+		size_t Slots() const {
+			return mHandlers.size();
+		}
+
+	private:
+		// messages below WM_USER are reserved for the system
+		static constexpr UINT DirectMessages = WM_USER;
+
+		// slots are stored as index + 1 in 16 bits
+		static constexpr size_t MaxHandlers = 0xFFFF;
+
+		struct ExtendedEntry {
+			UINT mMessage;
+			uint16_t mSlot;
+		};
+
+		// destroys the slot's handler and frees the slot, or defers both while a handler runs
+		void Retire(uint16_t slot) {
+			if (mDispatchDepth != 0) {
+				mRetired.push_back(slot);
+				return;
+			}
+			mHandlers[slot - 1] = nullptr;
+			mFree.push_back(slot);
+		}
+
+		// 0 means no handler, otherwise the handler's index + 1
+		uint16_t Find(UINT message) const {
+			if (message < DirectMessages) {
+				return mDirect[message];
+			}
+			auto position = std::lower_bound(mExtended.begin(), mExtended.end(), message,
+				[](const ExtendedEntry& entry, UINT value) { return entry.mMessage < value; });
+			if (position != mExtended.end() && position->mMessage == message) {
+				return position->mSlot;
+			}
+			return 0;
+		}
+
+		std::array<uint16_t, DirectMessages> mDirect{};
+		std::vector<ExtendedEntry> mExtended;
+
+		// indexed by slot - 1, a slot on mFree holds an empty function
+		std::deque<MessageHandler> mHandlers;
+		std::vector<uint16_t> mFree;
+
+		// Dispatch() calls in progress on the window's thread, and the slots off() or on() gave up meanwhile
+		size_t mDispatchDepth{ 0 };
+		std::vector<uint16_t> mRetired;
+	};
+
+	// one compile time entry: Handler is a member function of the window
+	// LRESULT Handler(HWND, UINT, WPARAM, LPARAM)
+	template<UINT Message, auto Handler>
+	struct OnMessage {
+		static constexpr UINT mMessage = Message;
+		static constexpr auto mHandler = Handler;
+	};
+
+	// a fixed handler set known at compile time
+	// Dispatch() is a chain of constant comparisons the compiler turns into a switch, and each handler
+	// is a direct, inlinable member call
+	//   using MessageMap = WMTS::StaticMessageMap<
+	//       WMTS::OnMessage<WM_SIZE, &MyWindow::OnSize>,
+	//       WMTS::OnMessage<WM_KEYDOWN, &MyWindow::OnKeyDown>>;
+	template<class... Entries>
+	struct StaticMessageMap {
+		static constexpr bool Unique() {
+			std::array<UINT, sizeof...(Entries)> messages{ Entries::mMessage... };
+			for (size_t i = 0; i < messages.size(); i++) {
+				for (size_t j = i + 1; j < messages.size(); j++) {
+					if (messages[i] == messages[j]) return false;
+				}
+			}
+			return true;
+		}
+		static_assert(Unique(), "StaticMessageMap has two handlers for the same message");
+
+		static constexpr bool Handles(UINT message) {
+			return ((message == Entries::mMessage) || ...);
+		}
+
+		// runs the handler for message on window, returns false without touching result if there is none
+		template<class Window>
+		static bool Dispatch(Window& window, HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam, LRESULT& result) {
+			return ((message == Entries::mMessage
+				? (result = (window.*Entries::mHandler)(hwnd, message, wParam, lParam), true)
+				: false) || ...);
+		}
+	};
+}
@@ -0,0 +1,441 @@
+#pragma once
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <unistd.h>
+#endif
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <format>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include "Histogram.hpp"
+#include "LockStats.hpp"
+
+// set WMTS_RECORD to 1 (cmake -DWMTS_RECORD=ON) to record every message window_proc_proxy() sees into
+// WMTSmessages.bin, replay it with the WMTSReplay tool, which needs no display and also runs on Linux
+#ifndef WMTS_RECORD
+#define WMTS_RECORD 0
+#endif
+
+namespace WMTS {
+	// the layout below is read by WMTSReplay, bump the version on any change
+	constexpr uint32_t MessageStreamMagic = 0x52544d57; // "WMTR"
+	constexpr uint32_t MessageChunkMagic = 0x43544d57; // "WMTC"
+	constexpr uint32_t MessageStreamVersion = 1;
+
+	// the start of a stream file, chunks follow it until the end of the file
+	struct MessageStreamHeader {
+		uint32_t mMagic;
+		uint32_t mVersion;
+		uint32_t mHeaderSize;
+		uint32_t mPid;
+	};
+
+	// one thread's batch of records, the records of one chunk are in time order,
+	// chunks of different threads overlap in time
+	// each record is five LEB128 varints: microseconds since the previous record of the chunk (the first since mBaseUs),
+	// the window handle, the message, wParam and lParam zigzag encoded so small negative values stay short
+	struct MessageChunkHeader {
+		uint32_t mMagic;
+		uint32_t mBytes;
+		uint32_t mCount;
+		uint32_t mReserved;
+		uint64_t mBaseUs;
+	};
+
+	// a decoded record
+	struct RecordedMessage {
+		// microseconds since the recording started
+		uint64_t mTimeUs;
+		uint64_t mWindow;
+		uint32_t mMessage;
+		uint64_t mWParam;
+		int64_t mLParam;
+	};
+
+	// messages whose wParam or lParam points into the recording process, they are recorded but not replayed
+	// the values are the WinUser.h ones, so this also builds where there is no Windows.h
+	inline bool MessageCarriesPointer(uint32_t message) {
+		switch (message) {
+		case 0x0001: // WM_CREATE, CREATESTRUCT*
+		case 0x000C: // WM_SETTEXT, string
+		case 0x000D: // WM_GETTEXT, buffer
+		case 0x001A: // WM_SETTINGCHANGE, string
+		case 0x0024: // WM_GETMINMAXINFO, MINMAXINFO*
+		case 0x002B: // WM_DRAWITEM
+		case 0x002C: // WM_MEASUREITEM
+		case 0x002D: // WM_DELETEITEM
+		case 0x0039: // WM_COMPAREITEM
+		case 0x0046: // WM_WINDOWPOSCHANGING, WINDOWPOS*
+		case 0x0047: // WM_WINDOWPOSCHANGED, WINDOWPOS*
+		case 0x004A: // WM_COPYDATA
+		case 0x004E: // WM_NOTIFY
+		case 0x007C: // WM_STYLECHANGING
+		case 0x007D: // WM_STYLECHANGED
+		case 0x0081: // WM_NCCREATE, CREATESTRUCT*
+		case 0x0083: // WM_NCCALCSIZE, RECT* or NCCALCSIZE_PARAMS*
+		case 0x0214: // WM_SIZING, RECT*, the WM_SIZE that follows carries the size
+		case 0x0216: // WM_MOVING, RECT*
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	// a copy of the recorder's counters
+	struct MessageRecordStats {
+		uint64_t mMessages{};
+		uint64_t mChunks{};
+		uint64_t mBytes{};
+
+		// writing a full chunk to the file, this happens on the thread whose buffer filled up
+		LatencyHistogram::Snapshot mFlushTime;
+
+		std::wstring Report() const {
+			return std::format(L"Message recording: messages={} chunks={} bytes={} ({:.1f} per message)\n"
+				L"  flush {}\n",
+				mMessages, mChunks, mBytes, mMessages ? (double)mBytes / (double)mMessages : 0.0, mFlushTime.Summary());
+		}
+	};
+
+	// one thread's records waiting to be written, filled without a lock
+	class MessageRecordBuffer {
+	public:
+		static constexpr size_t Capacity = 16 * 1024;
+
+		// five varints of at most 10 bytes
+		static constexpr size_t MaxRecordBytes = 50;
+
+		MessageRecordBuffer();
+		~MessageRecordBuffer();
+
+		MessageRecordBuffer(const MessageRecordBuffer&) = delete;
+		MessageRecordBuffer& operator=(const MessageRecordBuffer&) = delete;
+
+		// returns true once the buffer has no room for another record
+		bool Append(uint64_t TimeUs, uint64_t Window, uint32_t Message, uint64_t WParam, int64_t LParam) {
+			if (mCount == 0) {
+				mBaseUs = TimeUs;
+				mLastUs = TimeUs;
+			}
+			PutVarint(TimeUs - mLastUs);
+			PutVarint(Window);
+			PutVarint(Message);
+			PutVarint(WParam);
+			PutVarint(((uint64_t)LParam << 1) ^ (uint64_t)(LParam >> 63));
+			mLastUs = TimeUs;
+			mCount++;
+			return Capacity - mSize < MaxRecordBytes;
+		}
+
+		bool Empty() const { return mCount == 0; }
+
+		void Clear() {
+			mSize = 0;
+			mCount = 0;
+		}
+
+		MessageChunkHeader Header() const {
+			return MessageChunkHeader{ MessageChunkMagic, (uint32_t)mSize, mCount, 0, mBaseUs };
+		}
+
+		const uint8_t* Data() const { return mBytes; }
+
+	private:
+		void PutVarint(uint64_t value) {
+			while (value >= 0x80) {
+				mBytes[mSize++] = (uint8_t)(value | 0x80);
+				value >>= 7;
+			}
+			mBytes[mSize++] = (uint8_t)value;
+		}
+
+		uint8_t mBytes[Capacity];
+		size_t mSize{};
+		uint32_t mCount{};
+		uint64_t mBaseUs{};
+		uint64_t mLastUs{};
+	};
+
+	// records the messages of every window in the process into one stream file
+	// each thread appends to its own buffer and only takes the file lock to write a full buffer,
+	// so recording costs a clock read and a few byte stores per message
+	class MessageRecorder {
+	public:
+		static MessageRecorder& Get() {
+			static MessageRecorder recorder;
+			return recorder;
+		}
+
+		// call before the first window is created, relative paths are relative to the working directory like WMTSlog.txt
+		void SetPath(const std::filesystem::path& path) {
+			std::lock_guard<ProfiledMutex> local_lock(mFile_mtx);
+			mPath = path;
+		}
+
+		// any thread, the file is opened by the first message
+		void Record(uint64_t Window, uint32_t Message, uint64_t WParam, int64_t LParam) {
+			if (mStopped.load(std::memory_order_relaxed)) return;
+			std::call_once(mStart_flag, [this]() { Start(); });
+
+			if (!tlMessageRecordBuffer) {
+				tlMessageRecordBuffer = std::make_unique<MessageRecordBuffer>();
+			}
+			uint64_t now = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - mStart).count();
+			if (tlMessageRecordBuffer->Append(now, Window, Message, WParam, LParam)) {
+				Flush(*tlMessageRecordBuffer);
+			}
+		}
+
+		// writes what every thread still holds and closes the file, later messages are not recorded
+		// call once every other window thread has ended
+		void Stop() {
+			mStopped.store(true, std::memory_order_relaxed);
+			std::lock_guard<ProfiledMutex> local_lock(mFile_mtx);
+			for (MessageRecordBuffer* buffer : mBuffers) {
+				WriteChunk(*buffer);
+			}
+			mFile.close();
+		}
+
+		MessageRecordStats Read() {
+			std::lock_guard<ProfiledMutex> local_lock(mFile_mtx);
+			MessageRecordStats stats;
+			stats.mMessages = mMessages;
+			stats.mChunks = mChunks;
+			stats.mBytes = mBytes;
+			stats.mFlushTime = mFlushTime.Read();
+			return stats;
+		}
+
+		// writes a buffer that filled up, on the thread that filled it
+		void Flush(MessageRecordBuffer& buffer) {
+			auto start = std::chrono::steady_clock::now();
+			std::lock_guard<ProfiledMutex> local_lock(mFile_mtx);
+			WriteChunk(buffer);
+			mFlushTime.Record((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+		}
+
+		void Register(MessageRecordBuffer* buffer) {
+			std::lock_guard<ProfiledMutex> local_lock(mFile_mtx);
+			mBuffers.push_back(buffer);
+		}
+
+		void Unregister(MessageRecordBuffer* buffer) {
+			std::lock_guard<ProfiledMutex> local_lock(mFile_mtx);
+			WriteChunk(*buffer);
+			mBuffers.erase(std::remove(mBuffers.begin(), mBuffers.end(), buffer), mBuffers.end());
+		}
+
+		// the calling thread's buffer, created by its first message
+		inline static thread_local std::unique_ptr<MessageRecordBuffer> tlMessageRecordBuffer;
+
+	private:
+		MessageRecorder() = default;
+
+		void Start() {
+			std::lock_guard<ProfiledMutex> local_lock(mFile_mtx);
+			mStart = std::chrono::steady_clock::now();
+			mFile.open(mPath, std::ios::binary | std::ios::trunc);
+			MessageStreamHeader header{ MessageStreamMagic, MessageStreamVersion, sizeof(MessageStreamHeader), CurrentPid() };
+			mFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			mBytes += sizeof(header);
+		}
+
+		// mFile_mtx held
+		void WriteChunk(MessageRecordBuffer& buffer) {
+			if (buffer.Empty()) return;
+			if (mFile.is_open()) {
+				MessageChunkHeader header = buffer.Header();
+				mFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+				mFile.write(reinterpret_cast<const char*>(buffer.Data()), header.mBytes);
+				mMessages += header.mCount;
+				mChunks++;
+				mBytes += sizeof(header) + header.mBytes;
+			}
+			buffer.Clear();
+		}
+
+		static uint32_t CurrentPid() {
+#ifdef _WIN32
+			return (uint32_t)GetCurrentProcessId();
+#else
+			return (uint32_t)getpid();
+#endif
+		}
+
+		ProfiledMutex mFile_mtx{ L"MessageRecorder::mFile_mtx" };
+		std::filesystem::path mPath{ L"WMTSmessages.bin" };
+		std::ofstream mFile;
+		std::chrono::steady_clock::time_point mStart;
+		std::once_flag mStart_flag;
+		std::atomic<bool> mStopped{ false };
+
+		// every thread's buffer, so Stop() can write what is left in them
+		std::vector<MessageRecordBuffer*> mBuffers;
+
+		uint64_t mMessages{};
+		uint64_t mChunks{};
+		uint64_t mBytes{};
+		LatencyHistogram mFlushTime;
+	};
+
+	inline MessageRecordBuffer::MessageRecordBuffer() {
+		MessageRecorder::Get().Register(this);
+	}
+
+	// the thread is exiting, what it recorded goes to the file now
+	inline MessageRecordBuffer::~MessageRecordBuffer() {
+		MessageRecorder::Get().Unregister(this);
+	}
+
+	// a whole stream file decoded, every thread's chunks merged into one time ordered list
+	class MessageStream {
+	public:
+		// returns false if the file is missing or not a stream, a truncated last chunk is ignored
+		bool Load(const std::filesystem::path& path) {
+			mMessages.clear();
+			std::ifstream file(path, std::ios::binary);
+			if (!file) return false;
+
+			MessageStreamHeader header{};
+			file.read(reinterpret_cast<char*>(&header), sizeof(header));
+			if (!file || header.mMagic != MessageStreamMagic || header.mVersion != MessageStreamVersion ||
+				header.mHeaderSize != sizeof(MessageStreamHeader)) {
+				return false;
+			}
+			mPid = header.mPid;
+
+			std::vector<uint8_t> bytes;
+			for (;;) {
+				MessageChunkHeader chunk{};
+				file.read(reinterpret_cast<char*>(&chunk), sizeof(chunk));
+				if (!file || chunk.mMagic != MessageChunkMagic || chunk.mBytes > MessageRecordBuffer::Capacity) break;
+				bytes.resize(chunk.mBytes);
+				file.read(reinterpret_cast<char*>(bytes.data()), chunk.mBytes);
+				if (!file) break;
+				if (!DecodeChunk(chunk, bytes.data(), bytes.size())) break;
+			}
+
+			// each chunk is already ordered, a stable sort keeps one thread's messages with equal times in order
+			std::stable_sort(mMessages.begin(), mMessages.end(), [](const RecordedMessage& a, const RecordedMessage& b) {
+				return a.mTimeUs < b.mTimeUs;
+			});
+			return true;
+		}
+
+		const std::vector<RecordedMessage>& Messages() const { return mMessages; }
+
+		uint32_t Pid() const { return mPid; }
+
+	private:
+		static bool GetVarint(const uint8_t*& cursor, const uint8_t* end, uint64_t& value) {
+			value = 0;
+			for (unsigned shift = 0; cursor < end && shift < 64; shift += 7) {
+				uint8_t byte = *cursor++;
+				value |= (uint64_t)(byte & 0x7F) << shift;
+				if (!(byte & 0x80)) return true;
+			}
+			return false;
+		}
+
+		bool DecodeChunk(const MessageChunkHeader& chunk, const uint8_t* data, size_t size) {
+			const uint8_t* cursor = data;
+			const uint8_t* end = data + size;
+			uint64_t time = chunk.mBaseUs;
+			for (uint32_t i{}; i < chunk.mCount; i++) {
+				uint64_t delta, window, message, wparam, lparam;
+				if (!GetVarint(cursor, end, delta) || !GetVarint(cursor, end, window) || !GetVarint(cursor, end, message) ||
+					!GetVarint(cursor, end, wparam) || !GetVarint(cursor, end, lparam)) {
+					return false;
+				}
+				time += delta;
+				mMessages.push_back(RecordedMessage{ time, window, (uint32_t)message, wparam, (int64_t)(lparam >> 1) ^ -(int64_t)(lparam & 1) });
+			}
+			return true;
+		}
+
+		std::vector<RecordedMessage> mMessages;
+		uint32_t mPid{};
+	};
+
+	enum class ReplaySpeed {
+		// each message is delivered when it arrived in the recording, relative to the first one
+		ORIGINAL,
+		// back to back, for throughput runs
+		MAXIMUM
+	};
+
+	// a copy of what a replay did
+	struct ReplayStats {
+		uint64_t mMessages{};
+
+		// messages carrying pointers into the recording process, not delivered
+		uint64_t mSkipped{};
+
+		uint64_t mWallNs{};
+
+		// ORIGINAL only, how much later than its recorded time each message was delivered
+		LatencyHistogram::Snapshot mLateness;
+
+		// the time deliver() took per message
+		LatencyHistogram::Snapshot mDeliverTime;
+
+		std::wstring Report() const {
+			double seconds = (double)mWallNs / 1e9;
+			return std::format(L"Replay: messages={} skipped={} in {:.3f}s ({:.0f} per second)\n"
+				L"  deliver  {}\n"
+				L"  lateness {}\n",
+				mMessages, mSkipped, seconds, seconds > 0.0 ? (double)mMessages / seconds : 0.0,
+				mDeliverTime.Summary(), mLateness.Summary());
+		}
+	};
+
+	// feeds a stream to deliver(const RecordedMessage&) on the calling thread, in recorded order
+	// there is no message queue and no window system involved, deliver() decides what a message does
+	template<class F>
+	ReplayStats ReplayMessages(const MessageStream& stream, ReplaySpeed speed, F&& deliver) {
+		ReplayStats stats;
+		LatencyHistogram lateness;
+		LatencyHistogram deliver_time;
+		const auto& messages = stream.Messages();
+		auto start = std::chrono::steady_clock::now();
+		uint64_t first = messages.empty() ? 0 : messages.front().mTimeUs;
+
+		for (const RecordedMessage& message : messages) {
+			if (MessageCarriesPointer(message.mMessage)) {
+				stats.mSkipped++;
+				continue;
+			}
+
+			auto due = start + std::chrono::microseconds(message.mTimeUs - first);
+			auto before = std::chrono::steady_clock::now();
+			if (speed == ReplaySpeed::ORIGINAL) {
+				if (before < due) {
+					std::this_thread::sleep_until(due);
+					before = std::chrono::steady_clock::now();
+				}
+				lateness.Record((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(before - due).count());
+			}
+
+			deliver(message);
+			deliver_time.Record((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - before).count());
+			stats.mMessages++;
+		}
+
+		stats.mWallNs = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		stats.mLateness = lateness.Read();
+		stats.mDeliverTime = deliver_time.Read();
+		return stats;
+	}
+}
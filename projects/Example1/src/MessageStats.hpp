@@ -0,0 +1,138 @@
+#pragma once
+#include <Windows.h>
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <string>
+#include <format>
+#include "Histogram.hpp"
+
+// set WMTS_MESSAGE_STATS to 1 (cmake -DWMTS_MESSAGE_STATS=ON) to measure every window message loop
+#ifndef WMTS_MESSAGE_STATS
+#define WMTS_MESSAGE_STATS 0
+#endif
+
+namespace WMTS {
+	// the groups messages are counted in
+	enum class MessageClass {
+		INPUT,
+		PAINT,
+		SIZE,
+		COMMAND,
+		OTHER,
+		COUNT
+	};
+
+	inline MessageClass ClassifyMessage(UINT message) {
+		if ((message >= WM_KEYFIRST && message <= WM_KEYLAST) || (message >= WM_MOUSEFIRST && message <= WM_MOUSELAST)) {
+			return MessageClass::INPUT;
+		}
+
+		switch (message) {
+		case WM_PAINT:
+		case WM_ERASEBKGND:
+			return MessageClass::PAINT;
+		case WM_SIZE:
+		case WM_SIZING:
+		case WM_MOVE:
+		case WM_ENTERSIZEMOVE:
+		case WM_EXITSIZEMOVE:
+			return MessageClass::SIZE;
+		case WM_COMMAND:
+			return MessageClass::COMMAND;
+		default:
+			return MessageClass::OTHER;
+		}
+	}
+
+	inline const wchar_t* MessageClassName(MessageClass c) {
+		switch (c) {
+		case MessageClass::INPUT: return L"input";
+		case MessageClass::PAINT: return L"paint";
+		case MessageClass::SIZE: return L"size";
+		case MessageClass::COMMAND: return L"command";
+		default: return L"other";
+		}
+	}
+
+	// a copy of a window's message loop stats at one point in time
+	struct MessageLoopSnapshot {
+		std::array<uint64_t, (size_t)MessageClass::COUNT> mMessages{};
+
+		// time spent in WindowProcedure per message, in nanoseconds
+		LatencyHistogram::Snapshot mProcedureTime;
+
+		// time from post to dispatch per queued message, in nanoseconds
+		// the post time comes from MSG::time which has millisecond resolution
+		LatencyHistogram::Snapshot mQueueWait;
+
+		std::chrono::steady_clock::time_point mTakenAt;
+
+		uint64_t Total() const {
+			uint64_t total = 0;
+			for (auto count : mMessages) total += count;
+			return total;
+		}
+
+		// messages per second of one class between an earlier snapshot and this one
+		double Rate(const MessageLoopSnapshot& earlier, MessageClass c) const {
+			double seconds = std::chrono::duration<double>(mTakenAt - earlier.mTakenAt).count();
+			if (seconds <= 0.0) return 0.0;
+			return (double)(mMessages[(size_t)c] - earlier.mMessages[(size_t)c]) / seconds;
+		}
+
+		std::wstring Report() const {
+			std::wstring report;
+			for (size_t i{}; i < mMessages.size(); i++) {
+				report += std::format(L"{}={} ", MessageClassName((MessageClass)i), mMessages[i]);
+			}
+			report += L"\n    procedure: " + mProcedureTime.Summary();
+			report += L"\n    queue wait: " + mQueueWait.Summary();
+			return report;
+		}
+	};
+
+	// counters and histograms for one window's message loop
+	// written only by the window's own thread with relaxed atomics, Read() is safe from any thread
+	class MessageLoopStats {
+	public:
+		void CountMessage(UINT message) {
+			mMessages[(size_t)ClassifyMessage(message)].fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void RecordProcedureTime(uint64_t ns) {
+			mProcedureTime.Record(ns);
+		}
+
+		// msg_time is MSG::time, the GetTickCount() value when the message was posted
+		void RecordQueueWait(DWORD msg_time) {
+			DWORD waited_ms = GetTickCount() - msg_time;
+			mQueueWait.Record((uint64_t)waited_ms * 1'000'000);
+		}
+
+		MessageLoopSnapshot Read() const {
+			MessageLoopSnapshot s;
+			for (size_t i{}; i < mMessages.size(); i++) {
+				s.mMessages[i] = mMessages[i].load(std::memory_order_relaxed);
+			}
+			s.mProcedureTime = mProcedureTime.Read();
+			s.mQueueWait = mQueueWait.Read();
+			s.mTakenAt = std::chrono::steady_clock::now();
+			return s;
+		}
+
+	private:
+		std::array<std::atomic<uint64_t>, (size_t)MessageClass::COUNT> mMessages{};
+		LatencyHistogram mProcedureTime;
+		LatencyHistogram mQueueWait;
+	};
+
+	// the stats of the message loop running on this thread, nullptr when stats are off
+	// set by ProcessMessage() and read by window_proc_proxy() so the hot path does no map lookups
+	inline thread_local MessageLoopStats* tlMessageLoopStats = nullptr;
+
+	// every message is counted, including ones sent from inside a handler (WM_SIZE from SetWindowPos and the like),
+	// but only the outermost WindowProcedure call on a thread is timed and watched,
+	// so the time of a nested message is not added twice to the procedure time histogram
+	inline thread_local unsigned tlWindowProcedureDepth = 0;
+}
@@ -0,0 +1,358 @@
+#pragma once
+#ifdef _WIN32
+#include <Windows.h>
+#include <Psapi.h>
+#else
+#include <unistd.h>
+#include <fstream>
+#endif
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <string>
+#include <format>
+#include <algorithm>
+#include <utility>
+#include <functional>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
+#include "LockStats.hpp"
+
+namespace WMTS {
+	struct PoolStats {
+		size_t mSlotSize{};
+		size_t mChunks{};
+		size_t mSlotsPerChunk{};
+		size_t mLive{};
+		size_t mPeak{};
+
+		size_t ReservedBytes() const { return mChunks * mSlotsPerChunk * mSlotSize; }
+
+		// share of the reserved slots that are in use, the rest is slack kept for reuse
+		double Utilization() const {
+			size_t slots = mChunks * mSlotsPerChunk;
+			return slots ? (double)mLive / (double)slots : 0.0;
+		}
+
+		std::wstring Report() const {
+			return std::format(L"slot={}B chunks={} live={} peak={} reserved={}KB utilization={:.1f}%",
+				mSlotSize, mChunks, mLive, mPeak, ReservedBytes() / 1024, Utilization() * 100.0);
+		}
+	};
+
+	class FixedPool;
+
+	// every FixedPool registers here so their stats can be reported together
+	class PoolRegistry {
+	public:
+		static PoolRegistry& Get() {
+			static PoolRegistry registry;
+			return registry;
+		}
+
+		void Add(FixedPool* pool) {
+			std::lock_guard<std::mutex> local_lock(mPools_mtx);
+			mPools.push_back(pool);
+		}
+
+		void Remove(FixedPool* pool) {
+			std::lock_guard<std::mutex> local_lock(mPools_mtx);
+			auto found = std::find(mPools.begin(), mPools.end(), pool);
+			if (found != mPools.end()) mPools.erase(found);
+		}
+
+		std::wstring Report();
+
+	private:
+		PoolRegistry() = default;
+
+		std::mutex mPools_mtx;
+		std::vector<FixedPool*> mPools;
+	};
+
+	// hands out fixed size slots carved from contiguous chunks
+	// freed slots go on a free list and are reused before a new chunk is allocated,
+	// so long open/close churn reuses the same memory instead of fragmenting the heap
+	class FixedPool {
+	public:
+		FixedPool(size_t SlotSize, size_t SlotAlign, size_t SlotsPerChunk = 64)
+			:mSlotAlign(std::max(SlotAlign, alignof(FreeSlot))),
+			mSlotSize(RoundUp(std::max(SlotSize, sizeof(FreeSlot)), mSlotAlign)),
+			mSlotsPerChunk(SlotsPerChunk) {
+			PoolRegistry::Get().Add(this);
+		}
+
+		~FixedPool() {
+			PoolRegistry::Get().Remove(this);
+			for (void* chunk : mChunks) {
+				::operator delete(chunk, std::align_val_t(mSlotAlign));
+			}
+		}
+
+		FixedPool(const FixedPool&) = delete;
+		FixedPool& operator=(const FixedPool&) = delete;
+
+		void* Allocate() {
+			std::lock_guard<ProfiledMutex> local_lock(mPool_mtx);
+			if (!mFree) Grow();
+
+			FreeSlot* slot = mFree;
+			mFree = slot->mNext;
+			mPeak = std::max(++mLive, mPeak);
+			return slot;
+		}
+
+		void Deallocate(void* p) {
+			if (!p) return;
+			std::lock_guard<ProfiledMutex> local_lock(mPool_mtx);
+			FreeSlot* slot = static_cast<FreeSlot*>(p);
+			slot->mNext = mFree;
+			mFree = slot;
+			--mLive;
+		}
+
+		PoolStats Stats() {
+			std::lock_guard<ProfiledMutex> local_lock(mPool_mtx);
+			return PoolStats{ mSlotSize, mChunks.size(), mSlotsPerChunk, mLive, mPeak };
+		}
+
+	private:
+		struct FreeSlot {
+			FreeSlot* mNext;
+		};
+
+		static size_t RoundUp(size_t n, size_t align) {
+			return (n + align - 1) / align * align;
+		}
+
+		// mPool_mtx must be held
+		void Grow() {
+			char* chunk = static_cast<char*>(::operator new(mSlotSize * mSlotsPerChunk, std::align_val_t(mSlotAlign)));
+			mChunks.push_back(chunk);
+
+			// thread the new slots onto the free list in address order
+			for (size_t i = mSlotsPerChunk; i-- > 0;) {
+				FreeSlot* slot = reinterpret_cast<FreeSlot*>(chunk + i * mSlotSize);
+				slot->mNext = mFree;
+				mFree = slot;
+			}
+		}
+
+		const size_t mSlotAlign;
+		const size_t mSlotSize;
+		const size_t mSlotsPerChunk;
+
+		ProfiledMutex mPool_mtx{ L"FixedPool::mPool_mtx" };
+		FreeSlot* mFree{ nullptr };
+		std::vector<void*> mChunks;
+		size_t mLive{};
+		size_t mPeak{};
+	};
+
+	inline std::wstring PoolRegistry::Report() {
+		std::vector<FixedPool*> pools;
+		{
+			std::lock_guard<std::mutex> local_lock(mPools_mtx);
+			pools = mPools;
+		}
+
+		std::wstring report{ L"Pools:\n" };
+		for (auto pool : pools) {
+			report += L"  " + pool->Stats().Report() + L"\n";
+		}
+		return report;
+	}
+
+	// one shared pool per size and alignment class
+	template<size_t Size, size_t Align>
+	FixedPool& SizeClassPool() {
+		static FixedPool pool(Size, Align);
+		return pool;
+	}
+
+	// a std allocator that takes single objects from the matching SizeClassPool
+	// and falls back to operator new for arrays (such as unordered_map bucket arrays)
+	template<class T>
+	class PoolAllocator {
+	public:
+		using value_type = T;
+
+		PoolAllocator() noexcept = default;
+
+		template<class U>
+		PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+		T* allocate(size_t n) {
+			if (n == 1) {
+				return static_cast<T*>(SizeClassPool<sizeof(T), alignof(T)>().Allocate());
+			}
+			return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+		}
+
+		void deallocate(T* p, size_t n) noexcept {
+			if (n == 1) {
+				SizeClassPool<sizeof(T), alignof(T)>().Deallocate(p);
+				return;
+			}
+			::operator delete(p, std::align_val_t(alignof(T)));
+		}
+
+		template<class U>
+		bool operator==(const PoolAllocator<U>&) const noexcept { return true; }
+	};
+
+	// an unordered_map whose nodes come from the size class pools
+	template<class Key, class Value>
+	using PooledUnorderedMap = std::unordered_map<Key, Value, std::hash<Key>, std::equal_to<Key>, PoolAllocator<std::pair<const Key, Value>>>;
+
+	// a typed front end for a FixedPool
+	template<class T>
+	class ObjectPool {
+	public:
+		template<class... Args>
+		T* New(Args&&... args) {
+			void* slot = SizeClassPool<sizeof(T), alignof(T)>().Allocate();
+			try {
+				return ::new (slot) T(std::forward<Args>(args)...);
+			}
+			catch (...) {
+				SizeClassPool<sizeof(T), alignof(T)>().Deallocate(slot);
+				throw;
+			}
+		}
+
+		void Delete(T* p) {
+			if (!p) return;
+			p->~T();
+			SizeClassPool<sizeof(T), alignof(T)>().Deallocate(p);
+		}
+	};
+
+	// resident memory of the whole process
+	struct ProcessMemory {
+		size_t mResidentBytes{};
+		size_t mPeakResidentBytes{};
+	};
+
+	// reads the working set on Windows and /proc/self on Linux, zeros if it cannot be read
+	inline ProcessMemory ProcessMemoryUsage() {
+		ProcessMemory memory;
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters{};
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+			memory.mResidentBytes = counters.WorkingSetSize;
+			memory.mPeakResidentBytes = counters.PeakWorkingSetSize;
+		}
+#else
+		// statm counts pages, the second field is the resident set
+		std::ifstream statm("/proc/self/statm");
+		size_t pages = 0, resident = 0;
+		if (statm >> pages >> resident) {
+			memory.mResidentBytes = resident * (size_t)sysconf(_SC_PAGESIZE);
+		}
+
+		std::ifstream status("/proc/self/status");
+		std::string line;
+		while (std::getline(status, line)) {
+			if (line.rfind("VmHWM:", 0) == 0) {
+				memory.mPeakResidentBytes = (size_t)std::stoull(line.substr(6)) * 1024;
+				break;
+			}
+		}
+#endif
+		return memory;
+	}
+
+	// stats of every pool in the process and its resident memory
+	inline std::wstring PoolReport() {
+		ProcessMemory memory = ProcessMemoryUsage();
+		return std::format(L"Memory: resident={}KB peak resident={}KB\n", memory.mResidentBytes / 1024, memory.mPeakResidentBytes / 1024)
+			+ PoolRegistry::Get().Report();
+	}
+
+	// opens and closes windows Cycles times with Windows of them open at once, once with the bookkeeping
+	// a window costs (two map nodes, a dimensions block and a thread object) on the heap and once from the size class pools
+	// between windows a random long lived string is replaced, the way the rest of the process allocates,
+	// which is what scatters heap allocated bookkeeping over many pages
+	// reports the time per open and close, the pages the live bookkeeping ends up on, the pools' reserved bytes
+	// and the resident set sampled during the churn
+	// Example1 --benchmark-churn runs it
+	inline std::wstring BenchmarkWindowChurn(size_t Windows = 64, size_t Cycles = 200000) {
+		using Dimensions = std::array<uint32_t, 4>;
+		using ThreadObject = std::array<uint64_t, 4>;
+		constexpr size_t PageSize = 4096;
+
+		std::wstring report = std::format(L"Window churn, {} windows open, {} opens and closes:\n", Windows, Cycles);
+
+		auto run = [&](auto& threads, auto& dimensions, auto&& make, auto&& destroy, const wchar_t* name) {
+			std::mt19937_64 random{ 42 };
+			std::vector<std::string> others(Windows * 4);
+			std::vector<uint64_t> open;
+			uint64_t next = 1;
+			size_t resident_peak = ProcessMemoryUsage().mResidentBytes;
+
+			auto start = std::chrono::steady_clock::now();
+			for (size_t cycle{}; cycle < Cycles + Windows; cycle++) {
+				if (open.size() == Windows) {
+					// the oldest windows are not always the ones closed first
+					size_t index = (size_t)(random() % open.size());
+					uint64_t handle = open[index];
+					open[index] = open.back();
+					open.pop_back();
+					destroy(threads.at(handle));
+					threads.erase(handle);
+					dimensions.erase(handle);
+				}
+
+				others[(size_t)(random() % others.size())].assign(24 + (size_t)(random() % 480), 'x');
+
+				uint64_t handle = next++;
+				threads.emplace(handle, make());
+				dimensions.emplace(handle, Dimensions{ 640, 480, 624, 441 });
+				open.push_back(handle);
+
+				if (cycle % 4096 == 0) {
+					resident_peak = std::max(resident_peak, ProcessMemoryUsage().mResidentBytes);
+				}
+			}
+			double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+			// the pages a walk over every open window's bookkeeping touches
+			std::unordered_set<uintptr_t> pages;
+			for (uint64_t handle : open) {
+				pages.insert((uintptr_t)&*threads.find(handle) / PageSize);
+				pages.insert((uintptr_t)threads.at(handle) / PageSize);
+				pages.insert((uintptr_t)&*dimensions.find(handle) / PageSize);
+			}
+
+			report += std::format(L"  {}: {:.0f}ns per open and close, live bookkeeping on {} pages, sampled peak resident={}KB\n",
+				name, ns / (double)(Cycles + Windows), pages.size(), resident_peak / 1024);
+
+			for (uint64_t handle : open) destroy(threads.at(handle));
+		};
+
+		{
+			std::unordered_map<uint64_t, ThreadObject*> threads;
+			std::unordered_map<uint64_t, Dimensions> dimensions;
+			run(threads, dimensions, []() { return new ThreadObject{}; }, [](ThreadObject* p) { delete p; }, L"heap  ");
+		}
+		{
+			ObjectPool<ThreadObject> objects;
+			PooledUnorderedMap<uint64_t, ThreadObject*> threads;
+			PooledUnorderedMap<uint64_t, Dimensions> dimensions;
+			run(threads, dimensions, [&]() { return objects.New(); }, [&](ThreadObject* p) { objects.Delete(p); }, L"pooled");
+		}
+
+		// the slots stay reserved for the next windows, this is what the pools hold after the churn
+		ProcessMemory memory = ProcessMemoryUsage();
+		report += std::format(L"  after: resident={}KB peak resident={}KB\n", memory.mResidentBytes / 1024, memory.mPeakResidentBytes / 1024)
+			+ PoolRegistry::Get().Report();
+		return report;
+	}
+}
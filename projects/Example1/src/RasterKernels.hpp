@@ -0,0 +1,408 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <format>
+#include <vector>
+#include <algorithm>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define WMTS_RASTER_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#else
+#define WMTS_RASTER_X86 0
+#endif
+
+// MSVC compiles any intrinsic without /arch, GCC and Clang need the instruction set enabled per function
+#if WMTS_RASTER_X86 && !defined(_MSC_VER)
+#define WMTS_TARGET(isa) __attribute__((target(isa)))
+#else
+#define WMTS_TARGET(isa)
+#endif
+
+namespace WMTS {
+	// row kernels for 32 bit BGRA pixels, one implementation per instruction set
+	// every level gives bit identical results, so a frame does not change with the machine it renders on
+	enum class KernelLevel {
+		SCALAR,
+		SSE2,
+		AVX2,
+		AVX512
+	};
+
+	inline const wchar_t* KernelLevelName(KernelLevel level) {
+		switch (level) {
+		case KernelLevel::SCALAR: return L"scalar";
+		case KernelLevel::SSE2: return L"SSE2";
+		case KernelLevel::AVX2: return L"AVX2";
+		case KernelLevel::AVX512: return L"AVX-512";
+		}
+		return L"unknown";
+	}
+
+	// the best level this CPU and OS support
+	// AVX levels also need the OS to save the wider registers, which XGETBV reports
+	inline KernelLevel DetectKernelLevel() {
+#if WMTS_RASTER_X86
+		auto cpuid = [](unsigned leaf, unsigned subleaf, unsigned regs[4]) {
+#ifdef _MSC_VER
+			int info[4];
+			__cpuidex(info, (int)leaf, (int)subleaf);
+			for (int i = 0; i < 4; i++) regs[i] = (unsigned)info[i];
+#else
+			__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+		};
+
+		unsigned regs[4]{};
+		cpuid(0, 0, regs);
+		unsigned max_leaf = regs[0];
+
+		cpuid(1, 0, regs);
+		bool sse2 = (regs[3] >> 26) & 1;
+		bool osxsave = (regs[2] >> 27) & 1;
+		bool avx = (regs[2] >> 28) & 1;
+		if (!sse2) return KernelLevel::SCALAR;
+
+		uint64_t xcr0 = 0;
+		if (osxsave) {
+#ifdef _MSC_VER
+			xcr0 = _xgetbv(0);
+#else
+			unsigned eax, edx;
+			__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+			xcr0 = ((uint64_t)edx << 32) | eax;
+#endif
+		}
+		bool ymm_saved = (xcr0 & 0x6) == 0x6;
+		bool zmm_saved = (xcr0 & 0xE6) == 0xE6;
+
+		if (max_leaf < 7 || !avx || !ymm_saved) return KernelLevel::SSE2;
+		cpuid(7, 0, regs);
+		bool avx2 = (regs[1] >> 5) & 1;
+		bool avx512f = (regs[1] >> 16) & 1;
+		bool avx512bw = (regs[1] >> 30) & 1;
+
+		if (avx512f && avx512bw && zmm_saved) return KernelLevel::AVX512;
+		if (avx2) return KernelLevel::AVX2;
+		return KernelLevel::SSE2;
+#else
+		return KernelLevel::SCALAR;
+#endif
+	}
+
+	namespace Kernels {
+		// dst = src + dst * (255 - src alpha) / 255 per channel, src is premultiplied
+		// the division is the exact rounding (t + 128 + ((t + 128) >> 8)) >> 8, all levels use it
+		inline uint32_t BlendPixel(uint32_t dst, uint32_t src) {
+			uint32_t inverse = 255 - (src >> 24);
+			uint32_t result = 0;
+			for (int shift = 0; shift < 32; shift += 8) {
+				uint32_t t = ((dst >> shift) & 0xFF) * inverse + 128;
+				t = (t + (t >> 8)) >> 8;
+				result |= std::min<uint32_t>(((src >> shift) & 0xFF) + t, 255) << shift;
+			}
+			return result;
+		}
+
+		// scalar, also the tail of every SIMD loop
+
+		inline void FillScalar(uint32_t* dst, size_t count, uint32_t color) {
+			for (size_t i{}; i < count; i++) dst[i] = color;
+		}
+
+		inline void BlendScalar(uint32_t* dst, const uint32_t* src, size_t count) {
+			for (size_t i{}; i < count; i++) dst[i] = BlendPixel(dst[i], src[i]);
+		}
+
+		// dst[i] = src[(start + i * step) >> 16], 16.16 fixed point
+		inline void ScaleScalar(uint32_t* dst, size_t count, const uint32_t* src, uint32_t start, uint32_t step) {
+			for (size_t i{}; i < count; i++) dst[i] = src[(start + (uint32_t)i * step) >> 16];
+		}
+
+#if WMTS_RASTER_X86
+		// SSE2, 4 pixels per step
+
+		WMTS_TARGET("sse2") inline void FillSSE2(uint32_t* dst, size_t count, uint32_t color) {
+			__m128i value = _mm_set1_epi32((int)color);
+			size_t i = 0;
+			for (; i + 4 <= count; i += 4) _mm_storeu_si128((__m128i*)(dst + i), value);
+			FillScalar(dst + i, count - i, color);
+		}
+
+		WMTS_TARGET("sse2") inline __m128i BlendSSE2x4(__m128i d, __m128i s) {
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i c255 = _mm_set1_epi16(255);
+			const __m128i c128 = _mm_set1_epi16(128);
+
+			__m128i dlo = _mm_unpacklo_epi8(d, zero);
+			__m128i dhi = _mm_unpackhi_epi8(d, zero);
+			__m128i slo = _mm_unpacklo_epi8(s, zero);
+			__m128i shi = _mm_unpackhi_epi8(s, zero);
+
+			// alpha of each pixel in all four of its 16 bit lanes
+			__m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(slo, 0xFF), 0xFF);
+			__m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(shi, 0xFF), 0xFF);
+
+			dlo = _mm_add_epi16(_mm_mullo_epi16(dlo, _mm_sub_epi16(c255, alo)), c128);
+			dhi = _mm_add_epi16(_mm_mullo_epi16(dhi, _mm_sub_epi16(c255, ahi)), c128);
+			dlo = _mm_srli_epi16(_mm_add_epi16(dlo, _mm_srli_epi16(dlo, 8)), 8);
+			dhi = _mm_srli_epi16(_mm_add_epi16(dhi, _mm_srli_epi16(dhi, 8)), 8);
+
+			return _mm_adds_epu8(_mm_packus_epi16(dlo, dhi), s);
+		}
+
+		WMTS_TARGET("sse2") inline void BlendSSE2(uint32_t* dst, const uint32_t* src, size_t count) {
+			size_t i = 0;
+			for (; i + 4 <= count; i += 4) {
+				__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+				__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+				_mm_storeu_si128((__m128i*)(dst + i), BlendSSE2x4(d, s));
+			}
+			BlendScalar(dst + i, src + i, count - i);
+		}
+
+		// SSE2 has no gather, the indices are still computed four at a time
+		WMTS_TARGET("sse2") inline void ScaleSSE2(uint32_t* dst, size_t count, const uint32_t* src, uint32_t start, uint32_t step) {
+			size_t i = 0;
+			for (; i + 4 <= count; i += 4) {
+				uint32_t base = start + (uint32_t)i * step;
+				__m128i value = _mm_set_epi32(
+					(int)src[(base + 3 * step) >> 16], (int)src[(base + 2 * step) >> 16],
+					(int)src[(base + step) >> 16], (int)src[base >> 16]);
+				_mm_storeu_si128((__m128i*)(dst + i), value);
+			}
+			ScaleScalar(dst + i, count - i, src, start + (uint32_t)i * step, step);
+		}
+
+		// AVX2, 8 pixels per step
+
+		WMTS_TARGET("avx2") inline void FillAVX2(uint32_t* dst, size_t count, uint32_t color) {
+			__m256i value = _mm256_set1_epi32((int)color);
+			size_t i = 0;
+			for (; i + 8 <= count; i += 8) _mm256_storeu_si256((__m256i*)(dst + i), value);
+			FillScalar(dst + i, count - i, color);
+		}
+
+		WMTS_TARGET("avx2") inline void BlendAVX2(uint32_t* dst, const uint32_t* src, size_t count) {
+			const __m256i zero = _mm256_setzero_si256();
+			const __m256i c255 = _mm256_set1_epi16(255);
+			const __m256i c128 = _mm256_set1_epi16(128);
+
+			size_t i = 0;
+			for (; i + 8 <= count; i += 8) {
+				__m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+				__m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+
+				// unpack and pack both work within 128 bit lanes, so the pixel order comes back unchanged
+				__m256i dlo = _mm256_unpacklo_epi8(d, zero);
+				__m256i dhi = _mm256_unpackhi_epi8(d, zero);
+				__m256i slo = _mm256_unpacklo_epi8(s, zero);
+				__m256i shi = _mm256_unpackhi_epi8(s, zero);
+
+				__m256i alo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(slo, 0xFF), 0xFF);
+				__m256i ahi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(shi, 0xFF), 0xFF);
+
+				dlo = _mm256_add_epi16(_mm256_mullo_epi16(dlo, _mm256_sub_epi16(c255, alo)), c128);
+				dhi = _mm256_add_epi16(_mm256_mullo_epi16(dhi, _mm256_sub_epi16(c255, ahi)), c128);
+				dlo = _mm256_srli_epi16(_mm256_add_epi16(dlo, _mm256_srli_epi16(dlo, 8)), 8);
+				dhi = _mm256_srli_epi16(_mm256_add_epi16(dhi, _mm256_srli_epi16(dhi, 8)), 8);
+
+				_mm256_storeu_si256((__m256i*)(dst + i), _mm256_adds_epu8(_mm256_packus_epi16(dlo, dhi), s));
+			}
+			BlendScalar(dst + i, src + i, count - i);
+		}
+
+		WMTS_TARGET("avx2") inline void ScaleAVX2(uint32_t* dst, size_t count, const uint32_t* src, uint32_t start, uint32_t step) {
+			__m256i position = _mm256_add_epi32(_mm256_set1_epi32((int)start),
+				_mm256_mullo_epi32(_mm256_set1_epi32((int)step), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+			__m256i advance = _mm256_set1_epi32((int)(step * 8));
+
+			size_t i = 0;
+			for (; i + 8 <= count; i += 8) {
+				__m256i index = _mm256_srli_epi32(position, 16);
+				_mm256_storeu_si256((__m256i*)(dst + i), _mm256_i32gather_epi32((const int*)src, index, 4));
+				position = _mm256_add_epi32(position, advance);
+			}
+			ScaleScalar(dst + i, count - i, src, start + (uint32_t)i * step, step);
+		}
+
+		// AVX-512 (F and BW), 16 pixels per step, the tail is a masked store instead of a scalar loop
+
+		WMTS_TARGET("avx512f,avx512bw") inline void FillAVX512(uint32_t* dst, size_t count, uint32_t color) {
+			__m512i value = _mm512_set1_epi32((int)color);
+			size_t i = 0;
+			for (; i + 16 <= count; i += 16) _mm512_storeu_si512((void*)(dst + i), value);
+			if (i < count) {
+				__mmask16 tail = (__mmask16)((1u << (count - i)) - 1);
+				_mm512_mask_storeu_epi32((void*)(dst + i), tail, value);
+			}
+		}
+
+		WMTS_TARGET("avx512f,avx512bw") inline void BlendAVX512(uint32_t* dst, const uint32_t* src, size_t count) {
+			const __m512i zero = _mm512_setzero_si512();
+			const __m512i c255 = _mm512_set1_epi16(255);
+			const __m512i c128 = _mm512_set1_epi16(128);
+
+			size_t i = 0;
+			while (i < count) {
+				size_t n = std::min<size_t>(count - i, 16);
+				__mmask16 mask = (__mmask16)(n == 16 ? 0xFFFF : (1u << n) - 1);
+				__m512i d = _mm512_maskz_loadu_epi32(mask, (const void*)(dst + i));
+				__m512i s = _mm512_maskz_loadu_epi32(mask, (const void*)(src + i));
+
+				__m512i dlo = _mm512_unpacklo_epi8(d, zero);
+				__m512i dhi = _mm512_unpackhi_epi8(d, zero);
+				__m512i slo = _mm512_unpacklo_epi8(s, zero);
+				__m512i shi = _mm512_unpackhi_epi8(s, zero);
+
+				__m512i alo = _mm512_shufflehi_epi16(_mm512_shufflelo_epi16(slo, 0xFF), 0xFF);
+				__m512i ahi = _mm512_shufflehi_epi16(_mm512_shufflelo_epi16(shi, 0xFF), 0xFF);
+
+				dlo = _mm512_add_epi16(_mm512_mullo_epi16(dlo, _mm512_sub_epi16(c255, alo)), c128);
+				dhi = _mm512_add_epi16(_mm512_mullo_epi16(dhi, _mm512_sub_epi16(c255, ahi)), c128);
+				dlo = _mm512_srli_epi16(_mm512_add_epi16(dlo, _mm512_srli_epi16(dlo, 8)), 8);
+				dhi = _mm512_srli_epi16(_mm512_add_epi16(dhi, _mm512_srli_epi16(dhi, 8)), 8);
+
+				_mm512_mask_storeu_epi32((void*)(dst + i), mask, _mm512_adds_epu8(_mm512_packus_epi16(dlo, dhi), s));
+				i += n;
+			}
+		}
+
+		WMTS_TARGET("avx512f,avx512bw") inline void ScaleAVX512(uint32_t* dst, size_t count, const uint32_t* src, uint32_t start, uint32_t step) {
+			__m512i position = _mm512_add_epi32(_mm512_set1_epi32((int)start),
+				_mm512_mullo_epi32(_mm512_set1_epi32((int)step), _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)));
+			__m512i advance = _mm512_set1_epi32((int)(step * 16));
+			// the unmasked srli and gather start from _mm512_undefined_epi32() in GCC's headers, which
+			// -Wmaybe-uninitialized reports, the full mask forms with a zero source compile to the same instructions
+			const __m512i zero = _mm512_setzero_si512();
+			const __mmask16 all = 0xFFFF;
+
+			size_t i = 0;
+			for (; i + 16 <= count; i += 16) {
+				__m512i index = _mm512_maskz_srli_epi32(all, position, 16);
+				_mm512_storeu_si512((void*)(dst + i), _mm512_mask_i32gather_epi32(zero, all, index, (const void*)src, 4));
+				position = _mm512_add_epi32(position, advance);
+			}
+			ScaleScalar(dst + i, count - i, src, start + (uint32_t)i * step, step);
+		}
+#endif
+
+		// plain copies go through memmove, the C runtime already picks the widest stores the CPU has
+		inline void Copy(uint32_t* dst, const uint32_t* src, size_t count) {
+			std::memmove(dst, src, count * sizeof(uint32_t));
+		}
+	}
+
+	// one set of row kernels
+	struct RasterKernelTable {
+		KernelLevel mLevel;
+
+		// dst[0..count) = color
+		void (*Fill)(uint32_t* dst, size_t count, uint32_t color);
+
+		// dst[0..count) = src[0..count), the ranges may overlap
+		void (*Copy)(uint32_t* dst, const uint32_t* src, size_t count);
+
+		// premultiplied source over destination
+		void (*Blend)(uint32_t* dst, const uint32_t* src, size_t count);
+
+		// nearest neighbour resample, dst[i] = src[(start + i * step) >> 16]
+		void (*Scale)(uint32_t* dst, size_t count, const uint32_t* src, uint32_t start, uint32_t step);
+	};
+
+	// the kernels for a level, a level the build cannot use falls back to the next lower one
+	inline RasterKernelTable KernelTableFor(KernelLevel level) {
+#if WMTS_RASTER_X86
+		switch (level) {
+		case KernelLevel::AVX512:
+			return { KernelLevel::AVX512, Kernels::FillAVX512, Kernels::Copy, Kernels::BlendAVX512, Kernels::ScaleAVX512 };
+		case KernelLevel::AVX2:
+			return { KernelLevel::AVX2, Kernels::FillAVX2, Kernels::Copy, Kernels::BlendAVX2, Kernels::ScaleAVX2 };
+		case KernelLevel::SSE2:
+			return { KernelLevel::SSE2, Kernels::FillSSE2, Kernels::Copy, Kernels::BlendSSE2, Kernels::ScaleSSE2 };
+		default:
+			break;
+		}
+#endif
+		return { KernelLevel::SCALAR, Kernels::FillScalar, Kernels::Copy, Kernels::BlendScalar, Kernels::ScaleScalar };
+	}
+
+	// the process wide kernel table, picked with CPUID on first use
+	class RasterKernels {
+	public:
+		static const RasterKernelTable& Get() {
+			return *Active().load(std::memory_order_acquire);
+		}
+
+		// forces a level, for comparing levels or ruling out a kernel while debugging
+		// a level above what the CPU supports is clamped to the detected one
+		static void SetLevel(KernelLevel level) {
+			level = std::min(level, Detected());
+			Active().store(&Tables()[(size_t)level], std::memory_order_release);
+		}
+
+		static KernelLevel Detected() {
+			static const KernelLevel detected = DetectKernelLevel();
+			return detected;
+		}
+
+	private:
+		static RasterKernelTable* Tables() {
+			static RasterKernelTable tables[4] = {
+				KernelTableFor(KernelLevel::SCALAR),
+				KernelTableFor(KernelLevel::SSE2),
+				KernelTableFor(KernelLevel::AVX2),
+				KernelTableFor(KernelLevel::AVX512) };
+			return tables;
+		}
+
+		static std::atomic<const RasterKernelTable*>& Active() {
+			static std::atomic<const RasterKernelTable*> active{ &Tables()[(size_t)Detected()] };
+			return active;
+		}
+	};
+
+	// measures every kernel at every level the CPU supports on a width x height surface
+	// reports bytes written per second (blend and scale also read, that traffic is not counted)
+	// takes a few hundred milliseconds, not for a frame, Example1 --benchmark-kernels runs it at 1920x1080
+	inline std::wstring BenchmarkRasterKernels(uint32_t width, uint32_t height, int repeats = 20) {
+		size_t pixels = (size_t)width * height;
+		std::vector<uint32_t> dst(pixels), src(pixels), half((size_t)(width / 2 + 1) * (height / 2 + 1));
+		for (size_t i{}; i < pixels; i++) src[i] = (uint32_t)(i * 2654435761u) | 0x80000000u;
+
+		auto rate = [&](auto&& run) {
+			auto start = std::chrono::steady_clock::now();
+			for (int r = 0; r < repeats; r++) run();
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			return seconds > 0 ? (double)pixels * sizeof(uint32_t) * repeats / seconds / 1e9 : 0.0;
+		};
+
+		std::wstring report = std::format(L"Raster kernels on {}x{}, GB/s written (detected {}):\n", width, height, KernelLevelName(RasterKernels::Detected()));
+		for (int level = 0; level <= (int)RasterKernels::Detected(); level++) {
+			RasterKernelTable table = KernelTableFor((KernelLevel)level);
+			uint32_t half_width = width / 2 + 1;
+			uint32_t step = (uint32_t)(((uint64_t)half_width << 16) / std::max<uint32_t>(width, 1));
+
+			double fill = rate([&] { table.Fill(dst.data(), pixels, 0xFF336699u); });
+			double copy = rate([&] { table.Copy(dst.data(), src.data(), pixels); });
+			double blend = rate([&] { table.Blend(dst.data(), src.data(), pixels); });
+			double scale = rate([&] {
+				for (uint32_t y{}; y < height; y++) {
+					table.Scale(dst.data() + (size_t)y * width, width, half.data() + (size_t)(y / 2) * half_width, 0, step);
+				}
+			});
+			report += std::format(L"  {:<8} fill={:.2f} copy={:.2f} blend={:.2f} scale={:.2f}\n",
+				KernelLevelName((KernelLevel)level), fill, copy, blend, scale);
+		}
+		return report;
+	}
+}
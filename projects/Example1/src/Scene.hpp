@@ -0,0 +1,50 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cwchar>
+#include <algorithm>
+#include "Framebuffer.hpp"
+#include "TiledRaster.hpp"
+#include "Damage.hpp"
+#include "Text.hpp"
+
+// what a window's logic thread draws each tick when RenderFrame() is not overridden, and the steps that turn the
+// recorded commands into pixels, shared by MTPlainWin32Window::RunLogic() and the WMTSReplay tool
+// nothing here touches Windows.h so the replay builds and renders the same frames without a window system
+
+namespace WMTS {
+	// how often RunLogic() draws a window's frame, the replay ticks its windows at the same recorded intervals
+	constexpr std::chrono::milliseconds LogicTick{ 50 };
+
+	// the default MTPlainWin32Window::RenderFrame() scene: a block sweeping across a dark background and a status line
+	// Frame is already sized to the client area, every pixel is drawn
+	inline void DrawDefaultScene(DrawList& Frame, uint64_t FrameNumber) {
+		Frame.Clear(PackColor(32, 40, 48));
+		int32_t size = (int32_t)std::max<uint32_t>(Frame.Height() / 4, 1);
+		int32_t travel = std::max<int32_t>((int32_t)Frame.Width() - size, 1);
+		int32_t x = (int32_t)((FrameNumber * 8) % (uint64_t)(2 * travel));
+		if (x > travel) x = 2 * travel - x;
+		Frame.FillRect(x, ((int32_t)Frame.Height() - size) / 2, size, size, PackColor(240, 160, 40));
+
+		// text goes through the glyph atlas, a fixed buffer keeps the tick free of allocations
+		wchar_t status[64];
+		std::swprintf(status, 64, L"Happy Window [%.*ls] frame %llu", (int)(FrameNumber % 20) + 1, L"********************", (unsigned long long)FrameNumber);
+		DrawString(Frame, status, 8, 8, PackColor(220, 220, 220), 2);
+	}
+
+	// the tick after the frame is recorded: compares Frame with the previous frame's commands, adds what Target
+	// missed since the frame it holds (TargetFrame, 0 when its pixels are undefined), rasterizes that into Target
+	// and publishes the commands as frame Published
+	// returns only this frame's damage, Redraw holds what was rasterized
+	// when the returned region is empty nothing was rendered and Published was not used
+	inline const DamageRegion& RenderChanges(DamageTracker& Tracker, const DrawList& Frame, TiledRenderer& Renderer,
+		Framebuffer& Target, uint64_t TargetFrame, uint64_t Published, DamageRegion& Redraw) {
+		const DamageRegion& damage = Tracker.Compute(Frame);
+		if (damage.Empty()) return damage;
+
+		Tracker.Accumulate(TargetFrame, Published, Redraw);
+		Renderer.Render(Frame, Target, Redraw.Rects(), Redraw.Count());
+		Tracker.Publish(Published);
+		return damage;
+	}
+}
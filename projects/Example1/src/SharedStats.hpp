@@ -0,0 +1,244 @@
+#pragma once
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+// set WMTS_SHARED_STATS to 1 (cmake -DWMTS_SHARED_STATS=ON) to publish live stats in shared memory
+// for an external monitor such as WMTSMonitor
+#ifndef WMTS_SHARED_STATS
+#define WMTS_SHARED_STATS 0
+#endif
+
+namespace WMTS {
+	// the layout below is read by other processes, bump the version on any change
+	constexpr uint32_t SharedStatsMagic = 0x53544d57; // "WMTS"
+	constexpr uint32_t SharedStatsVersion = 1;
+	constexpr uint32_t SharedStatsMaxWindows = 256;
+
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared stats need address free 64 bit atomics");
+
+	// one window's live counters, each field is written only by the thread noted next to it
+	struct alignas(64) SharedWindowStats {
+		// the window handle as an integer, 0 means the slot is free
+		std::atomic<uint64_t> mWindowHandle;
+
+		// messages dispatched by the window's message loop (UI thread)
+		std::atomic<uint64_t> mMessages;
+
+		// RunLogic() iterations (logic thread)
+		std::atomic<uint64_t> mTicks;
+
+		// consecutive messages that had waited in the queue before dispatch, 0 when the queue keeps up (UI thread)
+		std::atomic<uint64_t> mQueueDepth;
+
+		// CPU time in nanoseconds (each thread writes its own)
+		std::atomic<uint64_t> mUiCpuNs;
+		std::atomic<uint64_t> mLogicCpuNs;
+
+		// threads serving this window (UI thread + logic thread)
+		std::atomic<uint32_t> mThreads;
+	};
+
+	struct SharedStatsHeader {
+		uint32_t mMagic;
+		uint32_t mVersion;
+		uint32_t mHeaderSize;
+		uint32_t mSlotSize;
+		uint32_t mSlotCount;
+		uint32_t mPid;
+
+		// 1 while the producer is running, 0 once it shut down
+		std::atomic<uint32_t> mAlive;
+
+		// window and logic threads alive in the process
+		std::atomic<uint32_t> mThreads;
+
+		// windows with a claimed slot
+		std::atomic<uint32_t> mWindows;
+	};
+
+	struct SharedStatsBlock {
+		SharedStatsHeader mHeader;
+		SharedWindowStats mSlots[SharedStatsMaxWindows];
+	};
+
+	static_assert(std::is_standard_layout_v<SharedStatsBlock>, "SharedStatsBlock is shared between processes");
+
+	// the shared memory name for a process id
+	inline std::string SharedStatsName(uint32_t pid) {
+#ifdef _WIN32
+		return "Local\\WMTSStats-" + std::to_string(pid);
+#else
+		return "/WMTSStats-" + std::to_string(pid);
+#endif
+	}
+
+	// owns or attaches to the named shared memory holding a SharedStatsBlock
+	class SharedStatsRegion {
+	public:
+		SharedStatsRegion() = default;
+
+		~SharedStatsRegion() {
+			Close();
+		}
+
+		SharedStatsRegion(const SharedStatsRegion&) = delete;
+		SharedStatsRegion& operator=(const SharedStatsRegion&) = delete;
+
+		// creates the region for this process, returns false if the OS refuses
+		bool Create(uint32_t pid) {
+			mName = SharedStatsName(pid);
+			mOwner = true;
+#ifdef _WIN32
+			mMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, (DWORD)sizeof(SharedStatsBlock), mName.c_str());
+			if (!mMapping) return false;
+			mBlock = (SharedStatsBlock*)MapViewOfFile(mMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SharedStatsBlock));
+#else
+			// a segment left by a crashed process with the same pid is unlinked and made anew
+			int fd = shm_open(mName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+			if (fd < 0 && errno == EEXIST) {
+				shm_unlink(mName.c_str());
+				fd = shm_open(mName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+			}
+			if (fd < 0) return false;
+			if (ftruncate(fd, sizeof(SharedStatsBlock)) != 0) {
+				close(fd);
+				return false;
+			}
+			void* view = mmap(nullptr, sizeof(SharedStatsBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			close(fd);
+			mBlock = view == MAP_FAILED ? nullptr : (SharedStatsBlock*)view;
+#endif
+			if (!mBlock) return false;
+
+			// a mapping a reader still holds open is handed back as is (ERROR_ALREADY_EXISTS on Windows),
+			// so hide the header and zero every counter before publishing it again
+			SharedStatsHeader& header = mBlock->mHeader;
+			header.mMagic = 0;
+			std::atomic_thread_fence(std::memory_order_release);
+			header.mThreads.store(0, std::memory_order_relaxed);
+			header.mWindows.store(0, std::memory_order_relaxed);
+			for (auto& slot : mBlock->mSlots) {
+				slot.mWindowHandle.store(0, std::memory_order_relaxed);
+				slot.mMessages.store(0, std::memory_order_relaxed);
+				slot.mTicks.store(0, std::memory_order_relaxed);
+				slot.mQueueDepth.store(0, std::memory_order_relaxed);
+				slot.mUiCpuNs.store(0, std::memory_order_relaxed);
+				slot.mLogicCpuNs.store(0, std::memory_order_relaxed);
+				slot.mThreads.store(0, std::memory_order_relaxed);
+			}
+
+			header.mVersion = SharedStatsVersion;
+			header.mHeaderSize = sizeof(SharedStatsHeader);
+			header.mSlotSize = sizeof(SharedWindowStats);
+			header.mSlotCount = SharedStatsMaxWindows;
+			header.mPid = pid;
+			header.mAlive.store(1, std::memory_order_relaxed);
+
+			// the magic goes last so a reader never sees a half written header
+			std::atomic_thread_fence(std::memory_order_release);
+			header.mMagic = SharedStatsMagic;
+			return true;
+		}
+
+		// attaches to another process's region, returns false if it does not exist or the layout differs
+		bool Open(uint32_t pid) {
+			mName = SharedStatsName(pid);
+			mOwner = false;
+#ifdef _WIN32
+			mMapping = OpenFileMappingA(FILE_MAP_READ, FALSE, mName.c_str());
+			if (!mMapping) return false;
+			mBlock = (SharedStatsBlock*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, sizeof(SharedStatsBlock));
+#else
+			int fd = shm_open(mName.c_str(), O_RDONLY, 0);
+			if (fd < 0) return false;
+			void* view = mmap(nullptr, sizeof(SharedStatsBlock), PROT_READ, MAP_SHARED, fd, 0);
+			close(fd);
+			mBlock = view == MAP_FAILED ? nullptr : (SharedStatsBlock*)view;
+#endif
+			if (!mBlock) return false;
+
+			const SharedStatsHeader& header = mBlock->mHeader;
+			if (header.mMagic != SharedStatsMagic || header.mVersion != SharedStatsVersion ||
+				header.mHeaderSize != sizeof(SharedStatsHeader) || header.mSlotSize != sizeof(SharedWindowStats)) {
+				Close();
+				return false;
+			}
+			return true;
+		}
+
+		void Close() {
+			if (mBlock && mOwner) {
+				mBlock->mHeader.mAlive.store(0, std::memory_order_relaxed);
+			}
+#ifdef _WIN32
+			if (mBlock) UnmapViewOfFile(mBlock);
+			if (mMapping) CloseHandle(mMapping);
+			mMapping = nullptr;
+#else
+			if (mBlock) munmap(mBlock, sizeof(SharedStatsBlock));
+			if (mBlock && mOwner) shm_unlink(mName.c_str());
+#endif
+			mBlock = nullptr;
+		}
+
+		SharedStatsBlock* Block() const { return mBlock; }
+
+		// claims a free slot for a window, nullptr if every slot is taken
+		SharedWindowStats* Claim(uint64_t WindowHandle) {
+			if (!mBlock) return nullptr;
+			for (auto& slot : mBlock->mSlots) {
+				uint64_t expected = 0;
+				if (slot.mWindowHandle.load(std::memory_order_relaxed) == 0 &&
+					slot.mWindowHandle.compare_exchange_strong(expected, WindowHandle, std::memory_order_acq_rel)) {
+					mBlock->mHeader.mWindows.fetch_add(1, std::memory_order_relaxed);
+					return &slot;
+				}
+			}
+			return nullptr;
+		}
+
+		// finds the slot a window claimed, nullptr if it has none
+		SharedWindowStats* Find(uint64_t WindowHandle) const {
+			if (!mBlock) return nullptr;
+			for (auto& slot : mBlock->mSlots) {
+				if (slot.mWindowHandle.load(std::memory_order_acquire) == WindowHandle) {
+					return &slot;
+				}
+			}
+			return nullptr;
+		}
+
+		// zeroes the counters and frees the slot for the next window
+		void Release(SharedWindowStats* slot) {
+			if (!slot || !mBlock) return;
+			slot->mMessages.store(0, std::memory_order_relaxed);
+			slot->mTicks.store(0, std::memory_order_relaxed);
+			slot->mQueueDepth.store(0, std::memory_order_relaxed);
+			slot->mUiCpuNs.store(0, std::memory_order_relaxed);
+			slot->mLogicCpuNs.store(0, std::memory_order_relaxed);
+			slot->mThreads.store(0, std::memory_order_relaxed);
+			slot->mWindowHandle.store(0, std::memory_order_release);
+			mBlock->mHeader.mWindows.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+	private:
+		std::string mName;
+		bool mOwner{ false };
+		SharedStatsBlock* mBlock{ nullptr };
+#ifdef _WIN32
+		HANDLE mMapping{ nullptr };
+#endif
+	};
+}
@@ -0,0 +1,333 @@
+#pragma once
+#include <chrono>
+#include <format>
+#include <string>
+#include <thread>
+#include "iWindow.hpp"
+
+namespace WMTS {
+	// a compile time alternative to iWindow / iWindowClass / PlainWin32Window
+	// Derived customizes the window by hiding any of the hooks below with a member of the same name,
+	// the base reaches them through static_cast<Derived*> so every call binds at compile time
+	// and the derived WindowProcedure can be inlined straight into the window procedure Windows calls
+	//
+	// the hooks are called from the base, so Derived either makes them public or declares
+	// friend class WMTS::StaticWindow<Derived>;
+	//
+	// a Derived with a nested MessageMap (a StaticMessageMap) has it checked before WindowProcedure
+	//
+	// nothing runs from the constructor, call Run() (or Create() then ProcessMessage()) on the thread
+	// that should own the window, so overriding WindowInit() is safe here unlike in PlainWin32Window
+	template<class Derived>
+	class StaticWindow {
+	public:
+		StaticWindow() = default;
+
+		StaticWindow(const StaticWindow&) = delete;
+		StaticWindow& operator=(const StaticWindow&) = delete;
+
+		// creates the window and runs its message loop on the calling thread until it closes
+		int Run() {
+			if (!Create()) return -1;
+			return Self().ProcessMessage();
+		}
+
+		// runs the hooks in order: WindowInit(), SetWindowClass(), RegisterWindowClass(), CreateAWindow()
+		// returns false if the window could not be created
+		bool Create() {
+			Derived& self = Self();
+			self.WindowInit();
+			self.SetWindowClass();
+			self.RegisterWindowClass();
+			return self.CreateAWindow();
+		}
+
+		HWND GetHandle() const {
+			return mWindowHandle;
+		}
+
+		// shares the dimensions kept up to date by the default WM_SIZE handling
+		// logs an error and returns zeros if the window has not been created
+		WindowDimensions GetWindowSize() const {
+			if (mDimensions.has_value()) {
+				return mDimensions.value();
+			}
+			return WindowDimensions(mWindowHandle);
+		}
+
+	protected:
+		// default hooks, hide any of them in Derived
+
+		void WindowInit() {
+			mWindowClassName = L"StaticWin32Window";
+			mWindowTitle = L"StaticWin32Window";
+
+			// half the screen in each direction, like PlainWin32Window
+			mWindowWidthINIT = GetSystemMetrics(SM_CXSCREEN) / 2;
+			mWindowHeightINIT = GetSystemMetrics(SM_CYSCREEN) / 2;
+		}
+
+		void SetWindowClass() {
+			mWCEX.cbSize = sizeof(WNDCLASSEXW);
+			mWCEX.style = CS_HREDRAW | CS_VREDRAW;
+			mWCEX.lpfnWndProc = StaticWindowProc;
+			mWCEX.cbClsExtra = 0;
+			mWCEX.cbWndExtra = 0;
+			mWCEX.hInstance = mHinstance;
+			mWCEX.hIcon = NULL;
+			mWCEX.hCursor = LoadCursor(nullptr, IDC_ARROW);
+			mWCEX.hbrBackground = (HBRUSH)(COLOR_WINDOW + 1);
+			mWCEX.lpszMenuName = nullptr;
+			mWCEX.lpszClassName = mWindowClassName.c_str();
+			mWCEX.hIconSm = NULL;
+		}
+
+		// several windows of the same Derived type share one class, the second registration is not an error
+		void RegisterWindowClass() {
+			if (!RegisterClassExW(&mWCEX) && GetLastError() != ERROR_CLASS_ALREADY_EXISTS) {
+				logger log(Error::FATAL, WMTS_LOCATION);
+				log.to_console();
+				log.to_output();
+				log.to_log_file();
+				throw std::runtime_error("Failed to Register Windows Class mWCEX in the StaticWindow Class");
+			}
+		}
+
+		bool CreateAWindow() {
+			// the Derived pointer is passed so StaticWindowProc can cast it back without adjustment
+			HWND hwnd = CreateWindowW(
+				mWindowClassName.c_str(),
+				mWindowTitle.c_str(),
+				WS_OVERLAPPEDWINDOW,
+				CW_USEDEFAULT,
+				0,
+				mWindowWidthINIT,
+				mWindowHeightINIT,
+				nullptr,
+				nullptr,
+				mHinstance,
+				&Self());
+
+			if (!IsWindow(hwnd)) {
+				logger log(Error::FATAL, WMTS_LOCATION);
+				log.to_console();
+				log.to_output();
+				log.to_log_file();
+				return false;
+			}
+
+			mWindowHandle = hwnd;
+			mDimensions.emplace(hwnd);
+
+			// show window, because it starts as hidden
+			ShowWindow(hwnd, SW_SHOWDEFAULT);
+			return true;
+		}
+
+		int ProcessMessage() {
+			MSG msg{};
+			while (GetMessage(&msg, nullptr, 0, 0)) {
+				TranslateMessage(&msg);
+				DispatchMessage(&msg);
+			}
+			return (int)msg.wParam;
+		}
+
+		// the default handling, a Derived WindowProcedure falls back to it with
+		// return StaticWindow<Derived>::WindowProcedure(hwnd, message, wParam, lParam);
+		LRESULT WindowProcedure(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
+			switch (message) {
+			case WM_SIZE:
+			case WM_SIZING: {
+				if (mDimensions.has_value()) {
+					mDimensions->UpdateWindowDimensions(hwnd);
+				}
+				break;
+			}
+			case WM_PAINT: {
+				PAINTSTRUCT ps{};
+				BeginPaint(hwnd, &ps);
+				EndPaint(hwnd, &ps);
+				return 0;
+			}
+			case WM_DESTROY: {
+				mWindowHandle = nullptr;
+				PostQuitMessage(0);
+				return 0;
+			}
+			default:
+				break;
+			}
+			return DefWindowProc(hwnd, message, wParam, lParam);
+		}
+
+		// the procedure Windows calls, one instantiation per Derived type
+		// no virtual call, Derived::WindowProcedure is known here at compile time
+		static LRESULT CALLBACK StaticWindowProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
+			Derived* window = nullptr;
+			if (message == WM_NCCREATE) {
+				CREATESTRUCT* pCreate = reinterpret_cast<CREATESTRUCT*>(lParam);
+				window = reinterpret_cast<Derived*>(pCreate->lpCreateParams);
+				SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR)window);
+			}
+			else {
+				window = reinterpret_cast<Derived*>(GetWindowLongPtr(hwnd, GWLP_USERDATA));
+			}
+
+			if (window) {
+				if constexpr (requires { typename Derived::MessageMap; }) {
+					LRESULT result;
+					if (Derived::MessageMap::Dispatch(*window, hwnd, message, wParam, lParam, result)) {
+						return result;
+					}
+				}
+				return window->WindowProcedure(hwnd, message, wParam, lParam);
+			}
+			return DefWindowProc(hwnd, message, wParam, lParam);
+		}
+
+		Derived& Self() {
+			return static_cast<Derived&>(*this);
+		}
+
+		WNDCLASSEXW mWCEX{};
+		std::wstring mWindowClassName;
+		std::wstring mWindowTitle;
+		HINSTANCE mHinstance{ GetModuleHandle(NULL) };
+
+		// initial size for the window when it is first created
+		UINT mWindowWidthINIT{};
+		UINT mWindowHeightINIT{};
+
+		HWND mWindowHandle{ nullptr };
+
+		// set once the window exists, optional because WindowDimensions cannot be reassigned
+		std::optional<WindowDimensions> mDimensions;
+	};
+
+	// the windows BenchmarkDispatch() times
+	// the virtual path, the window is created by PlainWin32Window's constructor
+	struct DispatchBenchmarkVirtualWindow :public PlainWin32Window {
+		bool mHandleMove{ false };
+
+		LRESULT CALLBACK WindowProcedure(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) override {
+			if (mHandleMove && message == WM_MOUSEMOVE) return 0;
+			return PlainWin32Window::WindowProcedure(hwnd, message, wParam, lParam);
+		}
+
+		static LRESULT Procedure(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
+			return window_proc_proxy(hwnd, message, wParam, lParam);
+		}
+
+		HWND Handle() {
+			return GetHandle();
+		}
+	};
+
+	struct DispatchBenchmarkStaticWindow :public StaticWindow<DispatchBenchmarkStaticWindow> {
+		bool mHandleMove{ false };
+
+		void WindowInit() {
+			StaticWindow::WindowInit();
+			mWindowClassName = L"WMTSDispatchBenchmark";
+		}
+
+		LRESULT WindowProcedure(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
+			if (mHandleMove && message == WM_MOUSEMOVE) return 0;
+			return StaticWindow::WindowProcedure(hwnd, message, wParam, lParam);
+		}
+
+		static LRESULT Procedure(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
+			return StaticWindowProc(hwnd, message, wParam, lParam);
+		}
+	};
+
+	// the same window with the move handled by its MessageMap, its own class so it gets its own procedure
+	struct DispatchBenchmarkMappedWindow :public StaticWindow<DispatchBenchmarkMappedWindow> {
+		void WindowInit() {
+			StaticWindow::WindowInit();
+			mWindowClassName = L"WMTSDispatchBenchmarkMap";
+		}
+
+		LRESULT OnMouseMove(HWND, UINT, WPARAM, LPARAM) {
+			return 0;
+		}
+
+		using MessageMap = StaticMessageMap<OnMessage<WM_MOUSEMOVE, &DispatchBenchmarkMappedWindow::OnMouseMove>>;
+
+		static LRESULT Procedure(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
+			return StaticWindowProc(hwnd, message, wParam, lParam);
+		}
+	};
+
+	// compares the cost of dispatching one WM_MOUSEMOVE through the virtual window classes and through StaticWindow
+	// each path gets a real window, hidden right after it is created, and Messages calls of the procedure Windows
+	// would call for it, window_proc_proxy or StaticWindowProc, so the GWLP_USERDATA lookup is included
+	// "default" rows fall through to DefWindowProc like an unhandled move, "handled" rows return 0 from WindowProcedure,
+	// from a handler registered with on() or from a StaticMessageMap entry
+	// runs on its own thread so the WM_QUIT of the closing windows stays there, and unregisters its classes after
+	// PlainWin32Window registers the same class, so it runs before ExecuteThreads(), as Example1 --benchmark-dispatch does
+	inline std::wstring BenchmarkDispatch(uint64_t Messages = 10'000'000) {
+		std::wstring report = std::format(L"Message dispatch, WM_MOUSEMOVE x {}, per message:\n", Messages);
+
+		std::thread bench([&]() {
+			auto measure = [&](const wchar_t* name, auto procedure, HWND hwnd) {
+				// the result is summed so the calls cannot be dropped
+				LRESULT sum = 0;
+				auto start = std::chrono::steady_clock::now();
+				for (uint64_t i{}; i < Messages; i++) {
+					sum += procedure(hwnd, WM_MOUSEMOVE, 0, MAKELPARAM(i & 1023, (i >> 10) & 1023));
+				}
+				double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+				report += std::format(L"  {} {:.2f}ns (sum {})\n", name, ns / (double)Messages, (long long)sum);
+			};
+
+			try {
+				DispatchBenchmarkVirtualWindow virtual_window;
+				HWND virtual_handle = virtual_window.Handle();
+				ShowWindow(virtual_handle, SW_HIDE);
+
+				DispatchBenchmarkStaticWindow static_window;
+				DispatchBenchmarkMappedWindow mapped_window;
+				if (!static_window.Create() || !mapped_window.Create()) {
+					report += L"  the StaticWindows could not be created\n";
+					if (static_window.GetHandle()) DestroyWindow(static_window.GetHandle());
+					DestroyWindow(virtual_handle);
+					return;
+				}
+				HWND static_handle = static_window.GetHandle();
+				HWND mapped_handle = mapped_window.GetHandle();
+				ShowWindow(static_handle, SW_HIDE);
+				ShowWindow(mapped_handle, SW_HIDE);
+
+				measure(L"virtual, default     ", &DispatchBenchmarkVirtualWindow::Procedure, virtual_handle);
+				measure(L"StaticWindow, default", &DispatchBenchmarkStaticWindow::Procedure, static_handle);
+				virtual_window.mHandleMove = true;
+				static_window.mHandleMove = true;
+				measure(L"virtual, handled     ", &DispatchBenchmarkVirtualWindow::Procedure, virtual_handle);
+				measure(L"StaticWindow, handled", &DispatchBenchmarkStaticWindow::Procedure, static_handle);
+
+				virtual_window.mHandleMove = false;
+				virtual_window.on(WM_MOUSEMOVE, [](HWND, UINT, WPARAM, LPARAM) -> LRESULT { return 0; });
+				measure(L"on() table, handled  ", &DispatchBenchmarkVirtualWindow::Procedure, virtual_handle);
+				virtual_window.off(WM_MOUSEMOVE);
+				measure(L"StaticMessageMap     ", &DispatchBenchmarkMappedWindow::Procedure, mapped_handle);
+
+				DestroyWindow(mapped_handle);
+				DestroyWindow(static_handle);
+				DestroyWindow(virtual_handle);
+			}
+			catch (const std::runtime_error& e) {
+				// PlainWin32Window throws when its class is already registered by the running windows
+				report += L"  could not create the windows: ";
+				for (const char* c = e.what(); *c; c++) report.push_back((wchar_t)*c);
+				report += L"\n";
+			}
+			UnregisterClassW(L"Win32Window", GetModuleHandle(NULL));
+			UnregisterClassW(L"WMTSDispatchBenchmark", GetModuleHandle(NULL));
+			UnregisterClassW(L"WMTSDispatchBenchmarkMap", GetModuleHandle(NULL));
+		});
+		bench.join();
+		return report;
+	}
+}
@@ -0,0 +1,451 @@
+#pragma once
+#include <Windows.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <format>
+#include <filesystem>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include "Framebuffer.hpp"
+#include "Histogram.hpp"
+#include "TripleBuffer.hpp"
+#include "SurfacePool.hpp"
+#include "Pool.hpp"
+#include "Damage.hpp"
+#include "Capture.hpp"
+#include "SurfaceExport.hpp"
+#include "AllocTracking.hpp"
+
+namespace WMTS {
+	// where a window's finished frames go
+	enum class PresentMode {
+		// the logic thread invalidates the window and WM_PAINT blits the frame on the UI thread
+		WIN32_BLIT,
+		// frames are rendered and counted but never shown, for benchmarks and machines without a desktop
+		HEADLESS,
+		// like HEADLESS, and every mDumpEvery-th frame is written as a BMP next to WMTSlog.txt
+		HEADLESS_DUMP
+	};
+
+	struct PresentConfig {
+		PresentMode mMode{ PresentMode::WIN32_BLIT };
+		uint32_t mDumpEvery{ 60 };
+	};
+
+	// a copy of one window's frame counters, or of several added up
+	struct FrameStats {
+		uint64_t mFrames{};
+		uint64_t mPresents{};
+
+		// frames replaced by a newer one before the UI thread presented them
+		uint64_t mReplaced{};
+
+		// frames written by HEADLESS_DUMP
+		uint64_t mDumps{};
+
+		// ticks where nothing changed, nothing was rendered or presented
+		uint64_t mUnchanged{};
+
+		// pixels rendered into back buffers and copied to the screen, only damaged regions are touched
+		uint64_t mPixelsRendered{};
+		uint64_t mPixelsPresented{};
+
+		// the logic thread's time in RenderFrame() per frame
+		LatencyHistogram::Snapshot mFrameTime;
+
+		// the UI thread's time in the blit per WM_PAINT, or the dump time in HEADLESS_DUMP
+		LatencyHistogram::Snapshot mPresentTime;
+
+		// from EndFrame() publishing a frame to the UI thread taking it for its first present
+		LatencyHistogram::Snapshot mHandoffTime;
+
+		FrameStats& operator+=(const FrameStats& other) {
+			mFrames += other.mFrames;
+			mPresents += other.mPresents;
+			mReplaced += other.mReplaced;
+			mDumps += other.mDumps;
+			mUnchanged += other.mUnchanged;
+			mPixelsRendered += other.mPixelsRendered;
+			mPixelsPresented += other.mPixelsPresented;
+			mFrameTime += other.mFrameTime;
+			mPresentTime += other.mPresentTime;
+			mHandoffTime += other.mHandoffTime;
+			return *this;
+		}
+
+		std::wstring Report() const {
+			return std::format(L"frames={} unchanged ticks={} presents={} replaced before present={} dumps={}\n"
+				L"  pixels rendered per frame={} presented per present={}\n"
+				L"  frame time {}\n"
+				L"  present    {}\n"
+				L"  handoff    {}\n",
+				mFrames, mUnchanged, mPresents, mReplaced, mDumps,
+				mFrames ? mPixelsRendered / mFrames : 0, mPresents ? mPixelsPresented / mPresents : 0,
+				mFrameTime.Summary(), mPresentTime.Summary(), mHandoffTime.Summary());
+		}
+	};
+
+	// one of a window's three framebuffers and the published frame it holds
+	struct SurfaceFrame {
+		Framebuffer mPixels;
+
+		// the published frame number, 0 while the pixels hold none
+		uint64_t mNumber{};
+
+		// steady clock nanoseconds when EndFrame() published it
+		uint64_t mPublishedNs{};
+
+		// the growth slack was given back after the window's size settled
+		bool mTrimmed{ false };
+
+		// what changed since the frame before and the whole window's size, only set when frames are captured or exported
+		DamageRegion mDamage;
+		uint32_t mWindowWidth{};
+		uint32_t mWindowHeight{};
+
+		// the frame's record in the capture ring, NoCaptureRecord when it has none
+		uint64_t mCaptureRecord{ NoCaptureRecord };
+	};
+
+	// a window's CPU framebuffers, handed from the logic thread to the UI thread through a TripleBuffer
+	// the logic thread always has a buffer to render into and the UI thread always presents the newest
+	// finished frame, neither waits for the other and frames the UI thread had no time for are skipped
+	// each buffer remembers which published frame it holds, so a frame only redraws what changed since then
+	class WindowSurface {
+	public:
+		explicit WindowSurface(const PresentConfig& config = {})
+			:mConfig(config), mSettleFrames(SurfacePool::Get().Config().mSettleFrames) {}
+
+		WindowSurface(const WindowSurface&) = delete;
+		WindowSurface& operator=(const WindowSurface&) = delete;
+
+		// logic thread, returns the back buffer sized to the client area
+		// the buffers come from the SurfacePool with slack, so a resize storm only allocates now and then,
+		// and a buffer gives the slack back once the size has held for the pool's mSettleFrames
+		Framebuffer& BeginFrame(uint32_t width, uint32_t height) {
+			if (width != mWidth || height != mHeight) {
+				mWidth = width;
+				mHeight = height;
+				mSteadyFrames = 0;
+			}
+			else if (mSteadyFrames < mSettleFrames) {
+				mSteadyFrames++;
+			}
+
+			SurfaceFrame& back = mMailbox.Back();
+			if (back.mPixels.Width() != width || back.mPixels.Height() != height) {
+				// resized pixels are undefined, the next frame must redraw all of them
+				back.mPixels.Resize(width, height);
+				back.mNumber = 0;
+				back.mTrimmed = false;
+			}
+			else if (!back.mTrimmed && mSteadyFrames >= mSettleFrames) {
+				back.mPixels.Trim();
+				back.mTrimmed = true;
+			}
+			mFrameStart = std::chrono::steady_clock::now();
+			return back.mPixels;
+		}
+
+		// logic thread, the published frame the back buffer holds, 0 if it holds none
+		// the buffer that comes back from the UI thread can be several frames old
+		uint64_t BackContentFrame() {
+			return mMailbox.Back().mNumber;
+		}
+
+		// logic thread, the number EndFrame() gives the frame being rendered
+		uint64_t NextFrameNumber() const {
+			return mFrames.load(std::memory_order_relaxed) + 1;
+		}
+
+		// logic thread, counts a tick that had nothing to redraw
+		void SkipFrame() {
+			mUnchanged.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		// logic thread, before EndFrame(), what the frame changed and the window's size for the capture and the export
+		// only rectangles are kept, EndFrame() copies the pixels into the capture and the thread presenting the frame
+		// copies them into the export
+		void DescribeFrame(const DamageRegion& damage, uint32_t WindowWidth, uint32_t WindowHeight) {
+			SurfaceFrame& back = mMailbox.Back();
+			back.mDamage = damage;
+			back.mWindowWidth = WindowWidth;
+			back.mWindowHeight = WindowHeight;
+		}
+
+		// call before the logic thread starts, every frame published from then on is written to the ring
+		// the logic thread copies it right after publishing it, the UI thread only learns its record
+		void AttachCapture(CaptureRing& ring, HWND WindowHandle, uint32_t KeyframeEvery) {
+			mCapture.Attach(&ring, (uint64_t)WindowHandle, KeyframeEvery);
+		}
+
+		// call before the logic thread starts, every frame presented from then on is also published in a named
+		// shared memory segment for other processes, returns false if the segment could not be created
+		bool AttachExport(uint32_t pid, HWND WindowHandle, const SurfaceExportConfig& config) {
+			auto exported = std::make_unique<SharedSurface>();
+			if (!exported->Create(pid, (uint64_t)WindowHandle, config)) return false;
+			mExport = std::move(exported);
+			return true;
+		}
+
+		// the export counters, call once the thread presenting the frames has stopped
+		SurfaceExportStats ReadExport() const {
+			return mExport ? mExport->Read() : SurfaceExportStats{};
+		}
+
+		// logic thread, publishes the back buffer as the newest frame
+		// PixelsRendered is what the frame actually redrew, for the stats
+		// returns true if the window should be invalidated so WM_PAINT presents it
+		bool EndFrame(HWND WindowHandle, uint64_t PixelsRendered) {
+			mFrameTime.Record(ElapsedNs(mFrameStart));
+			SurfaceFrame& back = mMailbox.Back();
+			back.mNumber = NextFrameNumber();
+			back.mPublishedNs = NowNs();
+			mFrames.fetch_add(1, std::memory_order_relaxed);
+			mPixelsRendered.fetch_add(PixelsRendered, std::memory_order_relaxed);
+
+			// the record is reserved first so its position travels with the frame
+			back.mCaptureRecord = mCapture.Attached() ? mCapture.Reserve(back.mPixels, back.mNumber, back.mDamage.Rects(),
+				back.mDamage.Count(), back.mDamage.Full(), back.mWindowWidth, back.mWindowHeight) : NoCaptureRecord;
+
+			if (mMailbox.Publish()) {
+				mReplaced.fetch_add(1, std::memory_order_relaxed);
+			}
+			mHasFrame.store(true, std::memory_order_release);
+
+			// the UI thread may be presenting the frame already, it only reads it and the buffer comes back to this
+			// thread no sooner than the next Publish(), so the copy never holds up WM_PAINT
+			mCapture.Commit(back.mPixels);
+
+			switch (mConfig.mMode) {
+			case PresentMode::WIN32_BLIT:
+				return true;
+			case PresentMode::HEADLESS:
+				PresentHeadless(false, WindowHandle);
+				return false;
+			case PresentMode::HEADLESS_DUMP:
+				PresentHeadless(mConfig.mDumpEvery && mFrames.load(std::memory_order_relaxed) % mConfig.mDumpEvery == 0, WindowHandle);
+				return false;
+			}
+			return false;
+		}
+
+		// UI thread, draws the newest frame into the client area from inside BeginPaint()/EndPaint()
+		// only Paint, the rectangle BeginPaint() reports, is copied, the logic thread invalidates just what changed
+		// every published frame is complete, so a newer frame than the one invalidated still paints correctly
+		// a frame that does not match the client size yet (mid resize) is stretched over the whole client area
+		// returns false if there is nothing to present
+		bool Present(HDC hdc, uint32_t ClientWidth, uint32_t ClientHeight, const RECT& Paint) {
+			auto start = std::chrono::steady_clock::now();
+			TakeNewest();
+			const Framebuffer& front = mMailbox.Front().mPixels;
+			if (front.Empty()) return false;
+
+			BITMAPINFO info{};
+			info.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+			info.bmiHeader.biWidth = (LONG)front.Width();
+			// negative height: rows are stored top to bottom
+			info.bmiHeader.biHeight = -(LONG)front.Height();
+			info.bmiHeader.biPlanes = 1;
+			info.bmiHeader.biBitCount = 32;
+			info.bmiHeader.biCompression = BI_RGB;
+
+			uint64_t presented = 0;
+			if (front.Width() == ClientWidth && front.Height() == ClientHeight) {
+				PixelRect paint = PixelRect{ (int32_t)Paint.left, (int32_t)Paint.top, (int32_t)Paint.right, (int32_t)Paint.bottom }
+					.Intersect(PixelRect{ 0, 0, (int32_t)front.Width(), (int32_t)front.Height() });
+				if (!paint.Empty()) {
+					// describe only the painted rows as the DIB, so the source origin is unambiguous
+					// for a top down bitmap, the row stride stays the full frame width
+					uint32_t rows = (uint32_t)(paint.mBottom - paint.mTop);
+					info.bmiHeader.biHeight = -(LONG)rows;
+					SetDIBitsToDevice(hdc, paint.mLeft, paint.mTop, (DWORD)(paint.mRight - paint.mLeft), rows,
+						paint.mLeft, 0, 0, rows, front.Row((uint32_t)paint.mTop), &info, DIB_RGB_COLORS);
+					presented = RectArea(paint);
+				}
+			}
+			else {
+				StretchDIBits(hdc, 0, 0, (int)ClientWidth, (int)ClientHeight, 0, 0, (int)front.Width(), (int)front.Height(),
+					front.Pixels(), &info, DIB_RGB_COLORS, SRCCOPY);
+				presented = (uint64_t)ClientWidth * ClientHeight;
+			}
+			mPixelsPresented.fetch_add(presented, std::memory_order_relaxed);
+
+			mPresents.fetch_add(1, std::memory_order_relaxed);
+			mPresentTime.Record(ElapsedNs(start));
+			return true;
+		}
+
+		// the capture record of the frame presented last, NoCaptureRecord before the first captured one
+		// safe to call from any thread
+		uint64_t PresentedCaptureRecord() const {
+			return mPresentedRecord.load(std::memory_order_relaxed);
+		}
+
+		// true once a frame has been published, WM_ERASEBKGND is skipped from then on to avoid flicker
+		bool HasFrame() const {
+			return mHasFrame.load(std::memory_order_acquire);
+		}
+
+		const PresentConfig& Config() const {
+			return mConfig;
+		}
+
+		// safe to call from any thread
+		FrameStats Read() const {
+			FrameStats stats;
+			stats.mFrames = mFrames.load(std::memory_order_relaxed);
+			stats.mPresents = mPresents.load(std::memory_order_relaxed);
+			stats.mReplaced = mReplaced.load(std::memory_order_relaxed);
+			stats.mDumps = mDumps.load(std::memory_order_relaxed);
+			stats.mUnchanged = mUnchanged.load(std::memory_order_relaxed);
+			stats.mPixelsRendered = mPixelsRendered.load(std::memory_order_relaxed);
+			stats.mPixelsPresented = mPixelsPresented.load(std::memory_order_relaxed);
+			stats.mFrameTime = mFrameTime.Read();
+			stats.mPresentTime = mPresentTime.Read();
+			stats.mHandoffTime = mHandoffTime.Read();
+			return stats;
+		}
+
+	private:
+		static uint64_t RectArea(const PixelRect& rect) {
+			return (uint64_t)(rect.mRight - rect.mLeft) * (uint64_t)(rect.mBottom - rect.mTop);
+		}
+
+		static uint64_t ElapsedNs(std::chrono::steady_clock::time_point start) {
+			return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		static uint64_t NowNs() {
+			return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		// consumer side, takes the newest published frame if there is one and records how long it waited
+		// an exported window copies the frame out here, frames the consumer skipped are never exported
+		// a captured frame was copied by the logic thread, only its record is passed on
+		void TakeNewest() {
+			if (mMailbox.Acquire()) {
+				const SurfaceFrame& front = mMailbox.Front();
+				mHandoffTime.Record(NowNs() - front.mPublishedNs);
+				if (front.mCaptureRecord != NoCaptureRecord) {
+					mPresentedRecord.store(front.mCaptureRecord, std::memory_order_relaxed);
+				}
+				if (mExport) {
+					mExport->Publish(front.mPixels, front.mNumber, front.mDamage.Rects(), front.mDamage.Count(), front.mDamage.Full());
+				}
+			}
+		}
+
+		// logic thread, with no UI thread presenting it is the consumer as well
+		void PresentHeadless(bool dump, HWND WindowHandle) {
+			auto start = std::chrono::steady_clock::now();
+			TakeNewest();
+			if (dump) {
+				// runs inside RunLogic()'s allocation free tick, the path, the name and the file stream allocate
+				AllocAllowedScope dumping;
+				const Framebuffer& front = mMailbox.Front().mPixels;
+				auto path = std::filesystem::current_path() /
+					std::format("WMTSframe-{}-{}.bmp", (const void*)WindowHandle, mFrames.load(std::memory_order_relaxed));
+				if (WriteBmp(path, front)) {
+					mDumps.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+			mPresents.fetch_add(1, std::memory_order_relaxed);
+			mPresentTime.Record(ElapsedNs(start));
+		}
+
+		PresentConfig mConfig;
+
+		// the size of the last BeginFrame() and how many frames it has held, logic thread only
+		uint32_t mWidth{};
+		uint32_t mHeight{};
+		uint32_t mSteadyFrames{};
+		uint32_t mSettleFrames{};
+
+		// the logic thread owns Back(), the UI thread owns Front()
+		TripleBuffer<SurfaceFrame> mMailbox;
+		std::atomic<bool> mHasFrame{ false };
+
+		// inert until AttachCapture() and AttachExport(), the capture is written by the logic thread,
+		// the export by the consumer
+		WindowCapture mCapture;
+		std::unique_ptr<SharedSurface> mExport;
+		std::atomic<uint64_t> mPresentedRecord{ NoCaptureRecord };
+
+		std::chrono::steady_clock::time_point mFrameStart;
+
+		std::atomic<uint64_t> mFrames{ 0 };
+		std::atomic<uint64_t> mPresents{ 0 };
+		std::atomic<uint64_t> mReplaced{ 0 };
+		std::atomic<uint64_t> mDumps{ 0 };
+		std::atomic<uint64_t> mUnchanged{ 0 };
+		std::atomic<uint64_t> mPixelsRendered{ 0 };
+		std::atomic<uint64_t> mPixelsPresented{ 0 };
+		LatencyHistogram mFrameTime;
+		LatencyHistogram mPresentTime;
+		LatencyHistogram mHandoffTime;
+	};
+
+	// the surface of the window the calling UI thread serves, nullptr outside MTPlainWin32Window loops
+	inline thread_local WindowSurface* tlWindowSurface = nullptr;
+
+	// drives headless surfaces through scripted interactive resizes, once allocating exactly the client size
+	// like a plain grow only buffer and once through the SurfacePool with its current config
+	// two waves of Windows surfaces each take Steps resize steps, grow by dragging, shrink back and then settle,
+	// the second wave opens after the first closed so it can reuse its blocks
+	// reports allocations per resize, the pool's peak bytes and the resident set sampled during the storm
+	// takes a few seconds and uses the shared SurfacePool, so not while windows are open, Example1 --benchmark-resize-storm runs it
+	inline std::wstring BenchmarkResizeStorm(size_t Windows = 4, uint32_t Steps = 200) {
+		SurfacePool& pool = SurfacePool::Get();
+		SurfacePoolConfig pooled = pool.Config();
+		SurfacePoolConfig exact{ false, 0, 0, UINT32_MAX };
+		std::wstring report = std::format(L"Resize storm, {} windows x {} steps, two waves:\n", Windows, Steps);
+
+		for (const SurfacePoolConfig* config : { &exact, &pooled }) {
+			pool.SetConfig(*config);
+			pool.ReleaseCached();
+			pool.ResetStats();
+			size_t resident_peak = ProcessMemoryUsage().mResidentBytes;
+
+			for (uint32_t wave{}; wave < 2; wave++) {
+				std::vector<std::unique_ptr<WindowSurface>> surfaces;
+				for (size_t w{}; w < Windows; w++) {
+					surfaces.push_back(std::make_unique<WindowSurface>(PresentConfig{ PresentMode::HEADLESS, 0 }));
+				}
+
+				// a drag from 640x480 out to 1920x1080 and back in to 1024x768, a few pixels per WM_SIZING
+				// each window and wave is offset so they do not all ask for the same sizes
+				uint32_t settle = std::min<uint32_t>(config->mSettleFrames, 64) + 6;
+				for (uint32_t step{}; step < Steps + settle; step++) {
+					double t = std::min<double>(step, Steps) / Steps;
+					double drag = t < 0.5 ? t * 2.0 : 1.0 - (t - 0.5) * 2.0 * 0.7;
+					for (size_t w{}; w < surfaces.size(); w++) {
+						uint32_t offset = (uint32_t)(w * 37 + wave * 53);
+						uint32_t width = 640 + offset + (uint32_t)(drag * 1280.0);
+						uint32_t height = 480 + offset / 2 + (uint32_t)(drag * 600.0);
+						Framebuffer& frame = surfaces[w]->BeginFrame(width, height);
+						frame.Clear(PackColor((uint8_t)step, (uint8_t)w, 0));
+						surfaces[w]->EndFrame(nullptr, (uint64_t)width * height);
+					}
+					if (step % 16 == 0) {
+						resident_peak = std::max(resident_peak, ProcessMemoryUsage().mResidentBytes);
+					}
+				}
+				resident_peak = std::max(resident_peak, ProcessMemoryUsage().mResidentBytes);
+			}
+
+			SurfacePoolStats stats = pool.Read();
+			report += std::format(L"  {}: resizes={} allocations={} ({:.3f} per resize) reused={} shrinks={} peak in use={}KB sampled peak resident={}KB\n",
+				config == &exact ? L"exact " : L"pooled", stats.mResizes, stats.mAllocations, stats.AllocationsPerResize(),
+				stats.mReused, stats.mShrinks, stats.mPeakBytesInUse / 1024, resident_peak / 1024);
+		}
+
+		pool.SetConfig(pooled);
+		pool.ReleaseCached();
+		return report;
+	}
+}
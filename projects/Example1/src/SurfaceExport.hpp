@@ -0,0 +1,412 @@
+#pragma once
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <format>
+#include <type_traits>
+#include <algorithm>
+#include "Framebuffer.hpp"
+
+// set WMTS_SURFACE_EXPORT to 1 (cmake -DWMTS_SURFACE_EXPORT=ON) to publish every window's frames in a named
+// shared memory segment that other processes map and read in place, see WMTSSurfaceReader
+#ifndef WMTS_SURFACE_EXPORT
+#define WMTS_SURFACE_EXPORT 0
+#endif
+
+namespace WMTS {
+	// the layout below is read by other processes, bump the version on any change
+	constexpr uint32_t SharedSurfaceMagic = 0x53534d57; // "WMSS"
+	constexpr uint32_t SharedSurfaceVersion = 1;
+
+	// pixels start on a page so readers can hand them to APIs that want aligned memory
+	constexpr uint64_t SharedSurfacePage = 4096;
+
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared surfaces need address free 64 bit atomics");
+
+	enum class SurfacePixelFormat : uint32_t {
+		// 32 bits per pixel, bytes B, G, R, X in memory, what PackColor() makes and a 32 bit DIB expects
+		BGRX8 = 1
+	};
+
+	// one of the two frames a segment holds, a reader checks mSequence before and after it uses the pixels
+	struct alignas(64) SharedSurfaceSlot {
+		// odd while the writer is changing the slot, 2 more for every frame written into it
+		std::atomic<uint64_t> mSequence;
+
+		// the frame number the slot holds
+		uint64_t mGeneration;
+
+		uint32_t mWidth;
+		uint32_t mHeight;
+
+		// bytes from the start of one row to the next
+		uint32_t mStride;
+		uint32_t mReserved;
+
+		// steady clock nanoseconds when the frame was published, comparable between processes on one machine
+		uint64_t mPublishedNs;
+
+		// bytes from the start of the segment to the slot's pixels
+		uint64_t mPixelsOffset;
+	};
+
+	struct SharedSurfaceHeader {
+		uint32_t mMagic;
+		uint32_t mVersion;
+		uint32_t mHeaderSize;
+		uint32_t mSlotSize;
+		uint32_t mPid;
+		SurfacePixelFormat mFormat;
+		uint64_t mWindowHandle;
+
+		// the largest frame the slots have room for, larger frames are not exported
+		uint32_t mMaxWidth;
+		uint32_t mMaxHeight;
+		uint64_t mSlotBytes;
+
+		// 1 while the window is open, 0 once it closed
+		std::atomic<uint32_t> mAlive;
+		uint32_t mReserved;
+
+		// the newest complete frame, its generation times 2 plus its slot, 0 before the first frame
+		std::atomic<uint64_t> mNewest;
+
+		SharedSurfaceSlot mSlots[2];
+	};
+
+	static_assert(std::is_standard_layout_v<SharedSurfaceHeader>, "SharedSurfaceHeader is shared between processes");
+
+	// the shared memory name of a window's surface
+	inline std::string SharedSurfaceName(uint32_t pid, uint64_t WindowHandle) {
+#ifdef _WIN32
+		return "Local\\WMTSSurface-" + std::to_string(pid) + "-" + std::to_string(WindowHandle);
+#else
+		return "/WMTSSurface-" + std::to_string(pid) + "-" + std::to_string(WindowHandle);
+#endif
+	}
+
+	struct SurfaceExportConfig {
+		// the slots are sized for this once, when the window opens, a larger frame is counted and skipped
+		uint32_t mMaxWidth{ 1920 };
+		uint32_t mMaxHeight{ 1200 };
+	};
+
+	// a copy of one window's export counters, or of several added up
+	struct SurfaceExportStats {
+		uint64_t mFrames{};
+
+		// frames copied whole because the slot was not two frames behind, or the size changed
+		uint64_t mFullCopies{};
+
+		// frames larger than the slots
+		uint64_t mOversize{};
+
+		uint64_t mPixelsCopied{};
+
+		SurfaceExportStats& operator+=(const SurfaceExportStats& other) {
+			mFrames += other.mFrames;
+			mFullCopies += other.mFullCopies;
+			mOversize += other.mOversize;
+			mPixelsCopied += other.mPixelsCopied;
+			return *this;
+		}
+
+		std::wstring Report() const {
+			return std::format(L"Surface export: frames={} full copies={} too large={} pixels copied per frame={}\n",
+				mFrames, mFullCopies, mOversize, mFrames ? mPixelsCopied / mFrames : 0);
+		}
+	};
+
+	// a frame as a reader sees it, the pixels point into the shared memory
+	struct SharedSurfaceFrame {
+		const uint32_t* mPixels;
+		uint32_t mWidth;
+		uint32_t mHeight;
+		uint32_t mStride;
+		uint64_t mGeneration;
+		uint64_t mPublishedNs;
+	};
+
+	// a window's surface in named shared memory, two frame slots behind a sequence counter each
+	// the writer fills the slot that does not hold the newest frame and then points mNewest at it,
+	// so a reader has a whole frame interval to use the newest frame in place before it can be overwritten
+	// readers take no lock and copy nothing, a reader that was too slow sees the sequence change and retries
+	class SharedSurface {
+	public:
+		SharedSurface() = default;
+
+		~SharedSurface() {
+			Close();
+		}
+
+		SharedSurface(const SharedSurface&) = delete;
+		SharedSurface& operator=(const SharedSurface&) = delete;
+
+		// creates the segment for a window, returns false if the OS refuses
+		bool Create(uint32_t pid, uint64_t WindowHandle, const SurfaceExportConfig& config) {
+			Close();
+			mName = SharedSurfaceName(pid, WindowHandle);
+			mOwner = true;
+			uint64_t slot_bytes = RoundToPage((uint64_t)config.mMaxWidth * config.mMaxHeight * sizeof(uint32_t));
+			mBytes = RoundToPage(sizeof(SharedSurfaceHeader)) + 2 * slot_bytes;
+#ifdef _WIN32
+			mMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+				(DWORD)(mBytes >> 32), (DWORD)(mBytes & 0xFFFFFFFF), mName.c_str());
+			if (!mMapping) return false;
+			// a reader still holding the segment of an earlier window with this handle gets it handed back as is
+			// (ERROR_ALREADY_EXISTS) with the size it was created with, the view fails if that is too small
+			// and the contents are reset below before the magic is published again
+			mHeader = (SharedSurfaceHeader*)MapViewOfFile(mMapping, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T)mBytes);
+#else
+			// a segment left by a crashed process with the same pid is unlinked and made anew
+			int fd = shm_open(mName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+			if (fd < 0 && errno == EEXIST) {
+				shm_unlink(mName.c_str());
+				fd = shm_open(mName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+			}
+			if (fd < 0) return false;
+			if (ftruncate(fd, (off_t)mBytes) != 0) {
+				close(fd);
+				shm_unlink(mName.c_str());
+				return false;
+			}
+			void* view = mmap(nullptr, mBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			close(fd);
+			mHeader = view == MAP_FAILED ? nullptr : (SharedSurfaceHeader*)view;
+#endif
+			if (!mHeader) {
+				Close();
+				return false;
+			}
+
+			// the segment may not be fresh, hide the header and start every sequence even and mNewest at no frame
+			SharedSurfaceHeader& header = *mHeader;
+			header.mMagic = 0;
+			std::atomic_thread_fence(std::memory_order_release);
+			header.mNewest.store(0, std::memory_order_relaxed);
+			for (SharedSurfaceSlot& slot : header.mSlots) {
+				slot.mSequence.store(0, std::memory_order_relaxed);
+				slot.mGeneration = 0;
+				slot.mWidth = 0;
+				slot.mHeight = 0;
+				slot.mStride = 0;
+				slot.mReserved = 0;
+				slot.mPublishedNs = 0;
+			}
+			header.mReserved = 0;
+
+			header.mVersion = SharedSurfaceVersion;
+			header.mHeaderSize = sizeof(SharedSurfaceHeader);
+			header.mSlotSize = sizeof(SharedSurfaceSlot);
+			header.mPid = pid;
+			header.mFormat = SurfacePixelFormat::BGRX8;
+			header.mWindowHandle = WindowHandle;
+			header.mMaxWidth = config.mMaxWidth;
+			header.mMaxHeight = config.mMaxHeight;
+			header.mSlotBytes = slot_bytes;
+			header.mSlots[0].mPixelsOffset = RoundToPage(sizeof(SharedSurfaceHeader));
+			header.mSlots[1].mPixelsOffset = header.mSlots[0].mPixelsOffset + slot_bytes;
+			header.mAlive.store(1, std::memory_order_relaxed);
+
+			// the magic goes last so a reader never sees a half written header
+			std::atomic_thread_fence(std::memory_order_release);
+			header.mMagic = SharedSurfaceMagic;
+			return true;
+		}
+
+		// maps another process's window surface read only, returns false if it does not exist or the layout differs
+		bool Open(uint32_t pid, uint64_t WindowHandle) {
+			Close();
+			mName = SharedSurfaceName(pid, WindowHandle);
+			mOwner = false;
+#ifdef _WIN32
+			mMapping = OpenFileMappingA(FILE_MAP_READ, FALSE, mName.c_str());
+			if (!mMapping) return false;
+			// a view of size 0 maps the whole segment
+			mHeader = (SharedSurfaceHeader*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+			if (mHeader) {
+				MEMORY_BASIC_INFORMATION info{};
+				mBytes = VirtualQuery(mHeader, &info, sizeof(info)) ? (uint64_t)info.RegionSize : 0;
+			}
+#else
+			int fd = shm_open(mName.c_str(), O_RDONLY, 0);
+			if (fd < 0) return false;
+			struct stat info {};
+			if (fstat(fd, &info) != 0) {
+				close(fd);
+				return false;
+			}
+			mBytes = (uint64_t)info.st_size;
+			void* view = mBytes ? mmap(nullptr, mBytes, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+			close(fd);
+			mHeader = view == MAP_FAILED ? nullptr : (SharedSurfaceHeader*)view;
+#endif
+			if (!mHeader) {
+				Close();
+				return false;
+			}
+
+			const SharedSurfaceHeader& header = *mHeader;
+			if (mBytes < sizeof(SharedSurfaceHeader) || header.mMagic != SharedSurfaceMagic || header.mVersion != SharedSurfaceVersion ||
+				header.mHeaderSize != sizeof(SharedSurfaceHeader) || header.mSlotSize != sizeof(SharedSurfaceSlot) ||
+				header.mSlots[1].mPixelsOffset + header.mSlotBytes > mBytes) {
+				Close();
+				return false;
+			}
+			return true;
+		}
+
+		void Close() {
+			if (mHeader && mOwner) {
+				mHeader->mAlive.store(0, std::memory_order_relaxed);
+			}
+#ifdef _WIN32
+			if (mHeader) UnmapViewOfFile(mHeader);
+			if (mMapping) CloseHandle(mMapping);
+			mMapping = nullptr;
+#else
+			if (mHeader) munmap(mHeader, mBytes);
+			if (mHeader && mOwner) shm_unlink(mName.c_str());
+#endif
+			mHeader = nullptr;
+		}
+
+		bool IsOpen() const { return mHeader != nullptr; }
+
+		const SharedSurfaceHeader* Header() const { return mHeader; }
+
+		// writer side, the thread presenting the window, publishes frame Number
+		// Damage is what changed since frame Number - 1, DamageFull means everything did
+		// the slot being written is two frames old when every frame is exported, so only the damage of
+		// this frame and the one before is copied, anything else copies the whole frame
+		void Publish(const Framebuffer& frame, uint64_t Number, const PixelRect* Damage, size_t DamageCount, bool DamageFull) {
+			if (!mHeader || !mOwner || frame.Empty()) return;
+			SharedSurfaceHeader& header = *mHeader;
+			if (frame.Width() > header.mMaxWidth || frame.Height() > header.mMaxHeight) {
+				mStats.mOversize++;
+				mPreviousNumber = 0;
+				return;
+			}
+
+			uint64_t newest = header.mNewest.load(std::memory_order_relaxed);
+			size_t index = newest ? 1 - (size_t)(newest & 1) : 0;
+			SharedSurfaceSlot& slot = header.mSlots[index];
+			uint32_t* pixels = reinterpret_cast<uint32_t*>(reinterpret_cast<uint8_t*>(mHeader) + slot.mPixelsOffset);
+			PixelRect whole = frame.Area();
+
+			bool partial = !DamageFull && mPreviousNumber != 0 && Number == mPreviousNumber + 1 &&
+				slot.mGeneration + 2 == Number && slot.mWidth == frame.Width() && slot.mHeight == frame.Height();
+
+			uint64_t sequence = slot.mSequence.load(std::memory_order_relaxed);
+			slot.mSequence.store(sequence + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+
+			uint64_t copied = 0;
+			if (partial) {
+				for (size_t i{}; i < mPreviousCount; i++) copied += CopyRect(frame, pixels, mPrevious[i]);
+				for (size_t i{}; i < DamageCount; i++) copied += CopyRect(frame, pixels, Damage[i].Intersect(whole));
+			}
+			else {
+				copied = CopyRect(frame, pixels, whole);
+				mStats.mFullCopies++;
+			}
+			slot.mGeneration = Number;
+			slot.mWidth = frame.Width();
+			slot.mHeight = frame.Height();
+			slot.mStride = frame.Width() * sizeof(uint32_t);
+			slot.mPublishedNs = SteadyNs();
+
+			slot.mSequence.store(sequence + 2, std::memory_order_release);
+			header.mNewest.store(Number * 2 + index, std::memory_order_release);
+
+			// the next frame goes into the other slot, which is then this frame's predecessor
+			mPreviousNumber = DamageFull ? 0 : Number;
+			mPreviousCount = std::min(DamageCount, mPrevious.size());
+			for (size_t i{}; i < mPreviousCount; i++) mPrevious[i] = Damage[i].Intersect(whole);
+			if (DamageCount > mPrevious.size()) mPreviousNumber = 0;
+
+			mStats.mFrames++;
+			mStats.mPixelsCopied += copied;
+		}
+
+		// reader side, calls f(const SharedSurfaceFrame&) with the newest frame in place, nothing is copied
+		// returns false if there is no frame yet or the writer started on the slot while f ran,
+		// in which case whatever f took from the pixels is torn and must be thrown away
+		template<class F>
+		bool ReadNewest(F&& f) const {
+			if (!mHeader) return false;
+			const SharedSurfaceHeader& header = *mHeader;
+			uint64_t newest = header.mNewest.load(std::memory_order_acquire);
+			if (newest == 0) return false;
+
+			const SharedSurfaceSlot& slot = header.mSlots[newest & 1];
+			uint64_t before = slot.mSequence.load(std::memory_order_acquire);
+			if (before & 1) return false;
+
+			SharedSurfaceFrame frame;
+			frame.mPixels = reinterpret_cast<const uint32_t*>(reinterpret_cast<const uint8_t*>(mHeader) + slot.mPixelsOffset);
+			frame.mWidth = std::min(slot.mWidth, header.mMaxWidth);
+			frame.mHeight = std::min(slot.mHeight, header.mMaxHeight);
+			frame.mStride = slot.mStride;
+			frame.mGeneration = slot.mGeneration;
+			frame.mPublishedNs = slot.mPublishedNs;
+			f(frame);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return slot.mSequence.load(std::memory_order_relaxed) == before;
+		}
+
+		// writer side, the thread that publishes
+		SurfaceExportStats Read() const {
+			return mStats;
+		}
+
+		static uint64_t SteadyNs() {
+			return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+	private:
+		static uint64_t RoundToPage(uint64_t bytes) {
+			return (bytes + SharedSurfacePage - 1) / SharedSurfacePage * SharedSurfacePage;
+		}
+
+		// returns the pixels copied
+		static uint64_t CopyRect(const Framebuffer& frame, uint32_t* pixels, const PixelRect& rect) {
+			if (rect.Empty()) return 0;
+			size_t width = (size_t)(rect.mRight - rect.mLeft);
+			for (int32_t y = rect.mTop; y < rect.mBottom; y++) {
+				std::memcpy(pixels + (size_t)y * frame.Width() + rect.mLeft, frame.Row((uint32_t)y) + rect.mLeft, width * sizeof(uint32_t));
+			}
+			return (uint64_t)width * (uint64_t)(rect.mBottom - rect.mTop);
+		}
+
+		std::string mName;
+		bool mOwner{ false };
+		SharedSurfaceHeader* mHeader{ nullptr };
+		uint64_t mBytes{};
+#ifdef _WIN32
+		HANDLE mMapping{ nullptr };
+#endif
+
+		// the damage of the last frame published, it still has to reach the slot written next
+		uint64_t mPreviousNumber{};
+		std::array<PixelRect, 16> mPrevious{};
+		size_t mPreviousCount{};
+
+		SurfaceExportStats mStats;
+	};
+}
@@ -0,0 +1,291 @@
+#pragma once
+#include <atomic>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <format>
+#include <utility>
+#include <algorithm>
+#include "LockStats.hpp"
+
+namespace WMTS {
+	struct SurfacePoolConfig {
+		// round requests up to size classes, 4 per power of two, so nearby sizes share blocks
+		bool mSizeClasses{ true };
+
+		// a growing buffer asks for this much more than it needs, in percent,
+		// so a window dragged larger does not allocate on every step
+		uint32_t mSlackPercent{ 25 };
+
+		// freed blocks kept for reuse by any window, anything beyond goes back to the OS
+		size_t mCacheBytes{ 64 * 1024 * 1024 };
+
+		// frames a window's size must hold before a buffer much larger than it needs is shrunk
+		uint32_t mSettleFrames{ 20 };
+	};
+
+	// a copy of the surface pool's counters
+	struct SurfacePoolStats {
+		// framebuffer size changes, most of them fit the block the buffer already has
+		uint64_t mResizes{};
+
+		// blocks handed out, from the cache or freshly allocated
+		uint64_t mTakes{};
+		uint64_t mReused{};
+		uint64_t mAllocations{};
+
+		// blocks given back to the OS because the cache was full
+		uint64_t mReleased{};
+
+		// buffers moved to a smaller block once their size settled
+		uint64_t mShrinks{};
+
+		size_t mBytesInUse{};
+		size_t mPeakBytesInUse{};
+		size_t mBytesCached{};
+
+		double AllocationsPerResize() const {
+			return mResizes ? (double)mAllocations / (double)mResizes : 0.0;
+		}
+
+		std::wstring Report() const {
+			return std::format(L"Surfaces: resizes={} takes={} reused={} allocations={} ({:.3f} per resize) released={} shrinks={}\n"
+				L"  in use={}KB peak in use={}KB cached={}KB\n",
+				mResizes, mTakes, mReused, mAllocations, AllocationsPerResize(), mReleased, mShrinks,
+				mBytesInUse / 1024, mPeakBytesInUse / 1024, mBytesCached / 1024);
+		}
+	};
+
+	// pixel storage for framebuffers, shared by every window in the process
+	// blocks are rounded up to size classes and freed blocks are cached by class,
+	// so a window that closes hands its memory to the next window that opens or grows
+	class SurfacePool {
+	public:
+		// cache line aligned so the SIMD kernels never split a row start across lines
+		static constexpr size_t BlockAlign = 64;
+
+		// below this every request gets the same class
+		static constexpr size_t MinPixels = 4096;
+
+		static SurfacePool& Get() {
+			static SurfacePool pool;
+			return pool;
+		}
+
+		~SurfacePool() {
+			ReleaseCached();
+		}
+
+		// call before windows are created, blocks already handed out keep their size
+		void SetConfig(const SurfacePoolConfig& config) {
+			std::lock_guard<ProfiledMutex> local_lock(mFree_mtx);
+			mConfig = config;
+			TrimCache();
+		}
+
+		SurfacePoolConfig Config() {
+			std::lock_guard<ProfiledMutex> local_lock(mFree_mtx);
+			return mConfig;
+		}
+
+		// the capacity a buffer of Pixels pixels keeps once its size settled, class rounding without the slack
+		size_t SettledCapacity(size_t Pixels) {
+			std::lock_guard<ProfiledMutex> local_lock(mFree_mtx);
+			return CapacityFor(Pixels);
+		}
+
+		// a block of at least Pixels pixels plus the slack, its contents are undefined
+		// Exact leaves the slack out, for a buffer whose size has settled
+		// capacity receives the block's real size
+		uint32_t* Take(size_t Pixels, size_t& capacity, bool Exact = false) {
+			std::lock_guard<ProfiledMutex> local_lock(mFree_mtx);
+			capacity = CapacityFor(Exact ? Pixels : Pixels + Pixels * mConfig.mSlackPercent / 100);
+			mTakes++;
+
+			// the first cached block that fits without wasting more than half of it, searching up from its class
+			uint32_t* block = nullptr;
+			for (size_t index = ClassIndex(capacity); index < ClassCount && !block; index++) {
+				auto& list = mFree[index];
+				for (size_t i{}; i < list.size(); i++) {
+					// an exact request only takes its own size, a shrink must not end up in a block as large as before
+					if (Exact ? list[i].second == capacity : list[i].second >= capacity && list[i].second <= capacity * 2) {
+						block = list[i].first;
+						capacity = list[i].second;
+						mBytesCached -= capacity * sizeof(uint32_t);
+						list[i] = list.back();
+						list.pop_back();
+						break;
+					}
+				}
+			}
+
+			if (block) {
+				mReused++;
+			}
+			else {
+				block = static_cast<uint32_t*>(::operator new(capacity * sizeof(uint32_t), std::align_val_t(BlockAlign)));
+				mAllocations++;
+			}
+			mBytesInUse += capacity * sizeof(uint32_t);
+			mPeakBytesInUse = std::max(mPeakBytesInUse, mBytesInUse);
+			return block;
+		}
+
+		// returns a block from Take(), it is cached for any window or freed if the cache is full
+		void Give(uint32_t* block, size_t capacity) {
+			if (!block) return;
+			std::lock_guard<ProfiledMutex> local_lock(mFree_mtx);
+			size_t bytes = capacity * sizeof(uint32_t);
+			mBytesInUse -= bytes;
+			mFree[ClassIndex(capacity)].emplace_back(block, capacity);
+			mBytesCached += bytes;
+			TrimCache();
+		}
+
+		void CountResize() {
+			mResizes.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void CountShrink() {
+			std::lock_guard<ProfiledMutex> local_lock(mFree_mtx);
+			mShrinks++;
+		}
+
+		// frees every cached block, for example after a burst of windows closed
+		void ReleaseCached() {
+			std::lock_guard<ProfiledMutex> local_lock(mFree_mtx);
+			for (auto& list : mFree) {
+				for (auto [block, capacity] : list) {
+					::operator delete(block, std::align_val_t(BlockAlign));
+					mReleased++;
+				}
+				list.clear();
+			}
+			mBytesCached = 0;
+		}
+
+		// safe to call from any thread
+		SurfacePoolStats Read() {
+			std::lock_guard<ProfiledMutex> local_lock(mFree_mtx);
+			SurfacePoolStats stats;
+			stats.mResizes = mResizes.load(std::memory_order_relaxed);
+			stats.mTakes = mTakes;
+			stats.mReused = mReused;
+			stats.mAllocations = mAllocations;
+			stats.mReleased = mReleased;
+			stats.mShrinks = mShrinks;
+			stats.mBytesInUse = mBytesInUse;
+			stats.mPeakBytesInUse = mPeakBytesInUse;
+			stats.mBytesCached = mBytesCached;
+			return stats;
+		}
+
+		// zeroes the counters and restarts the peak from what is in use now, for benchmarks
+		void ResetStats() {
+			std::lock_guard<ProfiledMutex> local_lock(mFree_mtx);
+			mResizes.store(0, std::memory_order_relaxed);
+			mTakes = mReused = mAllocations = mReleased = mShrinks = 0;
+			mPeakBytesInUse = mBytesInUse;
+		}
+
+	private:
+		SurfacePool() = default;
+
+		// 4 classes per power of two, the same log-linear split LatencyHistogram uses
+		static constexpr size_t ClassCount = 64 * 4;
+
+		static size_t ClassIndex(size_t pixels) {
+			if (pixels < 4) return pixels;
+			unsigned msb = 63u - (unsigned)std::countl_zero((uint64_t)pixels);
+			size_t sub = (pixels >> (msb - 2)) & 3;
+			return (msb - 1) * 4 + sub;
+		}
+
+		// rounds up to the next class boundary, a number with nothing below its top 3 bits
+		static size_t RoundToClass(size_t pixels) {
+			if (pixels <= MinPixels) return MinPixels;
+			unsigned msb = 63u - (unsigned)std::countl_zero((uint64_t)pixels);
+			size_t step = (size_t)1 << (msb - 2);
+			return (pixels + step - 1) & ~(step - 1);
+		}
+
+		size_t CapacityFor(size_t pixels) const {
+			return mConfig.mSizeClasses ? RoundToClass(pixels) : std::max<size_t>(pixels, 1);
+		}
+
+		// frees the largest cached blocks until the cache fits its budget
+		void TrimCache() {
+			for (size_t index = ClassCount; index-- > 0 && mBytesCached > mConfig.mCacheBytes;) {
+				auto& list = mFree[index];
+				while (!list.empty() && mBytesCached > mConfig.mCacheBytes) {
+					auto [block, capacity] = list.back();
+					list.pop_back();
+					::operator delete(block, std::align_val_t(BlockAlign));
+					mBytesCached -= capacity * sizeof(uint32_t);
+					mReleased++;
+				}
+			}
+		}
+
+		ProfiledMutex mFree_mtx{ L"SurfacePool::mFree_mtx" };
+		SurfacePoolConfig mConfig;
+
+		// cached blocks and their capacity in pixels, by size class
+		std::array<std::vector<std::pair<uint32_t*, size_t>>, ClassCount> mFree;
+
+		std::atomic<uint64_t> mResizes{ 0 };
+		uint64_t mTakes{};
+		uint64_t mReused{};
+		uint64_t mAllocations{};
+		uint64_t mReleased{};
+		uint64_t mShrinks{};
+		size_t mBytesInUse{};
+		size_t mPeakBytesInUse{};
+		size_t mBytesCached{};
+	};
+
+	// a block of pixels from the SurfacePool, given back when destroyed
+	class PixelBlock {
+	public:
+		PixelBlock() = default;
+
+		explicit PixelBlock(size_t Pixels, bool Exact = false) {
+			mPixels = SurfacePool::Get().Take(Pixels, mCapacity, Exact);
+		}
+
+		~PixelBlock() {
+			SurfacePool::Get().Give(mPixels, mCapacity);
+		}
+
+		PixelBlock(PixelBlock&& other) noexcept
+			:mPixels(std::exchange(other.mPixels, nullptr)), mCapacity(std::exchange(other.mCapacity, 0)) {}
+
+		PixelBlock& operator=(PixelBlock&& other) noexcept {
+			if (this != &other) {
+				SurfacePool::Get().Give(mPixels, mCapacity);
+				mPixels = std::exchange(other.mPixels, nullptr);
+				mCapacity = std::exchange(other.mCapacity, 0);
+			}
+			return *this;
+		}
+
+		PixelBlock(const PixelBlock&) = delete;
+		PixelBlock& operator=(const PixelBlock&) = delete;
+
+		uint32_t* Data() { return mPixels; }
+		const uint32_t* Data() const { return mPixels; }
+
+		// in pixels
+		size_t Capacity() const { return mCapacity; }
+
+	private:
+		uint32_t* mPixels{ nullptr };
+		size_t mCapacity{};
+	};
+}
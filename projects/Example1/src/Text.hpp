@@ -0,0 +1,349 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cwchar>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <format>
+#include <algorithm>
+#include "Font5x7.hpp"
+#include "Framebuffer.hpp"
+#include "TiledRaster.hpp"
+#include "AllocTracking.hpp"
+#include "LockStats.hpp"
+
+namespace WMTS {
+	// every glyph of the built in font rasterized once at one color and scale
+	// glyph pixels are opaque color, the rest is transparent, so a glyph is drawn with one blend per row
+	struct GlyphPage {
+		static constexpr uint32_t Columns = 16;
+		static constexpr uint32_t Rows = (Font5x7::LastChar - Font5x7::FirstChar + Columns) / Columns;
+
+		uint32_t mColor{};
+		uint32_t mScale{};
+		Framebuffer mPixels;
+
+		// where a printable character's glyph is on the page
+		PixelRect Glyph(uint32_t character) const {
+			uint32_t index = character - Font5x7::FirstChar;
+			int32_t x = (int32_t)((index % Columns) * Font5x7::Advance * mScale);
+			int32_t y = (int32_t)((index / Columns) * Font5x7::LineHeight * mScale);
+			return PixelRect::FromSize(x, y, (int32_t)(Font5x7::GlyphWidth * mScale), (int32_t)(Font5x7::GlyphHeight * mScale));
+		}
+	};
+
+	// the glyph pages of the process, shared by every window and raster thread
+	// a page never changes once built and is never freed, so draw lists can point into it from any thread
+	class GlyphAtlas {
+	public:
+		static constexpr uint32_t MaxScale = 8;
+
+		static GlyphAtlas& Get() {
+			static GlyphAtlas atlas;
+			return atlas;
+		}
+
+		// the page for color at scale (1 to MaxScale), built on first use
+		const GlyphPage& Page(uint32_t color, uint32_t scale) {
+			color &= 0x00FFFFFFu;
+			scale = std::clamp<uint32_t>(scale, 1, MaxScale);
+
+			std::lock_guard<ProfiledMutex> local_lock(mPages_mtx);
+			for (const auto& page : mPages) {
+				if (page->mColor == color && page->mScale == scale) return *page;
+			}
+
+			// a new color or size, rare after the first frames
+			AllocAllowedScope building;
+			auto page = std::make_unique<GlyphPage>();
+			page->mColor = color;
+			page->mScale = scale;
+			page->mPixels.Resize(GlyphPage::Columns * Font5x7::Advance * scale, GlyphPage::Rows * Font5x7::LineHeight * scale);
+			page->mPixels.Clear(0);
+			for (uint32_t character = Font5x7::FirstChar; character <= Font5x7::LastChar; character++) {
+				PixelRect glyph = page->Glyph(character);
+				for (uint32_t row{}; row < Font5x7::GlyphHeight; row++) {
+					for (uint32_t column{}; column < Font5x7::GlyphWidth; column++) {
+						if (!Font5x7::Pixel(character, column, row)) continue;
+						page->mPixels.FillRect(glyph.mLeft + (int32_t)(column * scale), glyph.mTop + (int32_t)(row * scale),
+							(int32_t)scale, (int32_t)scale, 0xFF000000u | color);
+					}
+				}
+			}
+			mPages.push_back(std::move(page));
+			return *mPages.back();
+		}
+
+		size_t Pages() {
+			std::lock_guard<ProfiledMutex> local_lock(mPages_mtx);
+			return mPages.size();
+		}
+
+	private:
+		GlyphAtlas() = default;
+
+		ProfiledMutex mPages_mtx{ L"GlyphAtlas::mPages_mtx" };
+		std::vector<std::unique_ptr<GlyphPage>> mPages;
+	};
+
+	// one glyph of a laid out string, in font pixels at scale 1
+	struct PlacedGlyph {
+		int32_t mX;
+		int32_t mY;
+		uint32_t mCharacter;
+	};
+
+	// a laid out string, reused for every draw of the same text
+	struct TextLayout {
+		std::vector<PlacedGlyph> mGlyphs;
+
+		// in font pixels at scale 1
+		uint32_t mWidth{};
+		uint32_t mHeight{};
+	};
+
+	// a copy of one text renderer's counters, or of several added up
+	struct TextStats {
+		uint64_t mDraws{};
+		uint64_t mLayoutHits{};
+		uint64_t mLayoutMisses{};
+		uint64_t mGlyphs{};
+
+		TextStats& operator+=(const TextStats& other) {
+			mDraws += other.mDraws;
+			mLayoutHits += other.mLayoutHits;
+			mLayoutMisses += other.mLayoutMisses;
+			mGlyphs += other.mGlyphs;
+			return *this;
+		}
+
+		std::wstring Report() const {
+			uint64_t lookups = mLayoutHits + mLayoutMisses;
+			return std::format(L"draws={} glyphs={} layout hits={} misses={} hit rate={:.1f}%\n",
+				mDraws, mGlyphs, mLayoutHits, mLayoutMisses, lookups ? 100.0 * (double)mLayoutHits / (double)lookups : 0.0);
+		}
+	};
+
+	// records text into a DrawList as blends from the GlyphAtlas
+	// strings are laid out once into run buffers kept in a cache where each string may sit in one of two slots,
+	// so a label or a counter value seen before costs a hash and a compare, and a stream of fresh counter
+	// values evicts the older of the two slots instead of the labels, the buffers keep their capacity when reused
+	// one per thread, see ThreadTextRenderer()
+	class TextRenderer {
+	public:
+		static constexpr size_t CacheSlots = 256;
+
+		// records text with its top left corner at x, y, '\n' starts a new line,
+		// characters outside printable ASCII are drawn as '?'
+		// returns the size of the text in pixels
+		std::pair<uint32_t, uint32_t> Draw(DrawList& list, std::wstring_view text, int32_t x, int32_t y, uint32_t color, uint32_t scale = 1) {
+			scale = std::clamp<uint32_t>(scale, 1, GlyphAtlas::MaxScale);
+			const TextLayout& layout = Layout(text);
+			const GlyphPage& page = FindPage(color, scale);
+			for (const PlacedGlyph& glyph : layout.mGlyphs) {
+				list.BlendOver(page.mPixels, page.Glyph(glyph.mCharacter),
+					x + glyph.mX * (int32_t)scale, y + glyph.mY * (int32_t)scale, page.mColor);
+			}
+			mDraws++;
+			mGlyphs += layout.mGlyphs.size();
+			return { layout.mWidth * scale, layout.mHeight * scale };
+		}
+
+		// the size Draw() would return
+		std::pair<uint32_t, uint32_t> Measure(std::wstring_view text, uint32_t scale = 1) {
+			scale = std::clamp<uint32_t>(scale, 1, GlyphAtlas::MaxScale);
+			const TextLayout& layout = Layout(text);
+			return { layout.mWidth * scale, layout.mHeight * scale };
+		}
+
+		TextStats Read() const {
+			return TextStats{ mDraws, mLayoutHits, mLayoutMisses, mGlyphs };
+		}
+
+		void ResetStats() {
+			mDraws = mLayoutHits = mLayoutMisses = mGlyphs = 0;
+		}
+
+	private:
+		struct CacheEntry {
+			uint64_t mHash{};
+			// the lookup that last used the entry, 0 while it is empty
+			uint64_t mLastUse{};
+			std::wstring mText;
+			TextLayout mLayout;
+		};
+
+		// FNV-1a
+		static uint64_t Hash(std::wstring_view text) {
+			uint64_t hash = 14695981039346656037ull;
+			for (wchar_t character : text) {
+				hash = (hash ^ (uint64_t)character) * 1099511628211ull;
+			}
+			return hash;
+		}
+
+		const TextLayout& Layout(std::wstring_view text) {
+			uint64_t hash = Hash(text);
+			mLookups++;
+			CacheEntry& first = mEntries[hash % CacheSlots];
+			CacheEntry& second = mEntries[(hash >> 32) % CacheSlots];
+			for (CacheEntry* candidate : { &first, &second }) {
+				if (candidate->mLastUse && candidate->mHash == hash && candidate->mText == text) {
+					candidate->mLastUse = mLookups;
+					mLayoutHits++;
+					return candidate->mLayout;
+				}
+			}
+			mLayoutMisses++;
+
+			CacheEntry& entry = first.mLastUse <= second.mLastUse ? first : second;
+
+			if (entry.mText.capacity() < text.size()) {
+				AllocAllowedScope growing;
+				entry.mText.reserve(text.size());
+			}
+			entry.mText.assign(text);
+			entry.mHash = hash;
+			entry.mLastUse = mLookups;
+
+			TextLayout& layout = entry.mLayout;
+			layout.mGlyphs.clear();
+			int32_t pen_x = 0, pen_y = 0;
+			uint32_t width = 0;
+			for (wchar_t character : text) {
+				if (character == L'\n') {
+					pen_x = 0;
+					pen_y += (int32_t)Font5x7::LineHeight;
+					continue;
+				}
+				uint32_t code = (uint32_t)character;
+				if (code < Font5x7::FirstChar || code > Font5x7::LastChar) code = '?';
+				if (code != ' ') {
+					detail::GrowIfFull(layout.mGlyphs);
+					layout.mGlyphs.push_back(PlacedGlyph{ pen_x, pen_y, code });
+				}
+				pen_x += (int32_t)Font5x7::Advance;
+				width = std::max<uint32_t>(width, (uint32_t)pen_x - (Font5x7::Advance - Font5x7::GlyphWidth));
+			}
+			layout.mWidth = width;
+			layout.mHeight = text.empty() ? 0 : (uint32_t)pen_y + Font5x7::GlyphHeight;
+			return layout;
+		}
+
+		// the last few pages this thread used, so most draws skip the atlas lock
+		const GlyphPage& FindPage(uint32_t color, uint32_t scale) {
+			color &= 0x00FFFFFFu;
+			for (const GlyphPage* page : mRecentPages) {
+				if (page && page->mColor == color && page->mScale == scale) return *page;
+			}
+			const GlyphPage& page = GlyphAtlas::Get().Page(color, scale);
+			mRecentPages[mNextRecent] = &page;
+			mNextRecent = (mNextRecent + 1) % mRecentPages.size();
+			return page;
+		}
+
+		std::array<CacheEntry, CacheSlots> mEntries;
+		std::array<const GlyphPage*, 8> mRecentPages{};
+		size_t mNextRecent{};
+		uint64_t mLookups{};
+
+		uint64_t mDraws{};
+		uint64_t mLayoutHits{};
+		uint64_t mLayoutMisses{};
+		uint64_t mGlyphs{};
+	};
+
+	// the calling thread's text renderer, created on first use so threads that never draw text
+	// do not carry its cache, a window's logic thread keeps its layouts from frame to frame
+	inline thread_local std::unique_ptr<TextRenderer> tlTextRenderer;
+
+	inline TextRenderer& ThreadTextRenderer() {
+		if (!tlTextRenderer) {
+			AllocAllowedScope creating;
+			tlTextRenderer = std::make_unique<TextRenderer>();
+		}
+		return *tlTextRenderer;
+	}
+
+	// records text into the frame through the calling thread's TextRenderer, see TextRenderer::Draw()
+	inline std::pair<uint32_t, uint32_t> DrawString(DrawList& list, std::wstring_view text, int32_t x, int32_t y, uint32_t color, uint32_t scale = 1) {
+		return ThreadTextRenderer().Draw(list, text, x, y, color, scale);
+	}
+
+	// records and rasterizes a text heavy 1280x720 frame: 64 live counters that change every frame,
+	// 32 static labels and a scrolling ticker, once through the atlas and the layout cache and once
+	// the naive way, laying out every string and filling every glyph pixel as its own rectangle
+	// reports milliseconds per frame for recording and rasterizing and the layout hit rate
+	// takes about a second on its own TextRenderer, Example1 --benchmark-text runs it
+	inline std::wstring BenchmarkText(int frames = 200) {
+		constexpr uint32_t width = 1280, height = 720;
+		const wchar_t* ticker = L"WMTS  windows 12  frames 48213  input events 9120  dropped 0  raster threads 7  ";
+		size_t ticker_length = std::wcslen(ticker);
+
+		// the uncached path: every string laid out again and every glyph pixel filled one by one
+		auto naive_string = [](DrawList& list, std::wstring_view text, int32_t x, int32_t y, uint32_t color) {
+			int32_t pen_x = x;
+			for (wchar_t character : text) {
+				uint32_t code = (uint32_t)character;
+				if (code < Font5x7::FirstChar || code > Font5x7::LastChar) code = '?';
+				for (uint32_t row{}; row < Font5x7::GlyphHeight; row++) {
+					for (uint32_t column{}; column < Font5x7::GlyphWidth; column++) {
+						if (Font5x7::Pixel(code, column, row)) list.FillRect(pen_x + (int32_t)column, y + (int32_t)row, 1, 1, color);
+					}
+				}
+				pen_x += (int32_t)Font5x7::Advance;
+			}
+		};
+
+		std::wstring report = std::format(L"Text frames {}x{}, 64 counters, 32 labels, a ticker, ms per frame:\n", width, height);
+		for (int cached = 1; cached >= 0; cached--) {
+			DrawList list;
+			TiledRenderer renderer;
+			Framebuffer target;
+			target.Resize(width, height);
+			auto owned = std::make_unique<TextRenderer>();
+			TextRenderer& text = *owned;
+			double record_ms = 0, raster_ms = 0;
+			size_t commands = 0;
+
+			for (int frame{}; frame < frames; frame++) {
+				auto start = std::chrono::steady_clock::now();
+				list.Reset(width, height);
+				list.Clear(PackColor(24, 26, 30));
+				wchar_t line[64];
+				for (uint32_t i{}; i < 32; i++) {
+					std::swprintf(line, 64, L"sensor %02u", i);
+					int32_t x = 16 + (int32_t)(i % 4) * 300, y = 16 + (int32_t)(i / 4) * 40;
+					if (cached) text.Draw(list, line, x, y, PackColor(150, 150, 160));
+					else naive_string(list, line, x, y, PackColor(150, 150, 160));
+				}
+				for (uint32_t i{}; i < 64; i++) {
+					std::swprintf(line, 64, L"%6.2f ms  %5u", (double)((frame * 7 + i * 13) % 1000) / 10.0, (unsigned)(frame * 3 + i));
+					int32_t x = 16 + (int32_t)(i % 4) * 300, y = 360 + (int32_t)(i / 4) * 20;
+					if (cached) text.Draw(list, line, x, y, PackColor(240, 240, 240), 1);
+					else naive_string(list, line, x, y, PackColor(240, 240, 240));
+				}
+				std::wstring_view scrolled(ticker + (size_t)frame % ticker_length, ticker_length - (size_t)frame % ticker_length);
+				if (cached) text.Draw(list, scrolled, 16, 340, PackColor(240, 200, 80));
+				else naive_string(list, scrolled, 16, 340, PackColor(240, 200, 80));
+				auto recorded = std::chrono::steady_clock::now();
+				renderer.Render(list, target);
+				auto rasterized = std::chrono::steady_clock::now();
+
+				record_ms += std::chrono::duration<double, std::milli>(recorded - start).count();
+				raster_ms += std::chrono::duration<double, std::milli>(rasterized - recorded).count();
+				commands += list.Commands().size();
+			}
+
+			report += std::format(L"  {}: record={:.3f}ms raster={:.3f}ms commands={}{}",
+				cached ? L"atlas + layout cache" : L"per pixel, no cache  ", record_ms / frames, raster_ms / frames, commands / (size_t)frames,
+				cached ? L" " + text.Read().Report() : std::wstring(L"\n"));
+		}
+		return report;
+	}
+}
@@ -0,0 +1,267 @@
+#pragma once
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <limits.h>
+#endif
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <string>
+#include <tuple>
+#include <functional>
+#include <utility>
+#include <stdexcept>
+#include <algorithm>
+#include <vector>
+#include "ThreadPlacement.hpp"
+
+namespace WMTS {
+	// how a NativeThread is created
+	struct ThreadAttributes {
+		// bytes of address space reserved for the stack, 0 uses the platform default
+		// (the executable's /STACK reserve on Windows, usually 1 MB, and RLIMIT_STACK on Linux, usually 8 MB)
+		// only touched pages are committed so this bounds the reservation, not resident memory
+		size_t mStackSize{ 0 };
+
+		// shown in debuggers and profilers, empty leaves the thread unnamed
+		// Linux truncates it to 15 characters
+		std::wstring mName;
+
+		// logical cores the thread may run on, empty allows every core
+		std::vector<uint32_t> mCores;
+
+		ThreadPriority mPriority{ ThreadPriority::NORMAL };
+	};
+
+	// attributes with a stack reservation and a name, the cores and the priority keep their defaults
+	inline ThreadAttributes NamedThreadAttributes(size_t StackSize, std::wstring Name) {
+		ThreadAttributes attributes;
+		attributes.mStackSize = StackSize;
+		attributes.mName = std::move(Name);
+		return attributes;
+	}
+
+	// the stack reservation a thread gets when ThreadAttributes::mStackSize is 0
+	inline size_t DefaultStackSize() {
+#ifdef _WIN32
+		// CreateThread() with a size of 0 uses the reserve size from the executable's PE header
+		HMODULE hModule = GetModuleHandle(NULL);
+		PIMAGE_DOS_HEADER pDOSHeader = (PIMAGE_DOS_HEADER)hModule;
+		PIMAGE_NT_HEADERS pNTHeaders = (PIMAGE_NT_HEADERS)((DWORD_PTR)hModule + pDOSHeader->e_lfanew);
+		return (size_t)pNTHeaders->OptionalHeader.SizeOfStackReserve;
+#else
+		// a fresh attribute object carries the default glibc picked from RLIMIT_STACK
+		pthread_attr_t attr;
+		size_t size = 0;
+		if (pthread_attr_init(&attr) == 0) {
+			pthread_attr_getstacksize(&attr, &size);
+			pthread_attr_destroy(&attr);
+		}
+		return size;
+#endif
+	}
+
+	// the stack reservation a thread created with attributes will get
+	inline size_t ReservedStackSize(const ThreadAttributes& attributes) {
+		return attributes.mStackSize ? attributes.mStackSize : DefaultStackSize();
+	}
+
+	// false on a NativeThread whose core set or priority the OS refused, true on every other thread
+	inline thread_local bool tlPlacementApplied = true;
+
+	// lets the thread itself report a refused placement, without its NativeThread object
+	inline bool CurrentThreadPlacementApplied() {
+		return tlPlacementApplied;
+	}
+
+	// a std::thread replacement created through the OS so the stack size and name can be chosen
+	// get_id() returns the same std::thread::id the thread sees from std::this_thread::get_id(),
+	// so it can key the same maps as a std::thread
+	class NativeThread {
+	public:
+		// starts f(args...) on a new thread, the arguments are copied like std::thread does
+		// returns once the thread is running and its id is known
+		// throws std::runtime_error if the OS refuses to create the thread
+		template<class F, class... Args>
+		explicit NativeThread(const ThreadAttributes& attributes, F&& f, Args&&... args) {
+			auto start = std::make_unique<Start<std::decay_t<F>, std::decay_t<Args>...>>(
+				attributes, std::forward<F>(f), std::forward<Args>(args)...);
+			Handshake handshake;
+			start->mHandshake = &handshake;
+
+			Launch(attributes, start.get());
+
+			// the thread owns the start block from here on
+			start.release();
+
+			std::unique_lock<std::mutex> handshake_lock(handshake.mHandshake_mtx);
+			handshake.mHandshake_cv.wait(handshake_lock, [&handshake] { return handshake.mReady; });
+			mId = handshake.mId;
+			mPlacementApplied = handshake.mPlacementApplied;
+		}
+
+		~NativeThread() {
+			// same rule as std::thread, a running thread must be joined or detached first
+			if (joinable()) std::terminate();
+		}
+
+		NativeThread(const NativeThread&) = delete;
+		NativeThread& operator=(const NativeThread&) = delete;
+
+		bool joinable() const {
+			return mJoinable;
+		}
+
+		void join() {
+			if (!mJoinable) return;
+#ifdef _WIN32
+			WaitForSingleObject(mHandle, INFINITE);
+			CloseHandle(mHandle);
+			mHandle = nullptr;
+#else
+			pthread_join(mThread, nullptr);
+#endif
+			mJoinable = false;
+		}
+
+		void detach() {
+			if (!mJoinable) return;
+#ifdef _WIN32
+			CloseHandle(mHandle);
+			mHandle = nullptr;
+#else
+			pthread_detach(mThread);
+#endif
+			mJoinable = false;
+		}
+
+		std::thread::id get_id() const {
+			return mId;
+		}
+
+		// false if the OS refused the core set or priority in the attributes
+		bool PlacementApplied() const {
+			return mPlacementApplied;
+		}
+
+	private:
+		// lives on the creating thread's stack until the new thread has published its id
+		struct Handshake {
+			std::mutex mHandshake_mtx;
+			std::condition_variable mHandshake_cv;
+			bool mReady{ false };
+			std::thread::id mId;
+			bool mPlacementApplied{ true };
+		};
+
+		struct StartBase {
+			explicit StartBase(const ThreadAttributes& attributes) :mAttributes(attributes) {}
+			virtual ~StartBase() = default;
+			virtual void Invoke() = 0;
+
+			ThreadAttributes mAttributes;
+			Handshake* mHandshake{ nullptr };
+		};
+
+		template<class F, class... Args>
+		struct Start :StartBase {
+			template<class FF, class... AA>
+			Start(const ThreadAttributes& attributes, FF&& f, AA&&... args)
+				:StartBase(attributes), mFunction(std::forward<FF>(f)), mArgs(std::forward<AA>(args)...) {}
+
+			void Invoke() override {
+				std::apply([this](auto&... args) { std::invoke(std::move(mFunction), std::move(args)...); }, mArgs);
+			}
+
+			F mFunction;
+			std::tuple<Args...> mArgs;
+		};
+
+		// runs on the new thread
+		static void Entry(StartBase* start_raw) {
+			std::unique_ptr<StartBase> start(start_raw);
+			SetCurrentThreadName(start->mAttributes.mName);
+
+			// placed before the creator returns, so the thread never runs user code unplaced
+			bool placement_applied = true;
+			if (!start->mAttributes.mCores.empty() || start->mAttributes.mPriority != ThreadPriority::NORMAL) {
+				placement_applied = ApplyCurrentThreadPlacement(start->mAttributes.mCores, start->mAttributes.mPriority);
+			}
+			tlPlacementApplied = placement_applied;
+
+			{
+				Handshake* handshake = start->mHandshake;
+				std::lock_guard<std::mutex> handshake_lock(handshake->mHandshake_mtx);
+				handshake->mId = std::this_thread::get_id();
+				handshake->mPlacementApplied = placement_applied;
+				handshake->mReady = true;
+				handshake->mHandshake_cv.notify_one();
+			}
+			// the creating thread may have returned, the handshake is gone
+			start->mHandshake = nullptr;
+
+			start->Invoke();
+		}
+
+		static void SetCurrentThreadName(const std::wstring& name) {
+			if (name.empty()) return;
+#ifdef _WIN32
+			SetThreadDescription(GetCurrentThread(), name.c_str());
+#else
+			// pthread names are at most 15 bytes plus the terminator, the name is assumed to be ASCII
+			std::string narrow;
+			for (wchar_t c : name.substr(0, 15)) narrow.push_back(c < 0x80 ? (char)c : '?');
+			pthread_setname_np(pthread_self(), narrow.c_str());
+#endif
+		}
+
+#ifdef _WIN32
+		static DWORD WINAPI ThreadProc(LPVOID param) {
+			Entry(static_cast<StartBase*>(param));
+			return 0;
+		}
+
+		void Launch(const ThreadAttributes& attributes, StartBase* start) {
+			// STACK_SIZE_PARAM_IS_A_RESERVATION makes the size the reservation instead of the initial commit
+			mHandle = CreateThread(nullptr, attributes.mStackSize, ThreadProc, start,
+				attributes.mStackSize ? STACK_SIZE_PARAM_IS_A_RESERVATION : 0, nullptr);
+			if (!mHandle) {
+				throw std::runtime_error("CreateThread failed in NativeThread");
+			}
+			mJoinable = true;
+		}
+
+		HANDLE mHandle{ nullptr };
+#else
+		static void* ThreadProc(void* param) {
+			Entry(static_cast<StartBase*>(param));
+			return nullptr;
+		}
+
+		void Launch(const ThreadAttributes& attributes, StartBase* start) {
+			pthread_attr_t attr;
+			if (pthread_attr_init(&attr) != 0) {
+				throw std::runtime_error("pthread_attr_init failed in NativeThread");
+			}
+			if (attributes.mStackSize) {
+				pthread_attr_setstacksize(&attr, std::max(attributes.mStackSize, (size_t)PTHREAD_STACK_MIN));
+			}
+			int result = pthread_create(&mThread, &attr, ThreadProc, start);
+			pthread_attr_destroy(&attr);
+			if (result != 0) {
+				throw std::runtime_error("pthread_create failed in NativeThread");
+			}
+			mJoinable = true;
+		}
+
+		pthread_t mThread{};
+#endif
+		bool mJoinable{ false };
+		bool mPlacementApplied{ true };
+		std::thread::id mId;
+	};
+}
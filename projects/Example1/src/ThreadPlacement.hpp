@@ -0,0 +1,321 @@
+#pragma once
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <fstream>
+#endif
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <format>
+#include <thread>
+#include <algorithm>
+#include "Histogram.hpp"
+
+namespace WMTS {
+	// relative priority of a thread inside the process
+	// on Linux the normal scheduler has no thread priorities, these map to the thread's nice value
+	// and raising it above NORMAL needs CAP_SYS_NICE (or a raised RLIMIT_NICE)
+	enum class ThreadPriority {
+		LOWEST,
+		BELOW_NORMAL,
+		NORMAL,
+		ABOVE_NORMAL,
+		HIGHEST
+	};
+
+	// how the threads of one role are spread over the allowed cores
+	enum class PlacementSpread {
+		// every thread may run on any allowed core
+		NONE,
+
+		// each new thread is pinned to the next allowed core, round robin
+		CORES,
+
+		// each new thread is restricted to the allowed cores of the next NUMA node, round robin
+		NUMA_NODES
+	};
+
+	// where and how urgently the threads of one role run
+	struct ThreadPlacement {
+		// logical core numbers the threads may run on, empty allows every core
+		std::vector<uint32_t> mCores;
+
+		ThreadPriority mPriority{ ThreadPriority::NORMAL };
+
+		PlacementSpread mSpread{ PlacementSpread::NONE };
+	};
+
+	// the logical cores of the machine grouped by NUMA node
+	class CoreTopology {
+	public:
+		static const CoreTopology& Get() {
+			static CoreTopology topology;
+			return topology;
+		}
+
+		uint32_t CoreCount() const { return mCoreCount; }
+
+		// one entry per node, each with its logical core numbers
+		const std::vector<std::vector<uint32_t>>& Nodes() const { return mNodes; }
+
+	private:
+		CoreTopology() {
+			mCoreCount = std::max(1u, std::thread::hardware_concurrency());
+#ifdef _WIN32
+			ULONG highest = 0;
+			if (GetNumaHighestNodeNumber(&highest)) {
+				for (ULONG node = 0; node <= highest; node++) {
+					ULONGLONG mask = 0;
+					if (!GetNumaNodeProcessorMask((UCHAR)node, &mask) || mask == 0) continue;
+					std::vector<uint32_t> cores;
+					for (uint32_t core = 0; core < 64; core++) {
+						if (mask & (1ull << core)) cores.push_back(core);
+					}
+					mNodes.push_back(std::move(cores));
+				}
+			}
+#else
+			for (uint32_t node = 0;; node++) {
+				std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+				if (!cpulist) break;
+				std::string list;
+				std::getline(cpulist, list);
+				auto cores = ParseCpuList(list);
+				if (!cores.empty()) mNodes.push_back(std::move(cores));
+			}
+#endif
+			// no NUMA information, treat the machine as one node
+			if (mNodes.empty()) {
+				std::vector<uint32_t> cores(mCoreCount);
+				for (uint32_t core = 0; core < mCoreCount; core++) cores[core] = core;
+				mNodes.push_back(std::move(cores));
+			}
+		}
+
+#ifndef _WIN32
+		// parses the kernel's "0-3,8,10-11" format
+		static std::vector<uint32_t> ParseCpuList(const std::string& list) {
+			std::vector<uint32_t> cores;
+			size_t pos = 0;
+			while (pos < list.size()) {
+				size_t end = list.find(',', pos);
+				if (end == std::string::npos) end = list.size();
+				std::string range = list.substr(pos, end - pos);
+				size_t dash = range.find('-');
+				try {
+					uint32_t first = (uint32_t)std::stoul(range.substr(0, dash));
+					uint32_t last = dash == std::string::npos ? first : (uint32_t)std::stoul(range.substr(dash + 1));
+					for (uint32_t core = first; core <= last; core++) cores.push_back(core);
+				}
+				catch (...) {
+					// a malformed entry is skipped
+				}
+				pos = end + 1;
+			}
+			return cores;
+		}
+#endif
+
+		uint32_t mCoreCount{};
+		std::vector<std::vector<uint32_t>> mNodes;
+	};
+
+	// applies a core set and a priority to the calling thread
+	// returns false if the OS refused either, the thread keeps running with whatever did apply
+	inline bool ApplyCurrentThreadPlacement(const std::vector<uint32_t>& cores, ThreadPriority priority) {
+		bool applied = true;
+#ifdef _WIN32
+		if (!cores.empty()) {
+			// SetThreadAffinityMask works within the thread's processor group, cores past 63 are ignored
+			DWORD_PTR mask = 0;
+			for (uint32_t core : cores) {
+				if (core < sizeof(DWORD_PTR) * 8) mask |= (DWORD_PTR)1 << core;
+			}
+			if (!mask || !SetThreadAffinityMask(GetCurrentThread(), mask)) applied = false;
+		}
+
+		int win_priority = THREAD_PRIORITY_NORMAL;
+		switch (priority) {
+		case ThreadPriority::LOWEST: { win_priority = THREAD_PRIORITY_LOWEST; } break;
+		case ThreadPriority::BELOW_NORMAL: { win_priority = THREAD_PRIORITY_BELOW_NORMAL; } break;
+		case ThreadPriority::NORMAL: { win_priority = THREAD_PRIORITY_NORMAL; } break;
+		case ThreadPriority::ABOVE_NORMAL: { win_priority = THREAD_PRIORITY_ABOVE_NORMAL; } break;
+		case ThreadPriority::HIGHEST: { win_priority = THREAD_PRIORITY_HIGHEST; } break;
+		}
+		if (priority != ThreadPriority::NORMAL && !SetThreadPriority(GetCurrentThread(), win_priority)) applied = false;
+#else
+		if (!cores.empty()) {
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			for (uint32_t core : cores) {
+				if (core < CPU_SETSIZE) CPU_SET(core, &set);
+			}
+			if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) applied = false;
+		}
+
+		// SCHED_OTHER threads share one static priority, the nice value is what weights them
+		// Linux keeps a nice value per thread, setpriority() on the thread id sets only this thread
+		int nice = 0;
+		switch (priority) {
+		case ThreadPriority::LOWEST: { nice = 10; } break;
+		case ThreadPriority::BELOW_NORMAL: { nice = 5; } break;
+		case ThreadPriority::NORMAL: { nice = 0; } break;
+		case ThreadPriority::ABOVE_NORMAL: { nice = -5; } break;
+		case ThreadPriority::HIGHEST: { nice = -10; } break;
+		}
+		if (priority != ThreadPriority::NORMAL && setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), nice) != 0) applied = false;
+#endif
+		return applied;
+	}
+
+	// hands out the core set and priority for each new thread of one role
+	class PlacementPolicy {
+	public:
+		// replaces the placement, threads that already run keep theirs
+		void Set(const ThreadPlacement& placement) {
+			mPlacement = placement;
+			mNext.store(0, std::memory_order_relaxed);
+		}
+
+		const ThreadPlacement& Get() const { return mPlacement; }
+
+		// the cores the next thread gets, empty means no restriction
+		// call once per thread, spreading advances on every call
+		std::vector<uint32_t> NextCores() {
+			const auto& allowed = mPlacement.mCores;
+			switch (mPlacement.mSpread) {
+			case PlacementSpread::NONE: {
+				return allowed;
+			}
+			case PlacementSpread::CORES: {
+				uint32_t n = mNext.fetch_add(1, std::memory_order_relaxed);
+				if (!allowed.empty()) return { allowed[n % allowed.size()] };
+				return { n % CoreTopology::Get().CoreCount() };
+			}
+			case PlacementSpread::NUMA_NODES: {
+				const auto& nodes = CoreTopology::Get().Nodes();
+				uint32_t n = mNext.fetch_add(1, std::memory_order_relaxed);
+
+				// try each node once starting from the next one, skipping nodes with no allowed cores
+				for (size_t i = 0; i < nodes.size(); i++) {
+					const auto& node = nodes[(n + i) % nodes.size()];
+					if (allowed.empty()) return node;
+
+					std::vector<uint32_t> cores;
+					for (uint32_t core : node) {
+						if (std::find(allowed.begin(), allowed.end(), core) != allowed.end()) cores.push_back(core);
+					}
+					if (!cores.empty()) return cores;
+				}
+				return allowed;
+			}
+			}
+			return allowed;
+		}
+
+	private:
+		ThreadPlacement mPlacement;
+		std::atomic<uint32_t> mNext{ 0 };
+	};
+
+	// measures the input latency tail of a UI thread while logic threads saturate every core
+	// an injector posts an event every 1 ms to a UI thread that waits on a condition variable, the way a message
+	// wakes a pump, and the time from posting to the UI thread running is recorded
+	// LogicThreads spinning threads (0 means two per core) compete with it, first with the default placement,
+	// then with the logic threads below normal, the UI thread above normal, both, and with more than one core
+	// the UI thread on core 0 and the logic threads on the others
+	// a row notes when the OS refused a placement, raising a priority on Linux needs CAP_SYS_NICE
+	// takes four or five times duration, Example1 --benchmark-placement runs it with the defaults
+	inline std::wstring BenchmarkPlacement(std::chrono::milliseconds duration = std::chrono::milliseconds(2000), uint32_t LogicThreads = 0) {
+		uint32_t cores = CoreTopology::Get().CoreCount();
+		if (LogicThreads == 0) LogicThreads = cores * 2;
+
+		std::vector<uint32_t> others;
+		for (uint32_t core = 1; core < cores; core++) others.push_back(core);
+
+		struct Scenario {
+			const wchar_t* mName;
+			ThreadPlacement mUi;
+			ThreadPlacement mLogic;
+		};
+		std::vector<Scenario> scenarios{
+			{ L"default            ", {}, {} },
+			{ L"logic below normal ", {}, { {}, ThreadPriority::BELOW_NORMAL } },
+			{ L"ui above normal    ", { {}, ThreadPriority::ABOVE_NORMAL }, {} },
+			{ L"both               ", { {}, ThreadPriority::ABOVE_NORMAL }, { {}, ThreadPriority::BELOW_NORMAL } },
+		};
+		// with one core there is nothing to separate
+		if (!others.empty()) {
+			scenarios.push_back({ L"ui on its own core ", { { 0 }, ThreadPriority::ABOVE_NORMAL }, { others, ThreadPriority::BELOW_NORMAL } });
+		}
+
+		std::wstring report = std::format(L"Input latency under CPU saturation, {} logic threads on {} cores, {} ms per run:\n",
+			LogicThreads, cores, duration.count());
+
+		for (const Scenario& scenario : scenarios) {
+			std::atomic<bool> stop{ false };
+			std::atomic<bool> applied{ true };
+
+			std::vector<std::thread> logic;
+			for (uint32_t i{}; i < LogicThreads; i++) {
+				logic.emplace_back([&]() {
+					if (!ApplyCurrentThreadPlacement(scenario.mLogic.mCores, scenario.mLogic.mPriority)) applied.store(false, std::memory_order_relaxed);
+					volatile uint64_t work = 0;
+					while (!stop.load(std::memory_order_relaxed)) work = work + 1;
+				});
+			}
+
+			std::mutex event_mtx;
+			std::condition_variable event_cv;
+			std::chrono::steady_clock::time_point posted{};
+			bool pending = false;
+			LatencyHistogram latency;
+
+			std::thread ui([&]() {
+				if (!ApplyCurrentThreadPlacement(scenario.mUi.mCores, scenario.mUi.mPriority)) applied.store(false, std::memory_order_relaxed);
+				std::unique_lock<std::mutex> event_lock(event_mtx);
+				while (true) {
+					event_cv.wait(event_lock, [&]() { return pending || stop.load(std::memory_order_relaxed); });
+					if (!pending) break;
+					latency.Record((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - posted).count());
+					pending = false;
+				}
+			});
+
+			auto end = std::chrono::steady_clock::now() + duration;
+			while (std::chrono::steady_clock::now() < end) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				{
+					std::lock_guard<std::mutex> event_lock(event_mtx);
+					// an event the UI thread has not picked up yet is still waiting, keep its post time
+					if (!pending) posted = std::chrono::steady_clock::now();
+					pending = true;
+				}
+				event_cv.notify_one();
+			}
+
+			{
+				std::lock_guard<std::mutex> event_lock(event_mtx);
+				stop.store(true, std::memory_order_relaxed);
+				pending = false;
+			}
+			event_cv.notify_one();
+			ui.join();
+			for (auto& thread : logic) thread.join();
+
+			report += std::format(L"  {}{} {}\n", scenario.mName, latency.Read().Summary(),
+				applied.load(std::memory_order_relaxed) ? L"" : L"(a placement was refused)");
+		}
+		return report;
+	}
+}
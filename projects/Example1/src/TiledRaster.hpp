@@ -0,0 +1,488 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <string>
+#include <format>
+#include <algorithm>
+#include "Framebuffer.hpp"
+#include "AllocTracking.hpp"
+#include "ThreadLauncher.hpp"
+
+namespace WMTS {
+	enum class DrawOp : uint8_t {
+		FILL,
+		BLIT,
+		BLEND,
+		SCALE
+	};
+
+	// one recorded drawing call, sources are referenced, not copied
+	struct DrawCommand {
+		DrawOp mOp;
+		uint32_t mColor;
+
+		// where the command draws, before clipping
+		PixelRect mRect;
+
+		const Framebuffer* mSource;
+
+		// BLIT and BLEND, where in the source the top left corner of mRect comes from
+		int32_t mSourceX{};
+		int32_t mSourceY{};
+
+		// FILL, BLIT and SCALE replace every pixel they cover, BLEND reads them
+		bool Opaque() const { return mOp != DrawOp::BLEND; }
+	};
+
+	namespace detail {
+		// capacity growth is not steady state work, it stops once a window's frames have their usual size
+		template<class Vector>
+		void GrowIfFull(Vector& vector) {
+			if (vector.size() < vector.capacity()) return;
+			AllocAllowedScope growing;
+			vector.reserve(std::max<size_t>(16, vector.capacity() * 2));
+		}
+	}
+
+	// a frame recorded as a list of commands, rasterized later by a TiledRenderer
+	// has the same drawing calls as Framebuffer, so drawing code moves between the two unchanged
+	// Framebuffer sources must stay alive and unchanged until the list is rendered
+	class DrawList {
+	public:
+		// starts a new frame of the given size, keeps the capacity of the old one
+		void Reset(uint32_t width, uint32_t height) {
+			mWidth = width;
+			mHeight = height;
+			mCommands.clear();
+			mInvalidated.clear();
+			mInvalidatedAll = false;
+		}
+
+		// marks a rectangle as changed even though the commands drawing it are the same as last frame,
+		// for example when a Framebuffer used as a source was redrawn
+		void Invalidate(int32_t x, int32_t y, int32_t width, int32_t height) {
+			PixelRect rect = PixelRect::FromSize(x, y, width, height);
+			if (rect.Empty()) return;
+			detail::GrowIfFull(mInvalidated);
+			mInvalidated.push_back(rect);
+		}
+
+		// redraws the whole frame
+		void InvalidateAll() {
+			mInvalidatedAll = true;
+		}
+
+		const std::vector<PixelRect>& Invalidated() const { return mInvalidated; }
+		bool InvalidatedAll() const { return mInvalidatedAll; }
+
+		uint32_t Width() const { return mWidth; }
+		uint32_t Height() const { return mHeight; }
+
+		// everything recorded before a clear is hidden by it, so it is dropped here
+		void Clear(uint32_t color) {
+			mCommands.clear();
+			Push(DrawCommand{ DrawOp::FILL, color, PixelRect{ 0, 0, (int32_t)mWidth, (int32_t)mHeight }, nullptr });
+		}
+
+		void FillRect(int32_t x, int32_t y, int32_t width, int32_t height, uint32_t color) {
+			Push(DrawCommand{ DrawOp::FILL, color, PixelRect::FromSize(x, y, width, height), nullptr });
+		}
+
+		void Blit(const Framebuffer& source, int32_t x, int32_t y) {
+			Push(DrawCommand{ DrawOp::BLIT, 0, PixelRect::FromSize(x, y, (int32_t)source.Width(), (int32_t)source.Height()), &source });
+		}
+
+		void BlendOver(const Framebuffer& source, int32_t x, int32_t y) {
+			Push(DrawCommand{ DrawOp::BLEND, 0, PixelRect::FromSize(x, y, (int32_t)source.Width(), (int32_t)source.Height()), &source });
+		}
+
+		// the SourceRect part of source, an atlas entry for example
+		void Blit(const Framebuffer& source, const PixelRect& SourceRect, int32_t x, int32_t y) {
+			PushPart(DrawOp::BLIT, 0, source, SourceRect, x, y);
+		}
+
+		// the SourceRect part of source, Tag is kept in mColor so damage tracking sees it,
+		// text passes its color because atlas pages of different colors can share an address over time
+		void BlendOver(const Framebuffer& source, const PixelRect& SourceRect, int32_t x, int32_t y, uint32_t Tag = 0) {
+			PushPart(DrawOp::BLEND, Tag, source, SourceRect, x, y);
+		}
+
+		void BlitScaled(const Framebuffer& source, int32_t x, int32_t y, int32_t width, int32_t height) {
+			Push(DrawCommand{ DrawOp::SCALE, 0, PixelRect::FromSize(x, y, width, height), &source });
+		}
+
+		const std::vector<DrawCommand>& Commands() const {
+			return mCommands;
+		}
+
+		// runs one command on target, clipped to bounds
+		static void Execute(const DrawCommand& command, Framebuffer& target, const PixelRect& bounds) {
+			const PixelRect& rect = command.mRect;
+			switch (command.mOp) {
+			case DrawOp::FILL:
+				target.FillRect(rect.mLeft, rect.mTop, rect.mRight - rect.mLeft, rect.mBottom - rect.mTop, command.mColor, bounds);
+				break;
+			case DrawOp::BLIT:
+				target.Blit(*command.mSource, SourcePart(command), rect.mLeft, rect.mTop, bounds);
+				break;
+			case DrawOp::BLEND:
+				target.BlendOver(*command.mSource, SourcePart(command), rect.mLeft, rect.mTop, bounds);
+				break;
+			case DrawOp::SCALE:
+				target.BlitScaled(*command.mSource, rect.mLeft, rect.mTop, rect.mRight - rect.mLeft, rect.mBottom - rect.mTop, bounds);
+				break;
+			}
+		}
+
+	private:
+		static PixelRect SourcePart(const DrawCommand& command) {
+			return PixelRect::FromSize(command.mSourceX, command.mSourceY,
+				command.mRect.mRight - command.mRect.mLeft, command.mRect.mBottom - command.mRect.mTop);
+		}
+
+		void Push(const DrawCommand& command) {
+			if (command.mRect.Empty()) return;
+			detail::GrowIfFull(mCommands);
+			mCommands.push_back(command);
+		}
+
+		// clips SourceRect to the source first, so mRect is exactly what gets drawn
+		void PushPart(DrawOp op, uint32_t color, const Framebuffer& source, const PixelRect& SourceRect, int32_t x, int32_t y) {
+			PixelRect part = SourceRect.Intersect(source.Area());
+			if (part.Empty()) return;
+			DrawCommand command{ op, color, PixelRect::FromSize(x + part.mLeft - SourceRect.mLeft, y + part.mTop - SourceRect.mTop,
+				part.mRight - part.mLeft, part.mBottom - part.mTop), &source };
+			command.mSourceX = part.mLeft;
+			command.mSourceY = part.mTop;
+			Push(command);
+		}
+
+		uint32_t mWidth{};
+		uint32_t mHeight{};
+		std::vector<DrawCommand> mCommands;
+		std::vector<PixelRect> mInvalidated;
+		bool mInvalidatedAll{ false };
+	};
+
+	// process wide threads that rasterize tiles for every window's logic thread
+	// the calling logic thread works on its own frame too, so a frame is never slower than running it alone
+	// jobs from several windows are served in the order they arrive
+	class RasterWorkers {
+	public:
+		static RasterWorkers& Get() {
+			static RasterWorkers workers;
+			return workers;
+		}
+
+		~RasterWorkers() {
+			Stop();
+		}
+
+		// threads besides the caller, 0 renders every frame on its logic thread
+		// the default is hardware_concurrency() - 1, takes effect from the next Run()
+		// joins the current threads, so call it while no frame is being rendered
+		void SetThreads(size_t threads) {
+			Stop();
+			std::lock_guard<std::mutex> local_lock(mWorkers_mtx);
+			mWanted = threads;
+		}
+
+		size_t Threads() {
+			std::lock_guard<std::mutex> local_lock(mWorkers_mtx);
+			return mWanted;
+		}
+
+		// calls fn(index) for every index in [0, count) across the workers and the calling thread
+		// returns once every call has finished, never allocates after the threads are started
+		template<class F>
+		void Run(size_t count, F&& fn) {
+			Job job;
+			job.mCount = count;
+			job.mContext = &fn;
+			job.mInvoke = [](void* context, size_t index) { (*static_cast<std::remove_reference_t<F>*>(context))(index); };
+
+			{
+				std::lock_guard<std::mutex> local_lock(mWorkers_mtx);
+				StartLocked();
+				if (!mThreads.empty()) {
+					Job** tail = &mJobs;
+					while (*tail) tail = &(*tail)->mNextJob;
+					*tail = &job;
+				}
+			}
+			mWork_cv.notify_all();
+
+			Work(job);
+
+			std::unique_lock<std::mutex> workers_lock(mWorkers_mtx);
+			// no worker can pick the job up once it is unlinked, then wait for those that did
+			Unlink(job);
+			mDone_cv.wait(workers_lock, [&job] { return job.mUsers == 0; });
+		}
+
+	private:
+		RasterWorkers() = default;
+
+		struct Job {
+			// the next index to hand out
+			std::atomic<size_t> mNextIndex{ 0 };
+			size_t mCount{};
+			void* mContext{};
+			void (*mInvoke)(void*, size_t) {};
+
+			// workers inside the job and the link to the next job, only changed under mWorkers_mtx
+			size_t mUsers{};
+			Job* mNextJob{};
+		};
+
+		static void Work(Job& job) {
+			for (size_t index = job.mNextIndex.fetch_add(1, std::memory_order_relaxed); index < job.mCount;
+				index = job.mNextIndex.fetch_add(1, std::memory_order_relaxed)) {
+				job.mInvoke(job.mContext, index);
+			}
+		}
+
+		// mWorkers_mtx must be held
+		void Unlink(Job& job) {
+			for (Job** link = &mJobs; *link; link = &(*link)->mNextJob) {
+				if (*link == &job) {
+					*link = job.mNextJob;
+					return;
+				}
+			}
+		}
+
+		// mWorkers_mtx must be held
+		void StartLocked() {
+			if (mStarted) return;
+			mStarted = true;
+			mStopping = false;
+			size_t threads = mWanted == SIZE_MAX ? std::max(1u, std::thread::hardware_concurrency()) - 1 : mWanted;
+			mWanted = threads;
+
+			AllocAllowedScope starting_threads;
+			for (size_t i{}; i < threads; i++) {
+				mThreads.push_back(std::make_unique<NativeThread>(NamedThreadAttributes(256 * 1024, L"WMTS raster"), [this] { WorkerLoop(); }));
+			}
+		}
+
+		void Stop() {
+			{
+				std::lock_guard<std::mutex> local_lock(mWorkers_mtx);
+				mStopping = true;
+			}
+			mWork_cv.notify_all();
+			for (auto& thread : mThreads) {
+				if (thread->joinable()) thread->join();
+			}
+			std::lock_guard<std::mutex> local_lock(mWorkers_mtx);
+			mThreads.clear();
+			mStarted = false;
+		}
+
+		void WorkerLoop() {
+			std::unique_lock<std::mutex> workers_lock(mWorkers_mtx);
+			while (true) {
+				mWork_cv.wait(workers_lock, [this] { return mStopping || FirstOpenJob(); });
+				if (mStopping) return;
+
+				Job* job = FirstOpenJob();
+				job->mUsers++;
+				workers_lock.unlock();
+				Work(*job);
+				workers_lock.lock();
+				if (--job->mUsers == 0) mDone_cv.notify_all();
+			}
+		}
+
+		// mWorkers_mtx must be held, the oldest job that still has indices to hand out
+		Job* FirstOpenJob() {
+			for (Job* job = mJobs; job; job = job->mNextJob) {
+				if (job->mNextIndex.load(std::memory_order_relaxed) < job->mCount) return job;
+			}
+			return nullptr;
+		}
+
+		std::mutex mWorkers_mtx;
+		std::condition_variable mWork_cv;
+		std::condition_variable mDone_cv;
+		std::vector<std::unique_ptr<NativeThread>> mThreads;
+		size_t mWanted{ SIZE_MAX };
+		bool mStarted{ false };
+		bool mStopping{ false };
+
+		// jobs in arrival order, each lives on its caller's stack
+		Job* mJobs{ nullptr };
+	};
+
+	struct TileConfig {
+		// 128 x 64 pixels is 32 KB, a tile and the sources it reads stay in L2 while its commands run
+		uint32_t mTileWidth{ 128 };
+		uint32_t mTileHeight{ 64 };
+
+		// smaller frames are rendered on the logic thread alone, waking workers costs more than it saves
+		uint32_t mMinParallelPixels{ 256 * 256 };
+	};
+
+	// rasterizes a DrawList into a Framebuffer one tile at a time
+	// every command is binned to the tiles it touches, then each tile runs only its own commands,
+	// so a tile's pixels are brought into cache once per frame no matter how many commands cover them
+	// an opaque command that covers a whole tile drops the commands binned to that tile before it
+	class TiledRenderer {
+	public:
+		explicit TiledRenderer(const TileConfig& config = {}) :mConfig(config) {
+			mConfig.mTileWidth = std::max<uint32_t>(mConfig.mTileWidth, 8);
+			mConfig.mTileHeight = std::max<uint32_t>(mConfig.mTileHeight, 8);
+		}
+
+		// list must have been recorded for target's size
+		// with Regions only the pixels inside them are rendered, the rest of target is left as it is
+		void Render(const DrawList& list, Framebuffer& target, const PixelRect* Regions = nullptr, size_t RegionCount = 0) {
+			mColumns = (target.Width() + mConfig.mTileWidth - 1) / mConfig.mTileWidth;
+			mRows = (target.Height() + mConfig.mTileHeight - 1) / mConfig.mTileHeight;
+			size_t tiles = (size_t)mColumns * mRows;
+			if (tiles == 0) return;
+
+			Bin(list, tiles);
+
+			auto run_tile = [this, &list, &target, Regions, RegionCount](size_t tile) {
+				PixelRect tile_rect = TileRect(tile);
+				if (!Regions) {
+					for (uint32_t index : mBins[tile]) {
+						DrawList::Execute(list.Commands()[index], target, tile_rect);
+					}
+					return;
+				}
+				// a tile outside every region costs one rectangle test per region
+				for (size_t region{}; region < RegionCount; region++) {
+					PixelRect bounds = tile_rect.Intersect(Regions[region]);
+					if (bounds.Empty()) continue;
+					for (uint32_t index : mBins[tile]) {
+						DrawList::Execute(list.Commands()[index], target, bounds);
+					}
+				}
+			};
+
+			if (tiles == 1 || (size_t)target.Width() * target.Height() < mConfig.mMinParallelPixels) {
+				for (size_t tile{}; tile < tiles; tile++) run_tile(tile);
+			}
+			else {
+				RasterWorkers::Get().Run(tiles, run_tile);
+			}
+		}
+
+		// the bin sizes from the last Render(), commands executed summed over tiles
+		size_t BinnedCommands() const {
+			size_t total = 0;
+			for (size_t tile{}; tile < (size_t)mColumns * mRows; tile++) total += mBins[tile].size();
+			return total;
+		}
+
+	private:
+		PixelRect TileRect(size_t tile) const {
+			int32_t x = (int32_t)((tile % mColumns) * mConfig.mTileWidth);
+			int32_t y = (int32_t)((tile / mColumns) * mConfig.mTileHeight);
+			return PixelRect::FromSize(x, y, (int32_t)mConfig.mTileWidth, (int32_t)mConfig.mTileHeight);
+		}
+
+		void Bin(const DrawList& list, size_t tiles) {
+			if (mBins.size() < tiles) {
+				AllocAllowedScope growing;
+				mBins.resize(tiles);
+			}
+			for (size_t tile{}; tile < tiles; tile++) mBins[tile].clear();
+
+			const auto& commands = list.Commands();
+			for (uint32_t index{}; index < (uint32_t)commands.size(); index++) {
+				const DrawCommand& command = commands[index];
+				const PixelRect& rect = command.mRect;
+
+				// tiles the command touches, the rect is clamped to the frame first
+				int32_t left = std::max(rect.mLeft, 0);
+				int32_t top = std::max(rect.mTop, 0);
+				int32_t right = std::min<int32_t>(rect.mRight, (int32_t)(mColumns * mConfig.mTileWidth));
+				int32_t bottom = std::min<int32_t>(rect.mBottom, (int32_t)(mRows * mConfig.mTileHeight));
+				if (left >= right || top >= bottom) continue;
+
+				uint32_t first_column = (uint32_t)left / mConfig.mTileWidth;
+				uint32_t last_column = (uint32_t)(right - 1) / mConfig.mTileWidth;
+				uint32_t first_row = (uint32_t)top / mConfig.mTileHeight;
+				uint32_t last_row = (uint32_t)(bottom - 1) / mConfig.mTileHeight;
+
+				for (uint32_t row = first_row; row <= last_row; row++) {
+					for (uint32_t column = first_column; column <= last_column; column++) {
+						size_t tile = (size_t)row * mColumns + column;
+						auto& bin = mBins[tile];
+						if (command.Opaque()) {
+							PixelRect tile_rect = TileRect(tile);
+							if (rect.mLeft <= tile_rect.mLeft && rect.mTop <= tile_rect.mTop &&
+								rect.mRight >= tile_rect.mRight && rect.mBottom >= tile_rect.mBottom) {
+								bin.clear();
+							}
+						}
+						detail::GrowIfFull(bin);
+						bin.push_back(index);
+					}
+				}
+			}
+		}
+
+		TileConfig mConfig;
+		uint32_t mColumns{};
+		uint32_t mRows{};
+
+		// per tile command indices, cleared every frame and never shrunk
+		std::vector<std::vector<uint32_t>> mBins;
+	};
+
+	// times Render() of a typical UI frame (a clear, a few hundred rectangles and some blended sprites)
+	// at each size for 1 to MaxThreads threads, reports milliseconds per frame and speedup over 1 thread
+	// takes a few seconds, not for a frame, Example1 --benchmark-tiles runs it at 720p, 1080p and 4K up to one thread per hardware thread
+	inline std::wstring BenchmarkTiledRaster(const std::vector<std::pair<uint32_t, uint32_t>>& sizes, size_t MaxThreads, int frames = 30) {
+		size_t saved = RasterWorkers::Get().Threads();
+		std::wstring report = L"Tiled raster, ms per frame (speedup over 1 thread):\n";
+
+		Framebuffer sprite;
+		sprite.Resize(64, 64);
+		sprite.Clear(0x80402010u);
+
+		for (auto [width, height] : sizes) {
+			Framebuffer target;
+			target.Resize(width, height);
+			DrawList list;
+			list.Reset(width, height);
+			list.Clear(PackColor(32, 40, 48));
+			for (uint32_t i{}; i < 300; i++) {
+				list.FillRect((int32_t)((i * 97) % width), (int32_t)((i * 57) % height), (int32_t)(width / 8), (int32_t)(height / 12), PackColor((uint8_t)i, 90, 200));
+			}
+			for (uint32_t i{}; i < 100; i++) {
+				list.BlendOver(sprite, (int32_t)((i * 131) % width), (int32_t)((i * 71) % height));
+			}
+
+			report += std::format(L"  {}x{}:", width, height);
+			double single = 0;
+			for (size_t threads = 1; threads <= std::max<size_t>(MaxThreads, 1); threads++) {
+				RasterWorkers::Get().SetThreads(threads - 1);
+				TiledRenderer renderer(TileConfig{ 128, 64, 0 });
+				renderer.Render(list, target);
+
+				auto start = std::chrono::steady_clock::now();
+				for (int f = 0; f < frames; f++) renderer.Render(list, target);
+				double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+				if (threads == 1) single = ms;
+				report += std::format(L" {}t={:.2f}ms({:.1f}x)", threads, ms, ms > 0 ? single / ms : 0.0);
+			}
+			report += L"\n";
+		}
+
+		RasterWorkers::Get().SetThreads(saved);
+		return report;
+	}
+}
@@ -0,0 +1,263 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <format>
+#include <algorithm>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define WMTS_TRACE_HAS_RDTSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define WMTS_TRACE_HAS_RDTSC 1
+#else
+#define WMTS_TRACE_HAS_RDTSC 0
+#endif
+
+// set WMTS_TRACE to 1 (cmake -DWMTS_TRACE=ON) to record spans and instant events
+// and write them as Chrome trace JSON (open it in https://ui.perfetto.dev or chrome://tracing)
+// when it is 0 the trace macros expand to nothing
+#ifndef WMTS_TRACE
+#define WMTS_TRACE 0
+#endif
+
+// events kept per thread, the oldest events are overwritten when a thread records more
+#ifndef WMTS_TRACE_BUFFER_EVENTS
+#define WMTS_TRACE_BUFFER_EVENTS 8192
+#endif
+
+namespace WMTS {
+	struct TraceEvent {
+		// must be a string literal or otherwise outlive the tracer
+		const char* mName;
+
+		// raw Tracer::Now() ticks, converted to time when the trace is written
+		uint64_t mStart;
+
+		// duration in ticks, 0 for instant events
+		uint64_t mDuration;
+
+		// 'X' complete span, 'i' instant event
+		char mPhase;
+	};
+
+	// a single producer ring of events owned by one thread
+	// the owning thread writes without locks, the exporter copies from any thread
+	class TraceBuffer {
+	public:
+		static constexpr size_t Capacity = WMTS_TRACE_BUFFER_EVENTS;
+
+		explicit TraceBuffer(uint32_t tid) :mTid(tid), mEvents(Capacity) {}
+
+		void Push(const TraceEvent& e) {
+			uint64_t head = mHead.load(std::memory_order_relaxed);
+			mEvents[head % Capacity] = e;
+			mHead.store(head + 1, std::memory_order_release);
+		}
+
+		// copies the events that are still in the ring
+		// events the owner may have been overwriting during the copy are dropped
+		std::vector<TraceEvent> Copy() const {
+			uint64_t head_before = mHead.load(std::memory_order_acquire);
+			uint64_t first = head_before > Capacity ? head_before - Capacity : 0;
+
+			std::vector<TraceEvent> events;
+			events.reserve((size_t)(head_before - first));
+			for (uint64_t i = first; i < head_before; i++) {
+				events.push_back(mEvents[i % Capacity]);
+			}
+
+			uint64_t head_after = mHead.load(std::memory_order_acquire);
+			if (head_after >= Capacity + first) {
+				size_t overwritten = (size_t)std::min<uint64_t>(head_after - Capacity - first + 1, events.size());
+				events.erase(events.begin(), events.begin() + overwritten);
+			}
+			return events;
+		}
+
+		void SetName(const std::string& name) {
+			std::lock_guard<std::mutex> local_lock(mName_mtx);
+			mName = name;
+		}
+
+		std::string GetName() {
+			std::lock_guard<std::mutex> local_lock(mName_mtx);
+			return mName;
+		}
+
+		uint32_t Tid() const { return mTid; }
+
+	private:
+		uint32_t mTid;
+		std::vector<TraceEvent> mEvents;
+		std::atomic<uint64_t> mHead{ 0 };
+
+		// the name is set rarely so a lock is fine here
+		std::mutex mName_mtx;
+		std::string mName;
+	};
+
+	class Tracer {
+	public:
+		static Tracer& Get() {
+			static Tracer tracer;
+			return tracer;
+		}
+
+		// a raw timestamp in ticks
+		// the time stamp counter is read directly because two steady_clock reads per span
+		// cost more than the whole span budget, ticks are calibrated against steady_clock on export
+		static uint64_t Now() {
+#if WMTS_TRACE_HAS_RDTSC
+			return __rdtsc();
+#else
+			return (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+		}
+
+		// the calling thread's buffer, created and registered on first use
+		TraceBuffer& ThreadBuffer() {
+			thread_local std::shared_ptr<TraceBuffer> buffer = Register();
+			return *buffer;
+		}
+
+		void Complete(const char* name, uint64_t start, uint64_t end) {
+			ThreadBuffer().Push(TraceEvent{ name, start, end - start, 'X' });
+		}
+
+		void Instant(const char* name) {
+			ThreadBuffer().Push(TraceEvent{ name, Now(), 0, 'i' });
+		}
+
+		// shows up as the thread's name in the trace viewer
+		void SetThreadName(const std::string& name) {
+			ThreadBuffer().SetName(name);
+		}
+
+		// writes every thread's buffer as Chrome trace event JSON
+		// returns false if the file could not be written
+		bool WriteChromeTrace(const std::filesystem::path& path) {
+			std::vector<std::shared_ptr<TraceBuffer>> buffers;
+			{
+				std::lock_guard<std::mutex> local_lock(mBuffers_mtx);
+				buffers = mBuffers;
+			}
+
+			std::ofstream file(path, std::ios::out | std::ios::trunc);
+			if (!file.is_open()) return false;
+
+			// nanoseconds per tick measured over the whole run so far
+			double ns_per_tick = NanosecondsPerTick();
+
+			file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+			bool first = true;
+			auto separator = [&file, &first]() {
+				if (!first) file << ",\n";
+				first = false;
+			};
+
+			for (auto& buffer : buffers) {
+				std::string name = buffer->GetName();
+				if (name.empty()) name = std::format("thread {}", buffer->Tid());
+
+				separator();
+				file << std::format(R"({{"ph":"M","name":"thread_name","pid":1,"tid":{},"args":{{"name":"{}"}}}})", buffer->Tid(), Escape(name));
+
+				for (const auto& e : buffer->Copy()) {
+					separator();
+					// chrome traces use microseconds, keep the nanoseconds as decimals
+					if (e.mPhase == 'X') {
+						file << std::format(R"({{"ph":"X","name":"{}","pid":1,"tid":{},"ts":{:.3f},"dur":{:.3f}}})",
+							Escape(e.mName), buffer->Tid(), ToMicroseconds(e.mStart, ns_per_tick), e.mDuration * ns_per_tick / 1000.0);
+					}
+					else {
+						file << std::format(R"({{"ph":"i","s":"t","name":"{}","pid":1,"tid":{},"ts":{:.3f}}})",
+							Escape(e.mName), buffer->Tid(), ToMicroseconds(e.mStart, ns_per_tick));
+					}
+				}
+			}
+			file << "\n]}\n";
+			return !file.fail();
+		}
+
+	private:
+		Tracer() = default;
+
+		double NanosecondsPerTick() const {
+#if WMTS_TRACE_HAS_RDTSC
+			auto elapsed_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - mEpoch).count();
+			auto elapsed_ticks = (double)(Now() - mEpochTicks);
+			return elapsed_ticks > 0.0 ? elapsed_ns / elapsed_ticks : 1.0;
+#else
+			return (double)std::chrono::steady_clock::period::num * 1e9 / (double)std::chrono::steady_clock::period::den;
+#endif
+		}
+
+		// microseconds since the tracer was created
+		double ToMicroseconds(uint64_t ticks, double ns_per_tick) const {
+			return (double)(int64_t)(ticks - mEpochTicks) * ns_per_tick / 1000.0;
+		}
+
+		std::shared_ptr<TraceBuffer> Register() {
+			std::lock_guard<std::mutex> local_lock(mBuffers_mtx);
+			auto buffer = std::make_shared<TraceBuffer>(mNextTid++);
+			mBuffers.push_back(buffer);
+			return buffer;
+		}
+
+		static std::string Escape(const std::string& s) {
+			std::string escaped;
+			escaped.reserve(s.size());
+			for (char c : s) {
+				if (c == '"' || c == '\\') escaped.push_back('\\');
+				if ((unsigned char)c < 0x20) continue;
+				escaped.push_back(c);
+			}
+			return escaped;
+		}
+
+		std::chrono::steady_clock::time_point mEpoch{ std::chrono::steady_clock::now() };
+		uint64_t mEpochTicks{ Now() };
+
+		// buffers of finished threads are kept so their events are still exported
+		std::mutex mBuffers_mtx;
+		std::vector<std::shared_ptr<TraceBuffer>> mBuffers;
+		uint32_t mNextTid{ 1 };
+	};
+
+	// records a complete span from construction to destruction
+	class TraceScope {
+	public:
+		explicit TraceScope(const char* name) :mName(name), mStart(Tracer::Now()) {}
+
+		~TraceScope() {
+			Tracer::Get().Complete(mName, mStart, Tracer::Now());
+		}
+
+		TraceScope(const TraceScope&) = delete;
+		TraceScope& operator=(const TraceScope&) = delete;
+
+	private:
+		const char* mName;
+		uint64_t mStart;
+	};
+}
+
+#define WMTS_TRACE_CONCAT_INNER(a, b) a##b
+#define WMTS_TRACE_CONCAT(a, b) WMTS_TRACE_CONCAT_INNER(a, b)
+
+#if WMTS_TRACE
+#define WMTS_TRACE_SCOPE(name) WMTS::TraceScope WMTS_TRACE_CONCAT(wmts_trace_scope_, __LINE__)(name)
+#define WMTS_TRACE_INSTANT(name) WMTS::Tracer::Get().Instant(name)
+#define WMTS_TRACE_THREAD_NAME(name) WMTS::Tracer::Get().SetThreadName(name)
+#else
+#define WMTS_TRACE_SCOPE(name) ((void)0)
+#define WMTS_TRACE_INSTANT(name) ((void)0)
+#define WMTS_TRACE_THREAD_NAME(name) ((void)0)
+#endif
@@ -0,0 +1,163 @@
+#pragma once
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <format>
+#include <thread>
+#include "Histogram.hpp"
+
+namespace WMTS {
+	// a lock free single producer single consumer mailbox of three slots, the newest published one wins
+	// the producer always owns a slot to write (Back) and the consumer always owns a slot to read (Front),
+	// the third slot sits in between and is handed over with one atomic exchange on either side
+	// publishing over a frame the consumer never took replaces it, so the consumer skips stale frames
+	// and neither side ever waits for the other
+	template<class T>
+	class TripleBuffer {
+	public:
+		TripleBuffer() = default;
+
+		TripleBuffer(const TripleBuffer&) = delete;
+		TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+		// producer only, the slot to fill next, its contents are whatever the slot held when it came back
+		T& Back() { return mSlots[mBack]; }
+
+		// producer only, hands Back() to the consumer and takes the middle slot as the new Back()
+		// returns true if that replaced a published slot the consumer never took
+		bool Publish() {
+			uint32_t previous = mMiddle.exchange(mBack | Fresh, std::memory_order_acq_rel);
+			mBack = previous & IndexMask;
+			return (previous & Fresh) != 0;
+		}
+
+		// consumer only, swaps Front() for the newest published slot
+		// returns false, keeping Front(), if nothing was published since the last call
+		bool Acquire() {
+			// only the consumer clears Fresh, so a set bit seen here is still set at the exchange
+			if (!(mMiddle.load(std::memory_order_relaxed) & Fresh)) return false;
+			uint32_t previous = mMiddle.exchange(mFront, std::memory_order_acq_rel);
+			mFront = previous & IndexMask;
+			return true;
+		}
+
+		// consumer only, the newest slot it acquired
+		T& Front() { return mSlots[mFront]; }
+		const T& Front() const { return mSlots[mFront]; }
+
+	private:
+		static constexpr uint32_t IndexMask = 3;
+		static constexpr uint32_t Fresh = 4;
+
+		std::array<T, 3> mSlots{};
+
+		// each side's own index on its own cache line, the shared one on a third
+		alignas(64) uint32_t mBack{ 0 };
+		alignas(64) std::atomic<uint32_t> mMiddle{ 1 };
+		alignas(64) uint32_t mFront{ 2 };
+	};
+
+	// runs a producer publishing Frames numbered frames against a consumer acquiring as fast as it can
+	// every slot is filled with its frame number, the consumer checks each frame it takes is whole,
+	// newer than the last one and never torn by the producer, reports OK or FAILED with the counts
+	// takes about a second, not for a frame, Example1 --stress-triple-buffer runs it
+	inline std::wstring StressTripleBuffer(uint64_t Frames = 1'000'000) {
+		struct Slot {
+			uint64_t mNumber{};
+			std::array<uint64_t, 15> mCopies{};
+		};
+		TripleBuffer<Slot> mailbox;
+		std::atomic<bool> done{ false };
+		uint64_t replaced = 0;
+
+		std::thread producer([&]() {
+			for (uint64_t frame = 1; frame <= Frames; frame++) {
+				Slot& slot = mailbox.Back();
+				slot.mNumber = frame;
+				slot.mCopies.fill(frame);
+				if (mailbox.Publish()) replaced++;
+				// lets the consumer in now and then on machines with fewer cores than threads
+				if (frame % 64 == 0) std::this_thread::yield();
+			}
+			done.store(true, std::memory_order_release);
+		});
+
+		uint64_t taken = 0, torn = 0, backwards = 0, last = 0;
+		for (;;) {
+			bool finished = done.load(std::memory_order_acquire);
+			if (mailbox.Acquire()) {
+				const Slot& slot = mailbox.Front();
+				for (uint64_t copy : slot.mCopies) {
+					if (copy != slot.mNumber) {
+						torn++;
+						break;
+					}
+				}
+				if (slot.mNumber <= last) backwards++;
+				last = slot.mNumber;
+				taken++;
+			}
+			else if (finished) {
+				break;
+			}
+			else {
+				std::this_thread::yield();
+			}
+		}
+		producer.join();
+
+		// the producer finished before the last empty Acquire(), so the last frame must have been taken
+		bool ok = torn == 0 && backwards == 0 && last == Frames && taken + replaced == Frames;
+		return std::format(L"Triple buffer stress: {} published={} taken={} skipped={} torn={} out of order={} last={}\n",
+			ok ? L"OK" : L"FAILED", Frames, taken, replaced, torn, backwards, last);
+	}
+
+	// measures the time from Publish() to the consumer's Acquire() of that frame
+	// the producer publishes a frame every IntervalUs microseconds, the consumer polls like a paint loop
+	// that sleeps PollUs between checks, 0 spins, reports the latency histogram and how many frames were skipped
+	// Example1 --benchmark-handoff runs it with the defaults, a spinning consumer
+	inline std::wstring BenchmarkFrameHandoff(uint64_t Frames = 2000, uint32_t IntervalUs = 1000, uint32_t PollUs = 0) {
+		TripleBuffer<uint64_t> mailbox;
+		LatencyHistogram latency;
+		std::atomic<bool> done{ false };
+		uint64_t replaced = 0;
+
+		auto now_ns = []() {
+			return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		};
+
+		std::thread producer([&]() {
+			auto next = std::chrono::steady_clock::now();
+			for (uint64_t frame{}; frame < Frames; frame++) {
+				next += std::chrono::microseconds(IntervalUs);
+				std::this_thread::sleep_until(next);
+				mailbox.Back() = now_ns();
+				if (mailbox.Publish()) replaced++;
+			}
+			done.store(true, std::memory_order_release);
+		});
+
+		for (;;) {
+			bool finished = done.load(std::memory_order_acquire);
+			if (mailbox.Acquire()) {
+				latency.Record(now_ns() - mailbox.Front());
+			}
+			else if (finished) {
+				break;
+			}
+			else if (PollUs) {
+				std::this_thread::sleep_for(std::chrono::microseconds(PollUs));
+			}
+			else {
+				std::this_thread::yield();
+			}
+		}
+		producer.join();
+
+		return std::format(L"Frame handoff, a frame every {}us, polled every {}us: skipped={}\n  publish to acquire {}\n",
+			IntervalUs, PollUs, replaced, latency.Read().Summary());
+	}
+}
@@ -0,0 +1,254 @@
+#pragma once
+#include <Windows.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <algorithm>
+
+// set WMTS_WATCHDOG to 1 (cmake -DWMTS_WATCHDOG=ON) to run a thread that flags hung message loops
+#ifndef WMTS_WATCHDOG
+#define WMTS_WATCHDOG 0
+#endif
+
+namespace WMTS {
+	// the progress marker of one message loop
+	// the UI thread only does two relaxed stores per message, the watchdog thread does the timing
+	struct PumpHeartbeat {
+		explicit PumpHeartbeat(HWND WindowHandle) :mWindowHandle(WindowHandle) {}
+
+		// call before and after WindowProcedure
+		// the sequence is odd while a message is being handled and even while the loop is idle
+		void BeginDispatch(UINT message) {
+			mMessage.store(message, std::memory_order_relaxed);
+			mSequence.store(mSequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+		// a no-op when the loop is already idle, which it is when a modal loop ended without its exit message
+		void EndDispatch() {
+			uint64_t sequence = mSequence.load(std::memory_order_relaxed);
+			if (sequence & 1) mSequence.store(sequence + 1, std::memory_order_release);
+		}
+
+		// UI thread only, true while no message is in flight
+		bool Idle() const {
+			return (mSequence.load(std::memory_order_relaxed) & 1) == 0;
+		}
+
+		// call after WM_ENTERSIZEMOVE or WM_ENTERMENULOOP, the message in flight now runs Windows' modal loop
+		// which waits for input just like the pump does, so the loop counts as idle until ExitModalLoop()
+		// and the messages the modal loop dispatches are watched as dispatches of their own
+		void EnterModalLoop() {
+			if (mModalDepth++ != 0 || Idle()) return;
+			mOuterMessage = mMessage.load(std::memory_order_relaxed);
+			EndDispatch();
+		}
+
+		// call before WM_EXITSIZEMOVE or WM_EXITMENULOOP, the outer message is in flight again and timed from here
+		void ExitModalLoop() {
+			if (mModalDepth == 0 || --mModalDepth != 0 || !Idle()) return;
+			BeginDispatch(mOuterMessage);
+		}
+
+		const HWND mWindowHandle;
+		std::atomic<uint64_t> mSequence{ 0 };
+		std::atomic<UINT> mMessage{ 0 };
+
+		// only touched by the UI thread, the modal loops entered and the message that entered the outermost one
+		uint32_t mModalDepth{ 0 };
+		UINT mOuterMessage{ 0 };
+
+		// only touched by the watchdog thread
+		uint64_t mLastSequence{ 0 };
+		std::chrono::steady_clock::time_point mFirstSeen{};
+		bool mFlagged{ false };
+	};
+
+	struct HangEvent {
+		HWND mWindowHandle;
+
+		// the message that was in flight
+		UINT mMessage;
+
+		// how long the message had been in flight when the event was raised
+		// measured from when the watchdog first saw it, so it is a lower bound
+		std::chrono::milliseconds mDuration;
+
+		// false when the hang is first detected, true when the loop made progress again
+		bool mRecovered;
+	};
+
+	// counters for alerting, read them with Watchdog::GetCounters()
+	struct WatchdogCounters {
+		uint64_t mHangsDetected{};
+		uint64_t mHangsRecovered{};
+		uint64_t mCurrentlyHung{};
+		std::chrono::milliseconds mLongestHang{};
+	};
+
+	// scans every registered message loop and flags any loop that has been inside
+	// the same message for longer than the responsiveness budget
+	class Watchdog {
+	public:
+		explicit Watchdog(std::chrono::milliseconds budget = std::chrono::milliseconds(100)) :mBudget(budget) {}
+
+		~Watchdog() {
+			Stop();
+		}
+
+		Watchdog(const Watchdog&) = delete;
+		Watchdog& operator=(const Watchdog&) = delete;
+
+		void Start() {
+			std::lock_guard<std::mutex> local_lock(mState_mtx);
+			if (mThread.joinable()) return;
+			mStop = false;
+			mThread = std::thread(&Watchdog::Scan, this);
+		}
+
+		void Stop() {
+			{
+				std::lock_guard<std::mutex> local_lock(mState_mtx);
+				mStop = true;
+			}
+			mStop_cv.notify_one();
+			if (mThread.joinable()) mThread.join();
+		}
+
+		// the loop is flagged when a single message takes longer than budget
+		void SetBudget(std::chrono::milliseconds budget) {
+			std::lock_guard<std::mutex> local_lock(mState_mtx);
+			mBudget = budget;
+		}
+
+		// called from the watchdog thread for every detection and every recovery
+		// keep it short, the next scan waits for it
+		void SetOnHang(std::function<void(const HangEvent&)> callback) {
+			std::lock_guard<std::mutex> local_lock(mState_mtx);
+			mOnHang = std::move(callback);
+		}
+
+		std::shared_ptr<PumpHeartbeat> Register(HWND WindowHandle) {
+			auto heartbeat = std::make_shared<PumpHeartbeat>(WindowHandle);
+			std::lock_guard<std::mutex> local_lock(mPumps_mtx);
+			mPumps.push_back(heartbeat);
+			return heartbeat;
+		}
+
+		void Unregister(const std::shared_ptr<PumpHeartbeat>& heartbeat) {
+			std::lock_guard<std::mutex> local_lock(mPumps_mtx);
+			auto found = std::find(mPumps.begin(), mPumps.end(), heartbeat);
+			if (found != mPumps.end()) {
+				if ((*found)->mFlagged) {
+					mCounters.mCurrentlyHung--;
+				}
+				mPumps.erase(found);
+			}
+		}
+
+		WatchdogCounters GetCounters() {
+			std::lock_guard<std::mutex> local_lock(mPumps_mtx);
+			return mCounters;
+		}
+
+		// the most recent detections and recoveries, oldest first
+		std::vector<HangEvent> GetRecentEvents() {
+			std::lock_guard<std::mutex> local_lock(mPumps_mtx);
+			return std::vector<HangEvent>(mEvents.begin(), mEvents.end());
+		}
+
+	private:
+		// how many events GetRecentEvents() keeps
+		static constexpr size_t MaxEvents = 64;
+
+		void Scan() {
+			std::unique_lock<std::mutex> state_lock(mState_mtx);
+			while (!mStop) {
+				// scan four times per budget so a hang is seen at most budget/4 late
+				auto interval = std::max(mBudget / 4, std::chrono::milliseconds(1));
+				mStop_cv.wait_for(state_lock, interval, [this] { return mStop; });
+				if (mStop) break;
+
+				auto budget = mBudget;
+				auto on_hang = mOnHang;
+				state_lock.unlock();
+
+				std::vector<HangEvent> raised;
+				{
+					std::lock_guard<std::mutex> local_lock(mPumps_mtx);
+					auto now = std::chrono::steady_clock::now();
+					for (auto& pump : mPumps) {
+						Check(*pump, now, budget, raised);
+					}
+				}
+
+				if (on_hang) {
+					for (const auto& event : raised) {
+						on_hang(event);
+					}
+				}
+
+				state_lock.lock();
+			}
+		}
+
+		// mPumps_mtx must be held
+		void Check(PumpHeartbeat& pump, std::chrono::steady_clock::time_point now, std::chrono::milliseconds budget, std::vector<HangEvent>& raised) {
+			uint64_t sequence = pump.mSequence.load(std::memory_order_acquire);
+			bool in_dispatch = (sequence & 1) != 0;
+
+			if (sequence != pump.mLastSequence) {
+				// progress since the last scan
+				if (pump.mFlagged) {
+					auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - pump.mFirstSeen);
+					Raise(HangEvent{ pump.mWindowHandle, pump.mMessage.load(std::memory_order_relaxed), duration, true }, raised);
+					mCounters.mHangsRecovered++;
+					mCounters.mCurrentlyHung--;
+					mCounters.mLongestHang = std::max(mCounters.mLongestHang, duration);
+					pump.mFlagged = false;
+				}
+				pump.mLastSequence = sequence;
+				pump.mFirstSeen = now;
+				return;
+			}
+
+			if (!in_dispatch || pump.mFlagged) return;
+
+			auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - pump.mFirstSeen);
+			if (duration >= budget) {
+				pump.mFlagged = true;
+				mCounters.mHangsDetected++;
+				mCounters.mCurrentlyHung++;
+				Raise(HangEvent{ pump.mWindowHandle, pump.mMessage.load(std::memory_order_relaxed), duration, false }, raised);
+			}
+		}
+
+		void Raise(const HangEvent& event, std::vector<HangEvent>& raised) {
+			mEvents.push_back(event);
+			if (mEvents.size() > MaxEvents) mEvents.pop_front();
+			raised.push_back(event);
+		}
+
+		// guards the settings and the stop flag
+		std::mutex mState_mtx;
+		std::condition_variable mStop_cv;
+		bool mStop{ false };
+		std::chrono::milliseconds mBudget;
+		std::function<void(const HangEvent&)> mOnHang;
+		std::thread mThread;
+
+		// guards the registered loops, the counters and the events
+		std::mutex mPumps_mtx;
+		std::vector<std::shared_ptr<PumpHeartbeat>> mPumps;
+		WatchdogCounters mCounters;
+		std::deque<HangEvent> mEvents;
+	};
+
+	// the heartbeat of the message loop running on this thread, nullptr when the watchdog is off
+	inline thread_local PumpHeartbeat* tlPumpHeartbeat = nullptr;
+}
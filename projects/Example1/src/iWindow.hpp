@@ -18,6 +18,33 @@
 #include <stdexcept>
 #include <optional>
 #include "resource.h"
+#include "MessageHandlers.hpp"
+#include "LockStats.hpp"
+#include "MessageStats.hpp"
+#include "Trace.hpp"
+#include "Watchdog.hpp"
+#include "CpuTime.hpp"
+#include "SharedStats.hpp"
+#include "AllocTracking.hpp"
+#include "Pool.hpp"
+#include "ThreadPlacement.hpp"
+#include "ThreadLauncher.hpp"
+#include "ElasticPool.hpp"
+#include "Coalescing.hpp"
+#include "InputRing.hpp"
+#include "SurfacePool.hpp"
+#include "Framebuffer.hpp"
+#include "Surface.hpp"
+#include "RasterKernels.hpp"
+#include "TiledRaster.hpp"
+#include "Damage.hpp"
+#include "TripleBuffer.hpp"
+#include "Font5x7.hpp"
+#include "Text.hpp"
+#include "Scene.hpp"
+#include "Capture.hpp"
+#include "SurfaceExport.hpp"
+#include "MessageRecord.hpp"
 
 namespace WMTS {	
 // these macros are for the logger class
@@ -94,7 +121,7 @@ namespace WMTS {
 
 		// output mMessage to a log file
 		void to_log_file(){
-			std::lock_guard<std::mutex> local_lock(mLogfileWrite_mtx);
+			std::lock_guard<ProfiledMutex> local_lock(mLogfileWrite_mtx);
 			
 			// if logFile is not open send info to console and output window
 			if (!logFile.is_open()) {
@@ -235,7 +262,8 @@ namespace WMTS {
 		// prevent multiple threads from writing to the log file at the same time
 		// the output would be messy and hard to read without this
 		// the stream is thread safe by design but << is not syncronized
-		std::mutex mLogfileWrite_mtx;
+		// static because every logger instance writes to the same logFile
+		inline static ProfiledMutex mLogfileWrite_mtx{ L"logger::mLogfileWrite_mtx" };
 	};
 	
 	
@@ -243,23 +271,22 @@ namespace WMTS {
 	struct WindowDimensions {
 		// This constructor gives memory to the ptrs and 0 as a value
 		WindowDimensions() {
-			mWidth = std::make_shared<UINT>(0);
-			mHeight = std::make_shared<UINT>(0);
-			mClientWidth = std::make_shared<UINT>(0);
-			mClientHeight = std::make_shared<UINT>(0);
+			AllocateValues();
 		}
 
 		// This constructor uses the window handle and gets the window rect dimensions
 		// (client and full) and allocates memory for the ptrs with the current rect values
 		// if the GetWindowRect function fails the error is logged
 		WindowDimensions(const HWND WindowHandle) {
+			AllocateValues();
+
 			RECT windowRect;
 			if (GetWindowRect(WindowHandle, &windowRect)) {
 				UINT width = windowRect.right - windowRect.left;
 				UINT height = windowRect.bottom - windowRect.top;
 
-				mWidth = std::make_shared<UINT>(width);
-				mHeight = std::make_shared<UINT>(height);
+				*mWidth = width;
+				*mHeight = height;
 			}
 			else {
 				logger log(Error::WARNING, WMTS_LOCATION);
@@ -273,8 +300,8 @@ namespace WMTS {
 				UINT clientWidth = clientRect.right - clientRect.left;
 				UINT clientHeight = clientRect.bottom - clientRect.top;
 
-				mClientWidth = std::make_shared<UINT>(clientWidth);
-				mClientHeight = std::make_shared<UINT>(clientHeight);
+				*mClientWidth = clientWidth;
+				*mClientHeight = clientHeight;
 			}
 			else {
 				logger log(Error::WARNING, WMTS_LOCATION);
@@ -289,7 +316,7 @@ namespace WMTS {
 		void UpdateWindowDimensions(const HWND WindowHandle) {
 			// prevents multiple threads from dereferencing the shared_ptrs and modiying
 			// the memory they point to at the same time which would lead to problems
-			std::lock_guard<std::mutex> local_lock(mUpdateWindowDimensions_mtx);
+			std::lock_guard<std::mutex> local_lock(mValues->mUpdateWindowDimensions_mtx);
 			
 			RECT windowRect;
 			if (GetWindowRect(WindowHandle, &windowRect)) {
@@ -324,13 +351,29 @@ namespace WMTS {
 
 		// custom copy constructor
 		WindowDimensions(const WindowDimensions& other)
-			: mWidth(other.mWidth),
+			: mValues(other.mValues),
+			mWidth(other.mWidth),
 			mHeight(other.mHeight),
 			mClientWidth(other.mClientWidth),
 			mClientHeight(other.mClientHeight) {
-			// Note: We don't copy the mutex, as each object should have its own mutex.
-			// and we dont allocate new memory instead the shared_ptrs point to the original memory
-			// in the copied object which reference counts the original shared_ptrs
+			// Note: the mutex is not copied either, it lives in the shared block with the values
+			// so every copy locks the same one. we dont allocate new memory instead the shared_ptrs
+			// point to the original memory in the copied object which reference counts the original shared_ptrs
+		}
+
+		// the four values as one consistent set
+		struct Snapshot {
+			UINT mWidth{};
+			UINT mHeight{};
+			UINT mClientWidth{};
+			UINT mClientHeight{};
+		};
+
+		// reads all four under the mutex UpdateWindowDimensions() holds, use this from another thread
+		// so a resize on the UI thread cannot land between the width and the height
+		Snapshot Read() const {
+			std::lock_guard<std::mutex> local_lock(mValues->mUpdateWindowDimensions_mtx);
+			return Snapshot{ mValues->mWidth, mValues->mHeight, mValues->mClientWidth, mValues->mClientHeight };
 		}
 
 		// const overload so much const
@@ -341,7 +384,34 @@ namespace WMTS {
 		const std::shared_ptr<const UINT> GetHeight() const { return std::const_pointer_cast<const UINT>(mHeight); }
 		const std::shared_ptr<const UINT> GetClientWidth() const { return std::const_pointer_cast<const UINT>(mClientWidth); }
 		const std::shared_ptr<const UINT> GetClientHeight() const { return std::const_pointer_cast<const UINT>(mClientHeight); }
+
+		// approximate heap bytes behind one window's dimensions: the values and their control block
+		static constexpr size_t SharedBytes() { return sizeof(Values) + 2 * sizeof(void*) + 2 * sizeof(long); }
 	private:
+		// all four values live in one pooled block with a single control block
+		// together with the mutex used in the function UpdateWindowDimensions() and Read(), shared by every copy
+		struct Values {
+			UINT mWidth;
+			UINT mHeight;
+			UINT mClientWidth;
+			UINT mClientHeight;
+			std::mutex mUpdateWindowDimensions_mtx;
+		};
+
+		// the four shared_ptrs alias into the block, so the getters keep their old behaviour
+		// while a window's dimensions cost one pool slot instead of four heap allocations
+		void AllocateValues() {
+			auto values = std::allocate_shared<Values>(PoolAllocator<Values>());
+			mValues = values;
+			mWidth = std::shared_ptr<UINT>(values, &values->mWidth);
+			mHeight = std::shared_ptr<UINT>(values, &values->mHeight);
+			mClientWidth = std::shared_ptr<UINT>(values, &values->mClientWidth);
+			mClientHeight = std::shared_ptr<UINT>(values, &values->mClientHeight);
+		}
+
+		// the shared block, for the mutex
+		std::shared_ptr<Values> mValues;
+
 		// entire window dimensions
 		std::shared_ptr<UINT> mWidth;
 		std::shared_ptr<UINT> mHeight;
@@ -349,9 +419,6 @@ namespace WMTS {
 		// drawable area inside window borders
 		std::shared_ptr<UINT> mClientWidth;
 		std::shared_ptr<UINT> mClientHeight;
-
-		// mutex used in the function UpdateWindowDimensions()
-		std::mutex mUpdateWindowDimensions_mtx;
 	};
 
 	// a thread safe class that has the maps and resources needed to keep track of the multiple windows created
@@ -368,13 +435,13 @@ namespace WMTS {
 
 		// add an entry to mThread_mp
 		void AddToThreadmp(const std::thread::id t_id,const HWND WindowHandle){
-			std::lock_guard<std::mutex> local_lock(mThreadmp_mtx);
+			std::lock_guard<ProfiledMutex> local_lock(mThreadmp_mtx);
 			mThread_mp.emplace(t_id,WindowHandle);
 		}
 
 		// search mThread_mp for a window handle(HWND) given a thread id
 		std::optional<HWND> SearchThreadmp(const std::thread::id& t_id){
-			std::lock_guard<std::mutex> local_lock(mThreadmp_mtx);
+			std::lock_guard<ProfiledMutex> local_lock(mThreadmp_mtx);
 			auto found = mThread_mp.find(t_id);
 			if(found != mThread_mp.end()){
 				return found->second;
@@ -384,20 +451,20 @@ namespace WMTS {
 		
 		// remove an entry from mThreadmp using an iterator position
 		void RemoveFromThreadmp(auto position){
-			std::lock_guard<std::mutex> local_lock(mThread_mp);
+			std::lock_guard<ProfiledMutex> local_lock(mThreadmp_mtx);
 			mThread_mp.erase(position);
 		}
 
 		// adds a handle to mWindowHandles
 		void AddToWindowHandles(const HWND WindowHandle){
-			std::lock_guard<std::mutex> local_lock(mWindowHandles_mtx);
+			std::lock_guard<ProfiledMutex> local_lock(mWindowHandles_mtx);
 			mWindowHandles.push_back(WindowHandle);
 		}
 
 		// search mWindowHandles for a matching window handle
 		// returns std::nullopt if a handle cannot be found
 		std::optional<HWND> SearchWindowHandles(const HWND WindowHandle){
-			std::lock_guard<std::mutex> local_lock(mWindowHandles_mtx);
+			std::lock_guard<ProfiledMutex> local_lock(mWindowHandles_mtx);
 			auto found = std::find(mWindowHandles.begin(),mWindowHandles.end(),WindowHandle);
 			if(found != mWindowHandles.end()){
 				return *found;
@@ -407,14 +474,14 @@ namespace WMTS {
 
 		// remove an entry from mWindowHandles using an iterator position
 		void RemoveFromWindowHandles(auto entry){
-			std::lock_guard<std::mutex> local_lock(mWindowHandles_mtx);
+			std::lock_guard<ProfiledMutex> local_lock(mWindowHandles_mtx);
 			mWindowHandles.erase(entry);
 		}
 
 		// get a windoow handle from mWindowHandles using an index
 		// if mWindowHandles is empty nullptr is returned
 		HWND GetWindowHandle(size_t index=0){
-			std::lock_guard<std::mutex> local_lock(mWindowHandles_mtx);
+			std::lock_guard<ProfiledMutex> local_lock(mWindowHandles_mtx);
 			if(mWindowHandles.empty()) return nullptr;
 			index = std::clamp(index, (size_t)0, mWindowHandles.size() - 1);
 			return mWindowHandles[index];
@@ -423,13 +490,13 @@ namespace WMTS {
 		// add an entry to mWindow_mp
 		// must make a copy of WindowDimensions, expensive yes but thread safe
 		void AddToWindowmp(const HWND WindowHandle,const WindowDimensions size){
-			std::lock_guard<std::mutex> local_lock(mWindowmp_mtx);
+			std::lock_guard<ProfiledMutex> local_lock(mWindowmp_mtx);
 			mWindow_mp.emplace(WindowHandle,size);
 		}
 
 		// search mWindow_mp for a window handle
 		std::optional<WindowDimensions> SearchWindowmp(const HWND WindowHandle){
-			std::lock_guard<std::mutex> local_lock(mWindowmp_mtx);
+			std::lock_guard<ProfiledMutex> local_lock(mWindowmp_mtx);
 			auto found = mWindow_mp.find(WindowHandle);
 			if(found != mWindow_mp.end()){
 				return found->second;
@@ -437,22 +504,35 @@ namespace WMTS {
 			return std::nullopt;
 		}
 
+		// refreshes a window's entry in mWindow_mp in place
+		// cheaper than SearchWindowmp() + UpdateWindowDimensions() which copies the WindowDimensions
+		// returns false if the window has no entry
+		bool UpdateWindowmp(const HWND WindowHandle){
+			std::lock_guard<ProfiledMutex> local_lock(mWindowmp_mtx);
+			auto found = mWindow_mp.find(WindowHandle);
+			if(found != mWindow_mp.end()){
+				found->second.UpdateWindowDimensions(WindowHandle);
+				return true;
+			}
+			return false;
+		}
+
 		// removes an entry from mWindowmp using an iterator position
 		void RemoveFromWindowmp(auto entry){
-			std::lock_guard<std::mutex> local_lock(mWindowmp_mtx);
+			std::lock_guard<ProfiledMutex> local_lock(mWindowmp_mtx);
 			mWindow_mp.erase(entry);
 		}
 
 		// add an entry to mThread_pool_mp
-		void AddToThreadpoolmp(std::thread::id t_id,std::thread* t_p){
-			std::lock_guard<std::mutex> local_lock(mThreadpoolmp_mtx);
+		void AddToThreadpoolmp(std::thread::id t_id,NativeThread* t_p){
+			std::lock_guard<ProfiledMutex> local_lock(mThreadpoolmp_mtx);
 			mThread_pool_mp.emplace(t_id,t_p);
 		}
 
-		// search mThread_pool_mp for a corresponding std::thread*
+		// search mThread_pool_mp for a corresponding NativeThread*
 		// returns nullopt if not found
-		std::optional<std::thread*> SearchThreadpoolmp(const std::thread::id t_id){
-			std::lock_guard<std::mutex> local_lock(mThreadpoolmp_mtx);
+		std::optional<NativeThread*> SearchThreadpoolmp(const std::thread::id t_id){
+			std::lock_guard<ProfiledMutex> local_lock(mThreadpoolmp_mtx);
 			auto found = mThread_pool_mp.find(t_id);
 			if(found != mThread_pool_mp.end()){
 				return found->second;
@@ -460,68 +540,203 @@ namespace WMTS {
 			return std::nullopt;
 		}
 
-		std::unordered_map<std::thread::id, std::thread*>::iterator ItSearchThreadpoolmp(const std::thread::id t_id){
-			std::lock_guard<std::mutex> local_lock(mThreadpoolmp_mtx);
+		PooledUnorderedMap<std::thread::id, NativeThread*>::iterator ItSearchThreadpoolmp(const std::thread::id t_id){
+			std::lock_guard<ProfiledMutex> local_lock(mThreadpoolmp_mtx);
 			return mThread_pool_mp.find(t_id);
 		}
 
 		// removes an entry from mThread_pool_mp using an iterator position
 		void RemoveFromThreadpoolmp(auto entry){
-			std::lock_guard<std::mutex> local_lock(mThreadpoolmp_mtx);
+			std::lock_guard<ProfiledMutex> local_lock(mThreadpoolmp_mtx);
 			mThread_pool_mp.erase(entry);
 		}
 
+		// creates the message loop stats for a window, returns the existing entry if there is one
+		std::shared_ptr<MessageLoopStats> AddToMessageStatsmp(const HWND WindowHandle){
+			std::lock_guard<ProfiledMutex> local_lock(mMessageStatsmp_mtx);
+			auto& stats = mMessageStats_mp[WindowHandle];
+			if(!stats){
+				stats = std::make_shared<MessageLoopStats>();
+			}
+			return stats;
+		}
+
+		// search mMessageStats_mp for a window's message loop stats
+		// returns nullptr if the window has no stats
+		std::shared_ptr<MessageLoopStats> SearchMessageStatsmp(const HWND WindowHandle){
+			std::lock_guard<ProfiledMutex> local_lock(mMessageStatsmp_mtx);
+			auto found = mMessageStats_mp.find(WindowHandle);
+			if(found != mMessageStats_mp.end()){
+				return found->second;
+			}
+			return nullptr;
+		}
+
+		// removes a window's entry from mMessageStats_mp
+		void RemoveFromMessageStatsmp(const HWND WindowHandle){
+			std::lock_guard<ProfiledMutex> local_lock(mMessageStatsmp_mtx);
+			mMessageStats_mp.erase(WindowHandle);
+		}
+
+		// creates the coalescing state for a window, returns the existing entry if there is one
+		std::shared_ptr<WindowCoalescer> AddToCoalescermp(const HWND WindowHandle){
+			std::lock_guard<ProfiledMutex> local_lock(mCoalescermp_mtx);
+			auto& coalescer = mCoalescer_mp[WindowHandle];
+			if(!coalescer){
+				coalescer = std::make_shared<WindowCoalescer>();
+			}
+			return coalescer;
+		}
+
+		// search mCoalescer_mp for a window's coalescing state
+		// returns nullptr if the window has none
+		std::shared_ptr<WindowCoalescer> SearchCoalescermp(const HWND WindowHandle){
+			std::lock_guard<ProfiledMutex> local_lock(mCoalescermp_mtx);
+			auto found = mCoalescer_mp.find(WindowHandle);
+			if(found != mCoalescer_mp.end()){
+				return found->second;
+			}
+			return nullptr;
+		}
+
+		// removes a window's entry from mCoalescer_mp
+		void RemoveFromCoalescermp(const HWND WindowHandle){
+			std::lock_guard<ProfiledMutex> local_lock(mCoalescermp_mtx);
+			mCoalescer_mp.erase(WindowHandle);
+		}
+
+		// creates the input ring for a window, returns the existing entry if there is one
+		std::shared_ptr<WindowInputRing> AddToInputRingmp(const HWND WindowHandle){
+			std::lock_guard<ProfiledMutex> local_lock(mInputRingmp_mtx);
+			auto& ring = mInputRing_mp[WindowHandle];
+			if(!ring){
+				ring = std::make_shared<WindowInputRing>();
+			}
+			return ring;
+		}
+
+		// search mInputRing_mp for a window's input ring
+		// returns nullptr if the window has none
+		std::shared_ptr<WindowInputRing> SearchInputRingmp(const HWND WindowHandle){
+			std::lock_guard<ProfiledMutex> local_lock(mInputRingmp_mtx);
+			auto found = mInputRing_mp.find(WindowHandle);
+			if(found != mInputRing_mp.end()){
+				return found->second;
+			}
+			return nullptr;
+		}
+
+		// removes a window's entry from mInputRing_mp
+		void RemoveFromInputRingmp(const HWND WindowHandle){
+			std::lock_guard<ProfiledMutex> local_lock(mInputRingmp_mtx);
+			mInputRing_mp.erase(WindowHandle);
+		}
+
+		// creates the framebuffers for a window, returns the existing entry if there is one
+		std::shared_ptr<WindowSurface> AddToSurfacemp(const HWND WindowHandle, const PresentConfig& config){
+			std::lock_guard<ProfiledMutex> local_lock(mSurfacemp_mtx);
+			auto& surface = mSurface_mp[WindowHandle];
+			if(!surface){
+				surface = std::make_shared<WindowSurface>(config);
+			}
+			return surface;
+		}
+
+		// search mSurface_mp for a window's framebuffers
+		// returns nullptr if the window has none
+		std::shared_ptr<WindowSurface> SearchSurfacemp(const HWND WindowHandle){
+			std::lock_guard<ProfiledMutex> local_lock(mSurfacemp_mtx);
+			auto found = mSurface_mp.find(WindowHandle);
+			if(found != mSurface_mp.end()){
+				return found->second;
+			}
+			return nullptr;
+		}
+
+		// removes a window's entry from mSurface_mp
+		void RemoveFromSurfacemp(const HWND WindowHandle){
+			std::lock_guard<ProfiledMutex> local_lock(mSurfacemp_mtx);
+			mSurface_mp.erase(WindowHandle);
+		}
+
+		// starts a thread with the given stack size and name
+		// thread objects come from a fixed size pool, a closed window's slot is reused by the next one
+		template<class... Args>
+		NativeThread* NewThread(const ThreadAttributes& attributes, Args&&... args){
+			return mThreadObjects.New(attributes, std::forward<Args>(args)...);
+		}
+
+		// the thread must be joined or detached first
+		void DeleteThread(NativeThread* t){
+			mThreadObjects.Delete(t);
+		}
+
 		bool GetThreadpoolmpEmptyState(){
-			std::lock_guard<std::mutex> local_lock(mThreadpoolmp_mtx);
+			std::lock_guard<ProfiledMutex> local_lock(mThreadpoolmp_mtx);
 			return mThread_pool_mp.empty();
 		}
 
-		std::unordered_map<std::thread::id, std::thread*>::iterator ItGetEndofThreadpoolmp(){
-			std::lock_guard<std::mutex> local_lock(mThreadpoolmp_mtx);
+		PooledUnorderedMap<std::thread::id, NativeThread*>::iterator ItGetEndofThreadpoolmp(){
+			std::lock_guard<ProfiledMutex> local_lock(mThreadpoolmp_mtx);
 			return mThread_pool_mp.end();
 		}
 
 		size_t GetThreadpoolmpSize(){
-			std::lock_guard<std::mutex> local_lock(mThreadpoolmp_mtx);
+			std::lock_guard<ProfiledMutex> local_lock(mThreadpoolmp_mtx);
 			return mThread_pool_mp.size();
 		}
 
+		// open windows, including the main window
+		size_t GetWindowCount(){
+			std::lock_guard<ProfiledMutex> local_lock(mWindowHandles_mtx);
+			return mWindowHandles.size();
+		}
+
 
-		// call this when a thread is exiting
+		// call this when a thread that served a single window is exiting
 		void Update(const std::thread::id t_id){
+			WMTS_TRACE_SCOPE("WindowResources::Update");
+
+			if(RemoveThread(t_id)){
+				RemoveWindow(t_id);
+			}
+		}
+
+		// call this from a pool worker thread that is exiting
+		// detaches the thread and gives its object back, returns false if the thread is not in mThread_pool_mp
+		bool RemoveThread(const std::thread::id t_id){
+			WMTS_TRACE_SCOPE("WindowResources::RemoveThread");
+
 			// scoped thread lock
 			// cant use the member functions here as that would result in a deadlock
-			// also we want to block any member function calls to mThread_pool_mp during Update()
-			// could use a recursive_mutex?
-			{
-				std::lock_guard<std::mutex> local_lock(mThreadpoolmp_mtx);
-				auto found = mThread_pool_mp.find(t_id);
-				if(found != mThread_pool_mp.end()){
-					std::thread* t = found->second;
-					if(t->joinable()){
-						// detach the thread
-						t->detach();
-
-						// Now that the thread is detached, we can delete the std::thread object.
-						delete t;
-
-						// erase the entry
-						mThread_pool_mp.erase(found);
-					}
-					else{
-						return;
-					}
-				}
-				else{
-					return;
+			// also we want to block any member function calls to mThread_pool_mp during RemoveThread()
+			std::lock_guard<ProfiledMutex> local_lock(mThreadpoolmp_mtx);
+			auto found = mThread_pool_mp.find(t_id);
+			if(found != mThread_pool_mp.end()){
+				NativeThread* t = found->second;
+				if(t->joinable()){
+					// detach the thread
+					t->detach();
+
+					// Now that the thread is detached, we can give the NativeThread object back to the pool.
+					DeleteThread(t);
+
+					// erase the entry
+					mThread_pool_mp.erase(found);
+					return true;
 				}
 			}
+			return false;
+		}
 
-
+		// call this when the window served by thread t_id has closed
+		// removes the window from every map, the thread itself can go on to serve another window
+		void RemoveWindow(const std::thread::id t_id){
+			WMTS_TRACE_SCOPE("WindowResources::RemoveWindow");
 
 			HWND FoundWindowHandle;
 			{
-				std::lock_guard<std::mutex> local_lock(mThreadmp_mtx);
+				std::lock_guard<ProfiledMutex> local_lock(mThreadmp_mtx);
 				auto found = mThread_mp.find(t_id);
 				if(found != mThread_mp.end()){
 					FoundWindowHandle = found->second;
@@ -534,10 +749,14 @@ namespace WMTS {
 				}
 			}
 
-
+			// the stats are shared_ptrs so readers holding a copy can still finish reading
+			RemoveFromMessageStatsmp(FoundWindowHandle);
+			RemoveFromCoalescermp(FoundWindowHandle);
+			RemoveFromInputRingmp(FoundWindowHandle);
+			RemoveFromSurfacemp(FoundWindowHandle);
 
 			{
-				std::lock_guard<std::mutex> local_lock(mWindowHandles_mtx);
+				std::lock_guard<ProfiledMutex> local_lock(mWindowHandles_mtx);
 				// update mWindowHandles vector
 				auto found = std::find(mWindowHandles.begin(), mWindowHandles.end(), FoundWindowHandle);
 				if (found != mWindowHandles.end()) {
@@ -551,7 +770,7 @@ namespace WMTS {
 
 
 			{
-				std::lock_guard<std::mutex> local_lock(mWindowmp_mtx);
+				std::lock_guard<ProfiledMutex> local_lock(mWindowmp_mtx);
 				auto found = mWindow_mp.find(FoundWindowHandle);
 				if (found != mWindow_mp.end()) {
 					// erase the entry
@@ -565,25 +784,60 @@ namespace WMTS {
 
 		
 	private:
+		// the maps take their nodes from the size class pools so window open/close churn
+		// reuses the same slots instead of scattering small allocations over the heap
+
 		// thread id to window handle map
-		std::unordered_map<std::thread::id, HWND> mThread_mp;
+		PooledUnorderedMap<std::thread::id, HWND> mThread_mp;
 		
 		// vector of window handles
 		std::vector<HWND> mWindowHandles;
 		
 		// Window handle to WindowDimensions map
-		std::unordered_map<HWND,WindowDimensions> mWindow_mp;
+		PooledUnorderedMap<HWND,WindowDimensions> mWindow_mp;
 		
 		// thread ID to thread pointer map
-		std::unordered_map<std::thread::id,std::thread*> mThread_pool_mp;
+		PooledUnorderedMap<std::thread::id,NativeThread*> mThread_pool_mp;
+
+		// UI and logic thread objects
+		ObjectPool<NativeThread> mThreadObjects;
+
+		ProfiledMutex mThreadpoolmp_mtx{ L"WindowResources::mThreadpoolmp_mtx" };
+		ProfiledMutex mThreadmp_mtx{ L"WindowResources::mThreadmp_mtx" };
+		ProfiledMutex mWindowHandles_mtx{ L"WindowResources::mWindowHandles_mtx" };
+		ProfiledMutex mWindowmp_mtx{ L"WindowResources::mWindowmp_mtx" };
 
-		std::mutex mThreadpoolmp_mtx;
-		std::mutex mThreadmp_mtx;
-		std::mutex mWindowHandles_mtx;
-		std::mutex mWindowmp_mtx;
+		// Window handle to message loop stats map, only filled when WMTS_MESSAGE_STATS is on
+		PooledUnorderedMap<HWND, std::shared_ptr<MessageLoopStats>> mMessageStats_mp;
+		ProfiledMutex mMessageStatsmp_mtx{ L"WindowResources::mMessageStatsmp_mtx" };
+
+		// Window handle to coalescing state map, only filled when WMTS_COALESCE is on
+		PooledUnorderedMap<HWND, std::shared_ptr<WindowCoalescer>> mCoalescer_mp;
+		ProfiledMutex mCoalescermp_mtx{ L"WindowResources::mCoalescermp_mtx" };
+
+		// Window handle to input ring map, filled by MTPlainWin32Window message loops
+		PooledUnorderedMap<HWND, std::shared_ptr<WindowInputRing>> mInputRing_mp;
+		ProfiledMutex mInputRingmp_mtx{ L"WindowResources::mInputRingmp_mtx" };
+
+		// Window handle to framebuffers map, filled by MTPlainWin32Window message loops
+		PooledUnorderedMap<HWND, std::shared_ptr<WindowSurface>> mSurface_mp;
+		ProfiledMutex mSurfacemp_mtx{ L"WindowResources::mSurfacemp_mtx" };
 	};
 
 	class iWindow {
+	public:
+		// handles message with fn before WindowProcedure sees it, replaces an earlier handler for the message
+		// fn returns the message result, unhandled messages take the normal WindowProcedure path
+		// register handlers before the windows are created, the table is read without a lock
+		void on(UINT message, MessageHandler fn) {
+			mMessageHandlers.on(message, std::move(fn));
+		}
+
+		// removes the handler registered for message
+		void off(UINT message) {
+			mMessageHandlers.off(message);
+		}
+
 	protected:
 		iWindow() {
 
@@ -605,15 +859,94 @@ namespace WMTS {
 			}
 
 			if (window) {
-				return window->WindowProcedure(hwnd, message, wParam, lParam);
+#if WMTS_RECORD
+				// every message of every window, the replayer decides which ones it can feed back
+				MessageRecorder::Get().Record((uint64_t)hwnd, message, (uint64_t)wParam, (int64_t)lParam);
+#endif
+#if WMTS_MESSAGE_STATS || WMTS_WATCHDOG
+				if (tlMessageLoopStats || tlPumpHeartbeat) {
+					return InstrumentedWindowProcedure(window, hwnd, message, wParam, lParam);
+				}
+#endif
+				return window->HandleMessage(hwnd, message, wParam, lParam);
 			}
 
 			return DefWindowProc(hwnd, message, wParam, lParam);
 		}
 
+		// registered handlers first, one table lookup, then the virtual WindowProcedure
+		LRESULT HandleMessage(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
+			LRESULT result;
+			if (mMessageHandlers.Dispatch(hwnd, message, wParam, lParam, result)) {
+				return result;
+			}
+			return WindowProcedure(hwnd, message, wParam, lParam);
+		}
+
+#if WMTS_MESSAGE_STATS || WMTS_WATCHDOG
+		// counts every message, nested ones too, times the outermost WindowProcedure call on this thread
+		// and marks it in flight for the watchdog
+		static LRESULT InstrumentedWindowProcedure(iWindow* window, HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
+			MessageLoopStats* stats = tlMessageLoopStats;
+			if (stats) {
+				stats->CountMessage(message);
+			}
+
+			PumpHeartbeat* heartbeat = tlPumpHeartbeat;
+			if (tlWindowProcedureDepth++ != 0) {
+				// dragging, sizing and menus run a modal loop inside DefWindowProc, the outer message stays in
+				// flight for as long as the user holds it, so the loop is idle in between and its messages are
+				// watched on their own instead
+				if (heartbeat && (message == WM_EXITSIZEMOVE || message == WM_EXITMENULOOP)) {
+					heartbeat->ExitModalLoop();
+				}
+				bool beat = heartbeat && heartbeat->Idle();
+				if (beat) {
+					heartbeat->BeginDispatch(message);
+				}
+				LRESULT result = window->HandleMessage(hwnd, message, wParam, lParam);
+				if (beat) {
+					heartbeat->EndDispatch();
+				}
+				if (heartbeat && (message == WM_ENTERSIZEMOVE || message == WM_ENTERMENULOOP)) {
+					heartbeat->EnterModalLoop();
+				}
+				--tlWindowProcedureDepth;
+				return result;
+			}
+
+			if (heartbeat) {
+				heartbeat->BeginDispatch(message);
+			}
+
+			std::chrono::steady_clock::time_point start;
+			if (stats) {
+				start = std::chrono::steady_clock::now();
+			}
+
+			LRESULT result = window->HandleMessage(hwnd, message, wParam, lParam);
+
+			if (stats) {
+				auto elapsed = std::chrono::steady_clock::now() - start;
+				stats->RecordProcedureTime((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+			}
+
+			if (heartbeat) {
+				heartbeat->EndDispatch();
+				// every modal loop ends with the message that entered it
+				heartbeat->mModalDepth = 0;
+			}
+			--tlWindowProcedureDepth;
+			return result;
+		}
+#endif
+
 		std::wstring mWindowTitle;
 		HINSTANCE mHinstance{ GetModuleHandle(NULL) };
 
+		// handlers registered with on()
+		MessageHandlerTable mMessageHandlers;
+
 		virtual int ProcessMessage() = 0;
 	};
 
@@ -629,9 +962,9 @@ namespace WMTS {
 
 		virtual bool CreateAWindow() = 0;
 
-		// I cannot pass newTitle as a reference since multiple threads will be accessing it
-		// they each need their own copy
-		virtual void SetWindowTitle(const std::wstring newTitle,const HWND WindowHandle) const = 0;
+		// newTitle is passed by reference to avoid a copy on every call,
+		// each calling thread must own the string it passes (RunLogic() keeps one buffer per thread)
+		virtual void SetWindowTitle(const std::wstring& newTitle,const HWND WindowHandle) const = 0;
 
 		// used in constructor to initialize class
 		virtual void WindowInit() = 0;
@@ -679,7 +1012,7 @@ namespace WMTS {
 		}
 
 
-		void SetWindowTitle(const std::wstring newTitle,const HWND WindowHandle) const override {
+		void SetWindowTitle(const std::wstring& newTitle,const HWND WindowHandle) const override {
 			SetWindowText(WindowHandle, newTitle.c_str());
 		}
 
@@ -689,7 +1022,9 @@ namespace WMTS {
 
 		void SetWindowClass() override {
 			mWCEX.cbSize = sizeof(WNDCLASSEXW);
-			mWCEX.style = CS_HREDRAW | CS_VREDRAW;
+			// no CS_HREDRAW | CS_VREDRAW, a resize invalidates only the exposed strip and the logic thread
+			// invalidates what its frames change, repainting the whole client area on every size step is wasted
+			mWCEX.style = 0;
 			mWCEX.lpfnWndProc = window_proc_proxy;
 			mWCEX.cbClsExtra = 0;
 			mWCEX.cbWndExtra = 0;
@@ -754,18 +1089,20 @@ namespace WMTS {
 		LRESULT CALLBACK WindowProcedure(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) override{
 			switch (message)
 			{
-			case WM_KEYDOWN: {
-				break;
-			}
+			case WM_KEYDOWN:
+			case WM_KEYUP:
+			case WM_LBUTTONDOWN:
+			case WM_LBUTTONUP:
+			case WM_RBUTTONDOWN:
+			case WM_RBUTTONUP:
 			case WM_MBUTTONDOWN:
-			{
-				break;
-			}
 			case WM_MBUTTONUP:
+			case WM_MOUSEMOVE:
 			{
-				break;
-			}
-			case WM_MOUSEMOVE: {
+				// handed to the window's logic thread, a full ring drops the event and counts it
+				if (tlWindowInputRing) {
+					tlWindowInputRing->Push(message, wParam, lParam);
+				}
 				break;
 			}
 			case WM_DISPLAYCHANGE:
@@ -775,10 +1112,15 @@ namespace WMTS {
 			case WM_SIZE:
 			case WM_SIZING:
 			{
-				auto size = mResources.SearchWindowmp(hwnd);
-				if(size.has_value()){
-					size.value().UpdateWindowDimensions(hwnd);
+#if WMTS_COALESCE
+				// a resize drag sends a burst of these, the message loop or the logic tick updates once
+				if (tlWindowCoalescer) {
+					tlWindowCoalescer->MarkSize();
+					break;
 				}
+#endif
+				// updated in place, no copy of the WindowDimensions
+				mResources.UpdateWindowmp(hwnd);
 				break;
 			}
 			case WM_COMMAND:
@@ -801,13 +1143,28 @@ namespace WMTS {
 				PAINTSTRUCT ps{};
 				HDC hdc = BeginPaint(hwnd, &ps);
 
+				// the logic thread rendered the frame, the UI thread only copies it to the screen
+				if (tlWindowSurface) {
+					RECT client{};
+					GetClientRect(hwnd, &client);
+					tlWindowSurface->Present(hdc, (uint32_t)(client.right - client.left), (uint32_t)(client.bottom - client.top), ps.rcPaint);
+				}
+
 				EndPaint(hwnd, &ps);
+				return 0;
+			}
+			case WM_ERASEBKGND:
+			{
+				// the frame covers the whole client area, erasing first would only flicker
+				if (tlWindowSurface && tlWindowSurface->HasFrame()) {
+					return 1;
+				}
 				break;
 			}
 			
 			case WM_DESTROY:
 				PostQuitMessage(0);
-				break;
+				return 0;
 			default:
 				return DefWindowProc(hwnd, message, wParam, lParam);
 
@@ -842,54 +1199,696 @@ namespace WMTS {
 			// add main thread ID to the map first and main handle at 0 index
 			mResources.AddToThreadmp(mainThreadID,GetHandle());
 
+#if WMTS_SHARED_STATS
+			// before any message loop starts so every window gets a slot
+			if (!mSharedStats.Create(GetCurrentProcessId())) {
+				logger log(Error::WARNING, WMTS_LOCATION);
+				log.to_console();
+				log.to_output();
+				log.to_log_file();
+			}
+#endif
+
+#if WMTS_CAPTURE
+			// allocated in full before any window opens, frames never grow the file
+			if (!mCaptureRing.Create(mCaptureConfig.mPath, mCaptureConfig.mCapacityBytes, GetCurrentProcessId())) {
+				logger log(Error::WARNING, WMTS_LOCATION);
+				log.to_console();
+				log.to_output();
+				log.to_log_file();
+			}
+#endif
+
+#if WMTS_WATCHDOG
+			// log every hang and every recovery, this runs on the watchdog thread
+			mWatchdog.SetOnHang([](const HangEvent& event) {
+				logger log(std::format(L"window {} {} message 0x{:04X} after {} ms",
+					(const void*)event.mWindowHandle,
+					event.mRecovered ? L"recovered from" : L"is not responding, stuck in",
+					event.mMessage,
+					event.mDuration.count()), event.mRecovered ? Error::INFO : Error::WARNING, WMTS_LOCATION);
+				log.to_console();
+				log.to_output();
+				log.to_log_file();
+			});
+			mWatchdog.Start();
+#endif
+
+#if WMTS_CPU_ACCOUNTING
+			// periodic per window CPU summary, runs on its own thread
+			mCpuAccounting.StartPeriodicSummary(std::chrono::seconds(10), [](const std::wstring& summary) {
+				logger log(summary, Error::INFO, WMTS_LOCATION);
+				log.to_console();
+				log.to_output();
+				log.to_log_file();
+			});
+#endif
+
+			// window threads come from the pool, it calls SpawnWorker() whenever it grows
+			mPool.Start([this](std::function<void()> worker) { SpawnWorker(std::move(worker)); });
+
 			// for the main thread window
 			ProcessMessage();
 
 			// main thread window is closed now
-			// wait for all threads to finish
+			// wait for the other windows to close, then let the idle workers go and wait for them to exit
+			mPool.WaitIdle();
+			mPool.Shutdown();
 			main_thread_lock = std::unique_lock<std::mutex>(main_thread_guard);
 			main_thread_cv.wait(main_thread_lock, [this] {return mResources.GetThreadpoolmpEmptyState(); });
+
+#if WMTS_WATCHDOG
+			mWatchdog.Stop();
+#endif
+
+#if WMTS_CPU_ACCOUNTING
+			mCpuAccounting.StopPeriodicSummary();
+#endif
+
+#if WMTS_SHARED_STATS
+			// marks the region as no longer alive for attached monitors
+			mSharedStats.Close();
+#endif
+
+#if WMTS_CAPTURE
+			// every window is closed, the OS writes the remaining pages back to the file
+			mCaptureRing.Close();
+#endif
+
+#if WMTS_RECORD
+			// every window thread has ended, what their buffers hold goes to the file
+			MessageRecorder::Get().Stop();
+#endif
+
+			// all windows are closed, dump the lock contention stats
+			DumpLockStats();
+
+			// pool usage and resident memory after every window closed
+			DumpMemoryReport();
+
+			logger pool_log(mPool.Metrics().Report(), Error::INFO, WMTS_LOCATION);
+			pool_log.to_console();
+			pool_log.to_output();
+			pool_log.to_log_file();
+
+			logger frame_log(L"Frames over all windows: " + GetFrameTotals().Report(), Error::INFO, WMTS_LOCATION);
+			frame_log.to_console();
+			frame_log.to_output();
+			frame_log.to_log_file();
+
+			logger text_log(L"Text over all windows: " + GetTextTotals().Report(), Error::INFO, WMTS_LOCATION);
+			text_log.to_console();
+			text_log.to_output();
+			text_log.to_log_file();
+
+			logger input_log(L"Input over all windows: " + GetInputTotals().Report(), Error::INFO, WMTS_LOCATION);
+			input_log.to_console();
+			input_log.to_output();
+			input_log.to_log_file();
+
+#if WMTS_COALESCE
+			logger coalesce_log(L"Coalescing over all windows: " + GetCoalesceTotals().Report(), Error::INFO, WMTS_LOCATION);
+			coalesce_log.to_console();
+			coalesce_log.to_output();
+			coalesce_log.to_log_file();
+#endif
+
+#if WMTS_CAPTURE
+			logger capture_log(GetCaptureStats().Report(), Error::INFO, WMTS_LOCATION);
+			capture_log.to_console();
+			capture_log.to_output();
+			capture_log.to_log_file();
+#endif
+
+#if WMTS_SURFACE_EXPORT
+			logger export_log(L"Over all windows: " + GetSurfaceExportTotals().Report(), Error::INFO, WMTS_LOCATION);
+			export_log.to_console();
+			export_log.to_output();
+			export_log.to_log_file();
+#endif
+
+#if WMTS_RECORD
+			logger record_log(MessageRecorder::Get().Read().Report(), Error::INFO, WMTS_LOCATION);
+			record_log.to_console();
+			record_log.to_output();
+			record_log.to_log_file();
+#endif
+
+#if WMTS_TRACE
+			WriteTrace();
+#endif
+
+#if WMTS_ALLOC_TRACKING
+			logger alloc_log(mAllocations.Report(), Error::INFO, WMTS_LOCATION);
+			alloc_log.to_console();
+			alloc_log.to_output();
+			alloc_log.to_log_file();
+#endif
+		}
+
+#if WMTS_TRACE
+		// writes every recorded span and event to WMTStrace.json next to WMTSlog.txt
+		// safe to call at any time from any thread
+		void WriteTrace() const {
+			auto path = std::filesystem::current_path() / "WMTStrace.json";
+			if (!Tracer::Get().WriteChromeTrace(path)) {
+				logger log(L"failed to write trace file " + path.wstring(), Error::WARNING, WMTS_LOCATION);
+				log.to_console();
+				log.to_output();
+				log.to_log_file();
+			}
+		}
+#endif
+
+		// writes the contention stats of every lock site to the console, output window and log file
+		// safe to call at any time from any thread
+		void DumpLockStats() const {
+			logger log(LockStatsReport(), Error::INFO, WMTS_LOCATION);
+			log.to_console();
+			log.to_output();
+			log.to_log_file();
+		}
+
+		// writes the resident memory, the stats of every pool, the framebuffer pool and the per window budget
+		// to the console, output window and log file
+		// safe to call at any time from any thread
+		void DumpMemoryReport() {
+			logger log(PoolReport() + SurfacePool::Get().Read().Report() + GetMemoryBudgetReport(), Error::INFO, WMTS_LOCATION);
+			log.to_console();
+			log.to_output();
+			log.to_log_file();
+		}
+
+		// sets the stack size and name for the threads created from now on
+		// call it before ExecuteThreads(), the attributes are read without a lock
+		void SetThreadAttributes(ThreadRole role, const ThreadAttributes& attributes) {
+			(role == ThreadRole::UI ? mUiThreadAttributes : mLogicThreadAttributes) = attributes;
+		}
+
+		// sets the window thread pool bounds and idle timeout
+		// call it before ExecuteThreads()
+		void SetPoolConfig(const ElasticPoolConfig& config) {
+			mPool.SetConfig(config);
+		}
+
+		// the pool's size and every grow, queue and shrink decision it made, safe to call from any thread
+		ElasticPoolMetrics GetPoolMetrics() {
+			return mPool.Metrics();
 		}
 
+		// restricts or pins the threads of a role to cores and sets their priority
+		// for example UI threads ABOVE_NORMAL spread over cores 0-1 and logic threads BELOW_NORMAL on the rest,
+		// so input handling is not starved when the logic loops saturate the machine
+		// call it before ExecuteThreads(), it applies to threads created from then on
+		void SetThreadPlacement(ThreadRole role, const ThreadPlacement& placement) {
+			(role == ThreadRole::UI ? mUiPlacement : mLogicPlacement).Set(placement);
+		}
+
+		// what one window costs: stack reservations plus the registry entries, thread objects
+		// and dimensions it owns, and the same scaled to ProjectedWindows for capacity planning
+		// the heap figures are estimates from the type sizes, map nodes are counted as value + next pointer + cached hash
+		std::wstring GetMemoryBudgetReport(size_t ProjectedWindows = 1000) {
+			auto node = [](size_t value) { return value + sizeof(void*) + sizeof(size_t); };
+			constexpr size_t control_block = 2 * sizeof(void*) + 2 * sizeof(long);
+
+			size_t ui_stack = ReservedStackSize(mUiThreadAttributes);
+			size_t logic_stack = ReservedStackSize(mLogicThreadAttributes);
+			size_t stacks = ui_stack + logic_stack;
+
+			size_t thread_objects = 2 * sizeof(NativeThread);
+			size_t registry =
+				node(sizeof(std::pair<const std::thread::id, HWND>)) +
+				node(sizeof(std::pair<const HWND, WindowDimensions>)) +
+				node(sizeof(std::pair<const std::thread::id, NativeThread*>)) +
+				sizeof(HWND);
+#if WMTS_MESSAGE_STATS
+			registry += node(sizeof(std::pair<const HWND, std::shared_ptr<MessageLoopStats>>)) + sizeof(MessageLoopStats) + control_block;
+#endif
+			size_t dimensions = WindowDimensions::SharedBytes();
+			size_t run_flag = sizeof(std::atomic<bool>) + control_block;
+			size_t heap = thread_objects + registry + dimensions + run_flag;
+
+			size_t windows = mResources.GetWindowCount();
+			ProcessMemory memory = ProcessMemoryUsage();
+
+			return std::format(L"Memory budget per window:\n"
+				L"  stack reserved: ui={}KB logic={}KB\n"
+				L"  heap: thread objects={}B registry entries={}B dimensions={}B run flag={}B total={}B\n"
+				L"  live windows={} stacks reserved={}MB heap={}KB resident={}MB\n"
+				L"  projected for {} windows: stacks reserved={}MB heap={}KB\n",
+				ui_stack / 1024, logic_stack / 1024,
+				thread_objects, registry, dimensions, run_flag, heap,
+				windows, windows * stacks / (1024 * 1024), windows * heap / 1024, memory.mResidentBytes / (1024 * 1024),
+				ProjectedWindows, ProjectedWindows * stacks / (1024 * 1024), ProjectedWindows * heap / 1024);
+		}
+
+		// returns a copy of a window's message loop stats, safe to call from any thread
+		// returns std::nullopt if the window is gone or WMTS_MESSAGE_STATS is off
+		std::optional<MessageLoopSnapshot> GetMessageStats(HWND WindowHandle) {
+			auto stats = mResources.SearchMessageStatsmp(WindowHandle);
+			if (stats) {
+				return stats->Read();
+			}
+			return std::nullopt;
+		}
+
+		// a window's input ring counters and input to logic latency, safe to call from any thread
+		// returns std::nullopt if the window is gone
+		std::optional<InputRingStats> GetInputStats(HWND WindowHandle) {
+			auto ring = mResources.SearchInputRingmp(WindowHandle);
+			if (ring) {
+				return ring->Read();
+			}
+			return std::nullopt;
+		}
+
+		// the input counters of every closed window added up
+		InputRingStats GetInputTotals() {
+			std::lock_guard<std::mutex> local_lock(mInputTotals_mtx);
+			return mInputTotals;
+		}
+
+		// how every window presents its frames, call before ExecuteThreads()
+		void SetPresentConfig(const PresentConfig& config) {
+			mPresentConfig = config;
+		}
+
+		// a window's frame count, frame time and present cost, safe to call from any thread
+		// returns std::nullopt if the window is gone
+		std::optional<FrameStats> GetFrameStats(HWND WindowHandle) {
+			auto surface = mResources.SearchSurfacemp(WindowHandle);
+			if (surface) {
+				return surface->Read();
+			}
+			return std::nullopt;
+		}
+
+		// the frame counters of every closed window added up
+		FrameStats GetFrameTotals() {
+			std::lock_guard<std::mutex> local_lock(mFrameTotals_mtx);
+			return mFrameTotals;
+		}
+
+		// the text draws and layout cache hits of every closed window added up
+		TextStats GetTextTotals() {
+			std::lock_guard<std::mutex> local_lock(mTextTotals_mtx);
+			return mTextTotals;
+		}
+
+		// tile size and the smallest frame split across the raster threads, call before ExecuteThreads()
+		// the raster thread count is process wide, see RasterWorkers::Get().SetThreads()
+		void SetTileConfig(const TileConfig& config) {
+			mTileConfig = config;
+		}
+
+		// called on the window's logic thread once per tick to record the next frame
+		// Frame is sized to the client area and its old contents are undefined, so draw every pixel
+		// starting with an opaque command such as Clear()
+		// the commands are rasterized afterwards in tiles spread over the shared raster threads,
+		// only where they differ from the previous frame's, mark changes the commands do not show with Invalidate()
+		// runs inside the tick, so do not allocate in steady state
+		virtual void RenderFrame(HWND WindowHandle, DrawList& Frame, uint64_t FrameNumber) {
+			// Example code: a block sweeping across a dark background, WMTSReplay draws the same scene
+			DrawDefaultScene(Frame, FrameNumber);
+		}
+
+		// called on the window's logic thread for each input event, in the order the UI thread saw them
+		// lost is the number of events dropped since the previous batch because the ring was full,
+		// it is only non zero on the first event of a batch
+		// runs inside the tick, so keep it short and do not allocate in steady state
+		virtual void OnInput(HWND WindowHandle, const InputEvent& Event, uint64_t Lost) {}
+
+#if WMTS_COALESCE
+		// a window's size and mouse move counters, safe to call from any thread
+		// returns std::nullopt if the window is gone
+		std::optional<CoalesceSnapshot> GetCoalesceStats(HWND WindowHandle) {
+			auto coalescer = mResources.SearchCoalescermp(WindowHandle);
+			if (coalescer) {
+				return coalescer->Read();
+			}
+			return std::nullopt;
+		}
+
+		// the counters of every closed window added up
+		CoalesceSnapshot GetCoalesceTotals() {
+			std::lock_guard<std::mutex> local_lock(mCoalesceTotals_mtx);
+			return mCoalesceTotals;
+		}
+#endif
+
+#if WMTS_CAPTURE
+		// where the frames are captured and how often a window writes a whole one, call before ExecuteThreads()
+		void SetCaptureConfig(const CaptureConfig& config) {
+			mCaptureConfig = config;
+		}
+
+		// frames and bytes written to the capture file so far, safe to call from any thread
+		CaptureStats GetCaptureStats() {
+			return mCaptureRing.Read();
+		}
+#endif
+
+#if WMTS_SURFACE_EXPORT
+		// the largest frame each window's shared memory has room for, call before ExecuteThreads()
+		void SetSurfaceExportConfig(const SurfaceExportConfig& config) {
+			mSurfaceExportConfig = config;
+		}
+
+		// the export counters of every closed window added up
+		SurfaceExportStats GetSurfaceExportTotals() {
+			std::lock_guard<std::mutex> local_lock(mSurfaceExportTotals_mtx);
+			return mSurfaceExportTotals;
+		}
+#endif
+
+#if WMTS_WATCHDOG
+		// hang counters, recent hang events and the responsiveness budget
+		Watchdog& GetWatchdog() {
+			return mWatchdog;
+		}
+#endif
+
+#if WMTS_ALLOC_TRACKING
+		// allocation counts in total, per live window and for closed windows
+		std::wstring GetAllocationReport() {
+			return mAllocations.Report();
+		}
+#endif
+
+#if WMTS_CPU_ACCOUNTING
+		// CPU time of every live window's UI and logic threads, busiest first
+		// each call reads the thread clocks, call it from any thread
+		std::vector<WindowCpuTime> GetCpuTime() {
+			return mCpuAccounting.Sample();
+		}
+
+		CpuAccounting& GetCpuAccounting() {
+			return mCpuAccounting;
+		}
+#endif
+
 		void RunLogic(std::thread::id CurrentThreadID,std::shared_ptr<std::atomic<bool>> run) {
 			// Example code for showing functionality:
 			// Put any logic code here: 
 			
-			// for std::format printing in the window title
-			int x = 0;
-			
 			// search the threadmp for the corresponding window handle
 			auto found = mResources.SearchThreadmp(CurrentThreadID);
 
 			if (found.has_value()) {
+				WMTS_TRACE_THREAD_NAME(std::format("window {} logic", (const void*)found.value()));
+
+#if WMTS_ALLOC_TRACKING
+				mAllocations.AttachCurrentThread(found.value());
+#endif
+
+#if WMTS_CPU_ACCOUNTING
+				auto cpu_entry = mCpuAccounting.RegisterCurrentThread(found.value(), ThreadRole::LOGIC);
+#endif
+
+				// created by the UI thread before starting this thread
+				std::shared_ptr<WindowInputRing> input = mResources.SearchInputRingmp(found.value());
+				std::shared_ptr<WindowSurface> surface = mResources.SearchSurfacemp(found.value());
+
+				// shares the values WM_SIZE updates, the frame follows the client area
+				std::optional<WindowDimensions> dimensions = mResources.SearchWindowmp(found.value());
+				uint64_t frame_number = 0;
+
+				// the text layouts RenderFrame() draws are cached on this thread, count this window's share
+				ThreadTextRenderer().ResetStats();
+
+				// recorded by RenderFrame(), then rasterized tile by tile, both keep their capacity between frames
+				DrawList draw_list;
+				TiledRenderer renderer(mTileConfig);
+
+				// what changed since the previous frame, only that is rasterized and presented
+				DamageTracker damage_tracker;
+				DamageRegion redraw;
+
+#if WMTS_COALESCE
+				// created by the UI thread before starting this thread
+				std::shared_ptr<WindowCoalescer> coalescer = mResources.SearchCoalescermp(found.value());
+#endif
+
+#if WMTS_SHARED_STATS
+				// the UI thread claimed the slot before starting this thread
+				SharedWindowStats* shared_stats = mSharedStats.Find((uint64_t)found.value());
+				if (shared_stats) {
+					shared_stats->mThreads.fetch_add(1, std::memory_order_relaxed);
+				}
+				if (mSharedStats.Block()) {
+					mSharedStats.Block()->mHeader.mThreads.fetch_add(1, std::memory_order_relaxed);
+				}
+#endif
+
 				while (*run) {
-					SetWindowTitle(std::format(L"Happy Window [{:*<{}}]", L'*', x + 1), found.value());
-					(++x) %= 20;
+					WMTS_TRACE_SCOPE("RunLogic tick");
+#if WMTS_ALLOC_TRACKING
+					NoAllocScope steady_state;
+#endif
+#if WMTS_COALESCE
+					// once per tick, this is the only flush while Windows runs its modal sizing loop
+					if (coalescer && coalescer->TakeSize()) {
+						mResources.UpdateWindowmp(found.value());
+					}
+#endif
+					// everything the UI thread pushed since the last tick, in one batch
+					if (input) {
+						uint64_t lost = 0;
+						input->Drain([&](const InputEvent& event) {
+							OnInput(found.value(), event, lost);
+							lost = 0;
+						}, lost);
+					}
+
+					if (surface && dimensions.has_value()) {
+						// one locked read, WM_SIZE updates the values on the UI thread
+						WindowDimensions::Snapshot size = dimensions->Read();
+						uint32_t width = size.mClientWidth;
+						uint32_t height = size.mClientHeight;
+						Framebuffer* frame = nullptr;
+						{
+#if WMTS_ALLOC_TRACKING
+							// the buffers only grow when the window gets larger than it has been
+							AllocAllowedScope resizing_frame;
+#endif
+							frame = &surface->BeginFrame(width, height);
+						}
+						{
+							WMTS_TRACE_SCOPE("RenderFrame");
+							draw_list.Reset(width, height);
+							RenderFrame(found.value(), draw_list, frame_number++);
+						}
+
+						// the back buffer is a frame or more behind, it also gets what changed in between
+						const DamageRegion* changes = nullptr;
+						{
+							WMTS_TRACE_SCOPE("Rasterize");
+							changes = &RenderChanges(damage_tracker, draw_list, renderer, *frame, surface->BackContentFrame(), surface->NextFrameNumber(), redraw);
+						}
+						const DamageRegion& damage = *changes;
+						if (damage.Empty()) {
+							// same commands as last tick, the front buffer and the screen are already up to date
+							surface->SkipFrame();
+						}
+						else {
+#if WMTS_CAPTURE || WMTS_SURFACE_EXPORT
+							// only this frame's changes, the copies build on the frame before, not on the back buffer
+							surface->DescribeFrame(damage, size.mWidth, size.mHeight);
+#endif
+							if (surface->EndFrame(found.value(), redraw.Area())) {
+								// WM_PAINT on the UI thread presents it, the screen only lacks this frame's damage
+								for (size_t i{}; i < damage.Count(); i++) {
+									RECT changed{ damage[i].mLeft, damage[i].mTop, damage[i].mRight, damage[i].mBottom };
+									InvalidateRect(found.value(), &changed, FALSE);
+								}
+							}
+						}
+					}
+
+#if WMTS_SHARED_STATS
+					if (shared_stats) {
+						shared_stats->mTicks.fetch_add(1, std::memory_order_relaxed);
+						shared_stats->mLogicCpuNs.store(CpuAccounting::CurrentThreadNs(), std::memory_order_relaxed);
+					}
+#endif
+
+					std::this_thread::sleep_for(LogicTick);
+				}
 
-					std::this_thread::sleep_for(std::chrono::milliseconds(50));
+				{
+					std::lock_guard<std::mutex> local_lock(mTextTotals_mtx);
+					mTextTotals += ThreadTextRenderer().Read();
+				}
+
+#if WMTS_SHARED_STATS
+				if (shared_stats) {
+					shared_stats->mThreads.fetch_sub(1, std::memory_order_relaxed);
+				}
+				if (mSharedStats.Block()) {
+					mSharedStats.Block()->mHeader.mThreads.fetch_sub(1, std::memory_order_relaxed);
 				}
+#endif
+
+#if WMTS_CPU_ACCOUNTING
+				mCpuAccounting.Unregister(cpu_entry);
+#endif
+
+#if WMTS_ALLOC_TRACKING
+				mAllocations.DetachCurrentThread(found.value());
+#endif
 			}
 		}
 	private:
-		// fp: function pointer
-		// this_obj: this pointer
-		void BuildThreadPool(size_t NumberOfThreads, auto fp, auto this_obj) {
-			NumberOfThreads = std::clamp(NumberOfThreads, (size_t)0, (size_t)total_threads - 1);
+		// asks the pool for NumberOfWindows new windows, each one runs Run() on a pool worker
+		// past the soft limit a window opens once its request waited mGrowAfter, at mMaxWorkers once another
+		// window closes, and only a request past mMaxPending waiting ones is rejected and logged
+		void RequestWindows(size_t NumberOfWindows) {
+			WMTS_TRACE_SCOPE("RequestWindows");
+
+#if WMTS_ALLOC_TRACKING
+			// creating a window is not steady state, it is expected to allocate
+			AllocAllowedScope creating_threads;
+#endif
+
+			for (size_t i{}; i < NumberOfWindows; i++) {
+				SubmitResult result = mPool.Submit([this] { Run(); });
+				if (result == SubmitResult::FULL || result == SubmitResult::STOPPED) {
+					std::wstring reason = result == SubmitResult::FULL ?
+						std::format(L"all {} window threads serve a window and enough requests wait, new window request rejected", mPool.Metrics().mWorkers) :
+						std::wstring(L"the window pool is shut down, new window request ignored");
+					logger log(reason, Error::WARNING, WMTS_LOCATION);
+					log.to_console();
+					log.to_output();
+					log.to_log_file();
+				}
+			}
+		}
 
-			// build thread pool
-			for (size_t i{}; (i < NumberOfThreads) && (mResources.GetThreadpoolmpSize() < total_threads); i++) {
-				// build map of thread_pool
-				auto thread = new std::thread(fp, this_obj);
-				mResources.AddToThreadpoolmp(thread->get_id(),thread);
+		// called by the pool with the function a new worker thread must run
+		// runs under the pool's lock, the worker only starts taking requests once its entry is in mThread_pool_mp
+		// nothing here may log, a placement failure is logged by the new thread before it takes the lock
+		void SpawnWorker(std::function<void()> worker) {
+			auto thread = mResources.NewThread(PlacedThreadAttributes(ThreadRole::UI), [this, worker] {
+				LogPlacementFailure(CurrentThreadPlacementApplied());
+				worker();
+
+				// the worker retired, it no longer serves any window
+				mResources.RemoveThread(std::this_thread::get_id());
+				NotifyMainThread();
+			});
+			mResources.AddToThreadpoolmp(thread->get_id(), thread);
+		}
+
+		// wakes ExecuteThreads() to check its exit condition
+		// the guard is taken so the notification cannot fall between its check and its wait
+		void NotifyMainThread() {
+			{
+				std::lock_guard<std::mutex> local_lock(main_thread_guard);
 			}
+			main_thread_cv.notify_all();
 		}
 
+#if WMTS_WATCHDOG
+		// flags any message loop stuck in one message for longer than the budget
+		Watchdog mWatchdog{ std::chrono::milliseconds(100) };
+#endif
+
+#if WMTS_CPU_ACCOUNTING
+		// per window CPU time of the UI and logic threads
+		CpuAccounting mCpuAccounting;
+#endif
+
+#if WMTS_SHARED_STATS
+		// live stats published in shared memory for WMTSMonitor
+		SharedStatsRegion mSharedStats;
+#endif
+
+#if WMTS_ALLOC_TRACKING
+		// allocation counters of every window's UI and logic threads
+		WindowAllocRegistry mAllocations;
+#endif
+
+#if WMTS_CAPTURE
+		// the memory mapped ring file every window's frames are captured into
+		CaptureRing mCaptureRing;
+		CaptureConfig mCaptureConfig;
+#endif
+
+#if WMTS_SURFACE_EXPORT
+		// how large a frame each window's shared memory holds
+		SurfaceExportConfig mSurfaceExportConfig;
+
+		// counters of closed windows, added when their message loop ends
+		SurfaceExportStats mSurfaceExportTotals;
+		std::mutex mSurfaceExportTotals_mtx;
+#endif
+
+		// how every window presents its frames
+		PresentConfig mPresentConfig;
+
+		// how every window's frames are split into tiles
+		TileConfig mTileConfig;
+
+		// frame counters of closed windows, added when their message loop ends
+		FrameStats mFrameTotals;
+		std::mutex mFrameTotals_mtx;
+
+		// input counters of closed windows, added when their message loop ends
+		InputRingStats mInputTotals;
+		std::mutex mInputTotals_mtx;
+
+		// text counters of closed windows, added when their logic thread ends
+		TextStats mTextTotals;
+		std::mutex mTextTotals_mtx;
+
+#if WMTS_COALESCE
+		// counters of closed windows, added when their message loop ends
+		CoalesceSnapshot mCoalesceTotals;
+		std::mutex mCoalesceTotals_mtx;
+#endif
+
 		std::mutex main_thread_guard;
 		std::unique_lock<std::mutex> main_thread_lock;
 		std::condition_variable main_thread_cv;
 
+		// stack reservations for the threads each window adds
+		// the UI thread keeps the usual Windows 1 MB because DefWindowProc, hooks and IMEs run on it,
+		// the logic thread only runs RunLogic() so it gets much less
+		ThreadAttributes mUiThreadAttributes{ NamedThreadAttributes(1024 * 1024, L"WMTS window ui") };
+		ThreadAttributes mLogicThreadAttributes{ NamedThreadAttributes(256 * 1024, L"WMTS window logic") };
+
+		// core sets and priorities for UI and logic threads, the defaults leave scheduling to the OS
+		PlacementPolicy mUiPlacement;
+		PlacementPolicy mLogicPlacement;
+
+		// the attributes for the next thread of a role with its placement filled in
+		// a policy left at its defaults keeps whatever SetThreadAttributes() set
+		ThreadAttributes PlacedThreadAttributes(ThreadRole role) {
+			bool ui = role == ThreadRole::UI;
+			ThreadAttributes attributes = ui ? mUiThreadAttributes : mLogicThreadAttributes;
+			PlacementPolicy& policy = ui ? mUiPlacement : mLogicPlacement;
+
+			const ThreadPlacement& placement = policy.Get();
+			if (!placement.mCores.empty() || placement.mSpread != PlacementSpread::NONE) {
+				attributes.mCores = policy.NextCores();
+			}
+			if (placement.mPriority != ThreadPriority::NORMAL) {
+				attributes.mPriority = placement.mPriority;
+			}
+			return attributes;
+		}
+
+		// placement failures are not fatal, the thread runs with default scheduling
+		void LogPlacementFailure(bool PlacementApplied) const {
+			if (PlacementApplied) return;
+			logger log(L"the OS refused the core set or priority for a new thread, it runs with default scheduling", Error::WARNING, WMTS_LOCATION);
+			log.to_console();
+			log.to_output();
+			log.to_log_file();
+		}
+
 		// thread guard for CreateAWindow()
-		std::mutex thread_guard1;
+		ProfiledMutex thread_guard1{ L"MTPlainWin32Window::thread_guard1" };
 
 		LRESULT CALLBACK WindowProcedure(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) override {
 			switch(message){
@@ -898,8 +1897,10 @@ namespace WMTS {
 					// Parse the menu selections:
 					switch (wmId){
 						case ID_NEW_WINDOW: {
-							BuildThreadPool(1, &WMTS::MTPlainWin32Window::Run, this);
-							break;
+							RequestWindows(1);
+
+							// handled, the base class has nothing more to do for it
+							return 0;
 						}
 					default:
 						return DefWindowProc(hwnd, message, wParam, lParam);
@@ -912,10 +1913,13 @@ namespace WMTS {
 			return PlainWin32Window::WindowProcedure(hwnd, message, wParam, lParam);
 		}
 
-		// total avaliable threads from the system
-		UINT total_threads = std::thread::hardware_concurrency();
+		// UI threads that each serve one window at a time, sized by load
+		ElasticPool mPool;
 
+		// one window on a pool worker, the worker goes back to the pool when the window closes
 		void Run() {
+			WMTS_TRACE_SCOPE("Run");
+
 			// if CreateAWindow fails we dont want the thread to continue
 			// it would cause problems in ProcessMessage()
 			if (!CreateAWindow())
@@ -925,13 +1929,8 @@ namespace WMTS {
 
 			auto ThreadID = std::this_thread::get_id();
 
-			// Update maps and resources
-			// much cleaner now and thread safe
-			mResources.Update(ThreadID);
-
-			// tell the waiting main thread to check if there is still threads in the thread pool map
-			// if the map is empty its safe to exit
-			main_thread_cv.notify_one();
+			// remove the window from the maps, the thread stays in mThread_pool_mp while it is a worker
+			mResources.RemoveWindow(ThreadID);
 		}
 
 		int ProcessMessage() override {
@@ -939,20 +1938,169 @@ namespace WMTS {
 			MSG msg{};
 			
 			// RunLogic function loop 
-			std::shared_ptr<std::atomic<bool>> run_logic{ std::make_shared<std::atomic<bool>> (true) };
+			std::shared_ptr<std::atomic<bool>> run_logic{ std::allocate_shared<std::atomic<bool>>(PoolAllocator<std::atomic<bool>>(), true) };
 
 			// get current thread id to use the correct window handle
 			auto CurrentThread = std::this_thread::get_id();
 
+			// the window this loop serves, used by the optional instrumentation below
+			auto CurrentWindow = mResources.SearchThreadmp(CurrentThread);
+
+#if WMTS_SHARED_STATS
+			// claimed before the logic thread starts so RunLogic() can find the slot
+			SharedWindowStats* shared_stats = nullptr;
+			if (CurrentWindow.has_value()) {
+				shared_stats = mSharedStats.Claim((uint64_t)CurrentWindow.value());
+			}
+			if (shared_stats) {
+				shared_stats->mThreads.fetch_add(1, std::memory_order_relaxed);
+			}
+			if (mSharedStats.Block()) {
+				mSharedStats.Block()->mHeader.mThreads.fetch_add(1, std::memory_order_relaxed);
+			}
+			uint64_t shared_queue_depth = 0;
+			ULONGLONG shared_cpu_updated_at = 0;
+#endif
+
+			// created before the logic thread starts so RunLogic() can find it
+			std::shared_ptr<WindowInputRing> input;
+			if (CurrentWindow.has_value()) {
+				input = mResources.AddToInputRingmp(CurrentWindow.value());
+			}
+			tlWindowInputRing = input.get();
+
+			std::shared_ptr<WindowSurface> surface;
+			if (CurrentWindow.has_value()) {
+				surface = mResources.AddToSurfacemp(CurrentWindow.value(), mPresentConfig);
+#if WMTS_CAPTURE
+				if (mCaptureRing.IsOpen()) {
+					surface->AttachCapture(mCaptureRing, CurrentWindow.value(), mCaptureConfig.mKeyframeEvery);
+				}
+#endif
+#if WMTS_SURFACE_EXPORT
+				if (surface->AttachExport(GetCurrentProcessId(), CurrentWindow.value(), mSurfaceExportConfig)) {
+					logger log(std::format(L"window {} exports its surface, read it with: WMTSSurfaceReader {} {}",
+						(const void*)CurrentWindow.value(), GetCurrentProcessId(), (uint64_t)CurrentWindow.value()), Error::INFO, WMTS_LOCATION);
+					log.to_console();
+					log.to_output();
+					log.to_log_file();
+				}
+				else {
+					logger log(Error::WARNING, WMTS_LOCATION);
+					log.to_console();
+					log.to_output();
+					log.to_log_file();
+				}
+#endif
+			}
+			tlWindowSurface = surface.get();
+
+#if WMTS_COALESCE
+			// created before the logic thread starts so RunLogic() can find it
+			std::shared_ptr<WindowCoalescer> coalescer;
+			if (CurrentWindow.has_value()) {
+				coalescer = mResources.AddToCoalescermp(CurrentWindow.value());
+			}
+			tlWindowCoalescer = coalescer.get();
+#endif
+
 			// put logic on a separate thread
-			std::thread* logic_thread = new std::thread(&WMTS::MTPlainWin32Window::RunLogic, this, CurrentThread, run_logic);
+			NativeThread* logic_thread = mResources.NewThread(PlacedThreadAttributes(ThreadRole::LOGIC), &WMTS::MTPlainWin32Window::RunLogic, this, CurrentThread, run_logic);
+			LogPlacementFailure(logic_thread->PlacementApplied());
+
+#if WMTS_TRACE
+			// name the thread after its window so the trace rows line up with window ids
+			if (CurrentWindow.has_value()) {
+				WMTS_TRACE_THREAD_NAME(std::format("window {} ui", (const void*)CurrentWindow.value()));
+			}
+#endif
+
+#if WMTS_MESSAGE_STATS
+			// hold a reference for the lifetime of the loop, Update() may erase the map entry first
+			std::shared_ptr<MessageLoopStats> stats;
+			if (CurrentWindow.has_value()) {
+				stats = mResources.AddToMessageStatsmp(CurrentWindow.value());
+			}
+			tlMessageLoopStats = stats.get();
+#endif
+
+#if WMTS_WATCHDOG
+			std::shared_ptr<PumpHeartbeat> heartbeat;
+			if (CurrentWindow.has_value()) {
+				heartbeat = mWatchdog.Register(CurrentWindow.value());
+			}
+			tlPumpHeartbeat = heartbeat.get();
+#endif
+
+#if WMTS_CPU_ACCOUNTING
+			std::shared_ptr<ThreadCpuEntry> cpu_entry;
+			if (CurrentWindow.has_value()) {
+				cpu_entry = mCpuAccounting.RegisterCurrentThread(CurrentWindow.value(), ThreadRole::UI);
+			}
+#endif
+
+#if WMTS_ALLOC_TRACKING
+			if (CurrentWindow.has_value()) {
+				mAllocations.AttachCurrentThread(CurrentWindow.value());
+			}
+#endif
 
 			// Windows message loop:
 			while (GetMessage(&msg, nullptr, 0, 0))
 			{
+#if WMTS_MESSAGE_STATS
+				if (stats) {
+					stats->RecordQueueWait(msg.time);
+				}
+#endif
+
+#if WMTS_SHARED_STATS
+				if (shared_stats) {
+					// a message that waited at least a tick means the loop is behind
+					shared_queue_depth = (GetTickCount() != msg.time) ? shared_queue_depth + 1 : 0;
+					shared_stats->mQueueDepth.store(shared_queue_depth, std::memory_order_relaxed);
+					shared_stats->mMessages.fetch_add(1, std::memory_order_relaxed);
+
+					// reading the thread's CPU time is a system call, do it at most twice a second
+					ULONGLONG now = GetTickCount64();
+					if (now - shared_cpu_updated_at >= 500) {
+						shared_stats->mUiCpuNs.store(CpuAccounting::CurrentThreadNs(), std::memory_order_relaxed);
+						shared_cpu_updated_at = now;
+					}
+				}
+#endif
+				WMTS_TRACE_SCOPE("DispatchMessage");
+#if WMTS_ALLOC_TRACKING
+				NoAllocScope steady_state;
+#endif
 				TranslateMessage(&msg);
 				DispatchMessage(&msg);
+
+#if WMTS_COALESCE
+				// once per pump iteration, the size events this message caused turn into one update
+				if (coalescer && coalescer->TakeSize()) {
+					mResources.UpdateWindowmp(CurrentWindow.value());
+				}
+#endif
+			}
+
+#if WMTS_MESSAGE_STATS
+			tlMessageLoopStats = nullptr;
+#endif
+
+			tlWindowInputRing = nullptr;
+			tlWindowSurface = nullptr;
+
+#if WMTS_COALESCE
+			tlWindowCoalescer = nullptr;
+#endif
+
+#if WMTS_WATCHDOG
+			tlPumpHeartbeat = nullptr;
+			if (heartbeat) {
+				mWatchdog.Unregister(heartbeat);
 			}
+#endif
 
 			// exit RunLogic() loop
 			*run_logic = false;
@@ -962,14 +2110,63 @@ namespace WMTS {
 				logic_thread->join();
 
 			// clean up
-			delete logic_thread;
+			mResources.DeleteThread(logic_thread);
+
+			// after the logic thread is joined so its last frame is counted
+			if (surface) {
+				std::lock_guard<std::mutex> local_lock(mFrameTotals_mtx);
+				mFrameTotals += surface->Read();
+			}
+
+#if WMTS_SURFACE_EXPORT
+			// after the logic thread is joined, in headless modes it publishes the frames
+			if (surface) {
+				std::lock_guard<std::mutex> local_lock(mSurfaceExportTotals_mtx);
+				mSurfaceExportTotals += surface->ReadExport();
+			}
+#endif
+
+			// after the logic thread is joined so its last drain is counted
+			if (input) {
+				std::lock_guard<std::mutex> local_lock(mInputTotals_mtx);
+				mInputTotals += input->Read();
+			}
+
+#if WMTS_COALESCE
+			// after the logic thread is joined so its flushes are counted
+			if (coalescer) {
+				std::lock_guard<std::mutex> local_lock(mCoalesceTotals_mtx);
+				mCoalesceTotals += coalescer->Read();
+			}
+#endif
+
+#if WMTS_CPU_ACCOUNTING
+			// after the logic thread is joined so the window's totals are complete
+			if (cpu_entry) {
+				mCpuAccounting.Unregister(cpu_entry);
+			}
+#endif
+
+#if WMTS_ALLOC_TRACKING
+			if (CurrentWindow.has_value()) {
+				mAllocations.DetachCurrentThread(CurrentWindow.value());
+			}
+#endif
+
+#if WMTS_SHARED_STATS
+			// after the logic thread is joined so it no longer writes to the slot
+			mSharedStats.Release(shared_stats);
+			if (mSharedStats.Block()) {
+				mSharedStats.Block()->mHeader.mThreads.fetch_sub(1, std::memory_order_relaxed);
+			}
+#endif
 
 			return (int)msg.wParam;
 		}
 
 		bool CreateAWindow() override {
 			// No need to unlock, as std::lock_guard will unlock automatically
-			std::lock_guard<std::mutex> lock(thread_guard1);
+			std::lock_guard<ProfiledMutex> lock(thread_guard1);
 
 			HWND hwnd = nullptr;
 
@@ -1015,4 +2212,124 @@ namespace WMTS {
 			return true;
 		}
 	};
+
+	// the window BenchmarkResizeCoalescing() resizes, the size messages take PlainWin32Window's own WindowProcedure
+	// and are only counted and timed on the way
+	struct ResizeBenchmarkWindow :public PlainWin32Window {
+		uint64_t mSizeEvents{};
+		uint64_t mSizeNs{};
+
+		LRESULT CALLBACK WindowProcedure(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) override {
+			if (message != WM_SIZE && message != WM_SIZING) {
+				return PlainWin32Window::WindowProcedure(hwnd, message, wParam, lParam);
+			}
+			auto start = std::chrono::steady_clock::now();
+			LRESULT result = PlainWin32Window::WindowProcedure(hwnd, message, wParam, lParam);
+			mSizeNs += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+			mSizeEvents++;
+			return result;
+		}
+
+		HWND Handle() {
+			return GetHandle();
+		}
+
+		// what the message loop and RunLogic() call when they take a coalesced size
+		bool Update(HWND hwnd) {
+			return mResources.UpdateWindowmp(hwnd);
+		}
+	};
+
+	// measures what WMTS_COALESCE saves during a resize storm
+	// a PlainWin32Window, hidden right after it is created, is resized Steps times with SetWindowPos, IntervalUs apart,
+	// which sends WM_SIZE synchronously the way the modal sizing loop does while the user drags a border,
+	// so no queued message is dispatched in between
+	// the storm runs once with tlWindowCoalescer unset, so every WM_SIZE updates the window's entry in mWindow_mp,
+	// and once with a WindowCoalescer that a second thread flushes every TickMs like the RunLogic() tick,
+	// the only flush during a drag; the second run needs WMTS_COALESCE, without it WM_SIZE never looks at the coalescer
+	// reports the size events, the updates they cost, the UI thread time spent on them and the reduction in updates
+	// runs on its own thread and unregisters the class after, so not while PlainWin32Window's windows are open,
+	// Example1 --benchmark-coalescing runs it
+	inline std::wstring BenchmarkResizeCoalescing(uint32_t Steps = 2000, uint32_t IntervalUs = 1000, uint32_t TickMs = (uint32_t)LogicTick.count()) {
+		std::wstring report = std::format(L"Resize storm, {} sizes {}us apart, logic tick {}ms:\n", Steps, IntervalUs, TickMs);
+
+		std::thread bench([&]() {
+			try {
+				ResizeBenchmarkWindow window;
+				HWND hwnd = window.Handle();
+				ShowWindow(hwnd, SW_HIDE);
+
+				auto storm = [&](const wchar_t* name, WindowCoalescer* coalescer) {
+					window.mSizeEvents = 0;
+					window.mSizeNs = 0;
+					std::atomic<uint64_t> flushes{ 0 };
+					std::atomic<uint64_t> flush_ns{ 0 };
+					auto flush = [&]() {
+						if (!coalescer->TakeSize()) return;
+						auto start = std::chrono::steady_clock::now();
+						window.Update(hwnd);
+						flush_ns.fetch_add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+						flushes.fetch_add(1, std::memory_order_relaxed);
+					};
+
+					tlWindowCoalescer = coalescer;
+					std::atomic<bool> run{ true };
+					std::thread logic;
+					if (coalescer) {
+						logic = std::thread([&]() {
+							while (run.load(std::memory_order_relaxed)) {
+								std::this_thread::sleep_for(std::chrono::milliseconds(TickMs));
+								flush();
+							}
+						});
+					}
+
+					// a drag back and forth over 400 pixels, one step per interval like the mouse moves of a drag
+					auto start = std::chrono::steady_clock::now();
+					auto next = start;
+					for (uint32_t i{}; i < Steps; i++) {
+						int step = (int)(i % 800);
+						int width = 400 + (step < 400 ? step : 800 - step);
+						SetWindowPos(hwnd, nullptr, 0, 0, width, 300 + width / 4, SWP_NOMOVE | SWP_NOZORDER | SWP_NOACTIVATE);
+						next += std::chrono::microseconds(IntervalUs);
+						while (std::chrono::steady_clock::now() < next) std::this_thread::yield();
+					}
+					double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+					run.store(false, std::memory_order_relaxed);
+					if (logic.joinable()) logic.join();
+					tlWindowCoalescer = nullptr;
+
+					uint64_t events = window.mSizeEvents;
+					uint64_t updates = events;
+					if (coalescer) {
+						// the last size of the storm is read once more, like the tick after the drag ends
+						flush();
+						updates = flushes.load(std::memory_order_relaxed);
+					}
+					report += std::format(L"  {} size events={} updates={} ({:.1f}% coalesced), {:.2f}ms in WM_SIZE, {:.2f}ms in ticks over {:.0f}ms\n",
+						name, events, updates, CoalesceSnapshot::Reduction(events, updates), (double)window.mSizeNs / 1e6,
+						(double)flush_ns.load(std::memory_order_relaxed) / 1e6, ms);
+				};
+
+				storm(L"per message", nullptr);
+#if WMTS_COALESCE
+				WindowCoalescer coalescer;
+				storm(L"coalesced  ", &coalescer);
+#else
+				report += L"  coalesced   needs WMTS_COALESCE\n";
+#endif
+				DestroyWindow(hwnd);
+			}
+			catch (const std::runtime_error& e) {
+				// PlainWin32Window throws when its class is already registered by the running windows
+				report += L"  could not create the window: ";
+				for (const char* c = e.what(); *c; c++) report.push_back((wchar_t)*c);
+				report += L"\n";
+			}
+			UnregisterClassW(L"Win32Window", GetModuleHandle(NULL));
+		});
+		bench.join();
+		return report;
+	}
 }
\ No newline at end of file
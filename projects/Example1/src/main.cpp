@@ -1,7 +1,69 @@
 #include "iWindow.hpp"
+#include "StaticWindow.hpp"
+
+// one window on the compile time class instead of the multithreaded system, run with --static
+// Escape closes it
+class ExampleStaticWindow :public WMTS::StaticWindow<ExampleStaticWindow> {
+	friend class WMTS::StaticWindow<ExampleStaticWindow>;
+
+	void WindowInit() {
+		StaticWindow::WindowInit();
+		mWindowTitle = L"StaticWindow Example";
+	}
+
+	LRESULT WindowProcedure(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
+		switch (message) {
+		case WM_KEYDOWN: {
+			if (wParam == VK_ESCAPE) {
+				DestroyWindow(hwnd);
+			}
+			return 0;
+		}
+		default:
+			return StaticWindow::WindowProcedure(hwnd, message, wParam, lParam);
+		}
+	}
+};
+
+// Example1 --benchmark-<name> runs one benchmark, --stress-<name> one stress test, instead of opening windows
+// the report goes to the debugger output and WMTSlog.txt, the benchmarks that open their own windows
+// need the window classes the running system would register, so none of them runs next to it
+struct BenchmarkSwitch {
+	const wchar_t* mSwitch;
+	std::wstring(*mRun)();
+};
+
+const BenchmarkSwitch Benchmarks[] = {
+	{ L"--benchmark-dispatch", [] { return WMTS::BenchmarkDispatch(); } },
+	{ L"--benchmark-churn", [] { return WMTS::BenchmarkWindowChurn(); } },
+	{ L"--benchmark-placement", [] { return WMTS::BenchmarkPlacement(); } },
+	{ L"--benchmark-coalescing", [] { return WMTS::BenchmarkResizeCoalescing(); } },
+	{ L"--benchmark-kernels", [] { return WMTS::BenchmarkRasterKernels(1920, 1080); } },
+	{ L"--benchmark-tiles", [] { return WMTS::BenchmarkTiledRaster({ { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } }, std::thread::hardware_concurrency()); } },
+	{ L"--benchmark-handoff", [] { return WMTS::BenchmarkFrameHandoff(); } },
+	{ L"--stress-triple-buffer", [] { return WMTS::StressTripleBuffer(); } },
+	{ L"--benchmark-resize-storm", [] { return WMTS::BenchmarkResizeStorm(); } },
+	{ L"--benchmark-text", [] { return WMTS::BenchmarkText(); } },
+};
 
 int APIENTRY wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _In_ LPWSTR lpCmdLine, _In_ int nCmdShow) {
+	std::wstring_view command_line{ lpCmdLine ? lpCmdLine : L"" };
+
+	for (const BenchmarkSwitch& benchmark : Benchmarks) {
+		if (command_line.find(benchmark.mSwitch) != std::wstring_view::npos) {
+			WMTS::logger log(benchmark.mRun(), WMTS::Error::INFO, WMTS_LOCATION);
+			log.to_output();
+			log.to_log_file();
+			return 0;
+		}
+	}
+
 	try{
+		if (command_line.find(L"--static") != std::wstring_view::npos) {
+			ExampleStaticWindow Window;
+			return Window.Run();
+		}
+
 		// might be heavy on the stack I dont know, to be on the safe side it's allocated on the heap
 		// TODO: Learn about stack limits in C++ and when to allocate on the stack vs heap
 		std::unique_ptr<WMTS::MTPlainWin32Window> Window{std::make_unique<WMTS::MTPlainWin32Window>()};
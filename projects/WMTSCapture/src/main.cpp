@@ -0,0 +1,154 @@
+#include "Capture.hpp"
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <filesystem>
+#include <format>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+// WMTSCapture <capture file> [output dir] [window handle]
+// extracts the frames of a capture file written by a WMTS process built with WMTS_CAPTURE=ON to BMP files
+// every window's frames are rebuilt from its last keyframe and the deltas after it,
+// a delta whose base frame was overwritten in the ring is left out until the window's next keyframe
+
+namespace {
+	struct WindowFrames {
+		WMTS::Framebuffer mCanvas;
+
+		// the frame the canvas holds, 0 before the first keyframe
+		uint64_t mFrame{};
+
+		uint64_t mWritten{};
+		uint64_t mSkipped{};
+		uint64_t mFirstNs{};
+		uint64_t mLastNs{};
+		uint32_t mWindowWidth{};
+		uint32_t mWindowHeight{};
+	};
+
+	// the record's rectangles lie inside its frame and their pixels inside the record
+	// a KEY is applied right after the canvas is resized, whose pixels are undefined, so it must be one rectangle
+	// covering the whole frame, WindowCapture::Reserve() never reserves any other
+	bool RecordFits(const WMTS::CaptureRecordHeader& record) {
+		const WMTS::PixelRect* rects = WMTS::CaptureRing::Rects(record);
+		if (record.mKind == WMTS::CaptureKind::KEY && (record.mRectCount != 1 || rects[0].mLeft != 0 || rects[0].mTop != 0 ||
+			(uint32_t)rects[0].mRight != record.mWidth || (uint32_t)rects[0].mBottom != record.mHeight)) {
+			return false;
+		}
+		uint64_t pixels = 0;
+		for (uint32_t i{}; i < record.mRectCount; i++) {
+			const WMTS::PixelRect& rect = rects[i];
+			if (rect.Empty() || rect.mLeft < 0 || rect.mTop < 0 ||
+				(uint32_t)rect.mRight > record.mWidth || (uint32_t)rect.mBottom > record.mHeight) {
+				return false;
+			}
+			pixels += (uint64_t)(rect.mRight - rect.mLeft) * (uint64_t)(rect.mBottom - rect.mTop);
+		}
+		return WMTS::CaptureRing::RecordBytes(record.mRectCount, pixels) <= record.mSize;
+	}
+
+	// copies the record's rectangles onto the canvas
+	void Apply(const WMTS::CaptureRecordHeader& record, WMTS::Framebuffer& canvas) {
+		const WMTS::PixelRect* rects = WMTS::CaptureRing::Rects(record);
+		const uint32_t* pixels = WMTS::CaptureRing::Pixels(record);
+		for (uint32_t i{}; i < record.mRectCount; i++) {
+			size_t width = (size_t)(rects[i].mRight - rects[i].mLeft);
+			for (int32_t y = rects[i].mTop; y < rects[i].mBottom; y++) {
+				std::memcpy(canvas.Row((uint32_t)y) + rects[i].mLeft, pixels, width * sizeof(uint32_t));
+				pixels += width;
+			}
+		}
+	}
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::cerr << "usage: WMTSCapture <capture file> [output dir] [window handle]" << std::endl;
+		return 1;
+	}
+
+	std::filesystem::path output = argc > 2 ? std::filesystem::path(argv[2]) : std::filesystem::current_path();
+	uint64_t only_window = 0;
+	try {
+		only_window = argc > 3 ? std::stoull(argv[3], nullptr, 0) : 0;
+	}
+	catch (const std::exception&) {
+		// std::stoull throws on anything that is not a number
+		std::cerr << "usage: WMTSCapture <capture file> [output dir] [window handle]" << std::endl;
+		return 1;
+	}
+
+	WMTS::CaptureRing ring;
+	if (!ring.Open(argv[1])) {
+		std::cerr << "cannot read " << argv[1] << " as a WMTS capture file" << std::endl;
+		return 2;
+	}
+
+	std::error_code error;
+	std::filesystem::create_directories(output, error);
+
+	const WMTS::CaptureFileHeader& header = *ring.Header();
+	std::cout << "capture of pid " << header.mPid << ", " << header.mRecords.load(std::memory_order_relaxed)
+		<< " frames recorded in a " << header.mCapacity / (1024 * 1024) << " MB ring" << std::endl;
+
+	std::map<uint64_t, WindowFrames> windows;
+	uint64_t failed = 0;
+	size_t records = ring.ForEachRecord([&](const WMTS::CaptureRecordHeader& record) {
+		if (only_window && record.mWindowHandle != only_window) return;
+
+		WindowFrames& window = windows[record.mWindowHandle];
+		if (window.mWritten + window.mSkipped == 0) window.mFirstNs = record.mTimeNs;
+		window.mLastNs = record.mTimeNs;
+		window.mWindowWidth = record.mWindowWidth;
+		window.mWindowHeight = record.mWindowHeight;
+
+		bool usable = RecordFits(record) && (record.mKind == WMTS::CaptureKind::KEY ||
+			(record.mKind == WMTS::CaptureKind::DELTA && window.mFrame != 0 && record.mBaseFrame == window.mFrame &&
+				window.mCanvas.Width() == record.mWidth && window.mCanvas.Height() == record.mHeight));
+		if (!usable) {
+			// the canvas no longer matches any frame, wait for the next keyframe
+			window.mFrame = 0;
+			window.mSkipped++;
+			return;
+		}
+
+		if (record.mKind == WMTS::CaptureKind::KEY) {
+			window.mCanvas.Resize(record.mWidth, record.mHeight);
+		}
+		Apply(record, window.mCanvas);
+		window.mFrame = record.mFrame;
+
+		auto path = output / std::format("WMTScapture-0x{:x}-{:08}.bmp", record.mWindowHandle, record.mFrame);
+		if (WMTS::WriteBmp(path, window.mCanvas)) {
+			window.mWritten++;
+		}
+		else {
+			failed++;
+		}
+	});
+
+	std::cout << records << " frames in the ring, written to " << output.string() << "\n\n";
+	std::cout << std::left << std::setw(20) << "WINDOW"
+		<< std::right << std::setw(12) << "SIZE"
+		<< std::setw(10) << "FRAMES"
+		<< std::setw(10) << "SKIPPED"
+		<< std::setw(12) << "FROM S"
+		<< std::setw(12) << "TO S" << "\n";
+	for (const auto& [handle, window] : windows) {
+		std::cout << std::left << std::setw(20) << std::format("0x{:x}", handle)
+			<< std::right << std::setw(12) << std::format("{}x{}", window.mWindowWidth, window.mWindowHeight)
+			<< std::setw(10) << window.mWritten
+			<< std::setw(10) << window.mSkipped
+			<< std::fixed << std::setprecision(3)
+			<< std::setw(12) << window.mFirstNs / 1e9
+			<< std::setw(12) << window.mLastNs / 1e9 << "\n";
+	}
+
+	if (failed) {
+		std::cerr << failed << " frames could not be written" << std::endl;
+		return 3;
+	}
+	return 0;
+}
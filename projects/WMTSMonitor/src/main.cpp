@@ -0,0 +1,108 @@
+#include "SharedStats.hpp"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <chrono>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// WMTSMonitor <pid> [interval ms]
+// attaches to the shared stats of a running WMTS process and prints a live top like view
+// it only reads the shared memory, the monitored process does no extra work for it
+
+namespace {
+	struct WindowSample {
+		uint64_t mMessages{};
+		uint64_t mTicks{};
+		uint64_t mCpuNs{};
+	};
+
+	void PrintView(const WMTS::SharedStatsBlock& block, std::unordered_map<uint64_t, WindowSample>& previous, double seconds) {
+		const auto& header = block.mHeader;
+
+		std::ostringstream out;
+		// clear the screen and go home, supported by Windows 10+ consoles and every unix terminal
+		out << "\x1b[2J\x1b[H";
+		out << "WMTS pid " << header.mPid
+			<< "  windows " << header.mWindows.load(std::memory_order_relaxed)
+			<< "  threads " << header.mThreads.load(std::memory_order_relaxed) << "\n\n";
+		out << std::left << std::setw(20) << "WINDOW"
+			<< std::right << std::setw(10) << "MSG/S"
+			<< std::setw(10) << "TICK/S"
+			<< std::setw(8) << "QUEUE"
+			<< std::setw(8) << "CPU%"
+			<< std::setw(12) << "CPU MS"
+			<< std::setw(9) << "THREADS" << "\n";
+
+		std::unordered_map<uint64_t, WindowSample> current;
+		for (const auto& slot : block.mSlots) {
+			uint64_t handle = slot.mWindowHandle.load(std::memory_order_acquire);
+			if (handle == 0) continue;
+
+			WindowSample sample;
+			sample.mMessages = slot.mMessages.load(std::memory_order_relaxed);
+			sample.mTicks = slot.mTicks.load(std::memory_order_relaxed);
+			sample.mCpuNs = slot.mUiCpuNs.load(std::memory_order_relaxed) + slot.mLogicCpuNs.load(std::memory_order_relaxed);
+			current[handle] = sample;
+
+			// rates need a previous sample of the same window
+			WindowSample before = sample;
+			auto found = previous.find(handle);
+			if (found != previous.end()) before = found->second;
+
+			auto rate = [seconds](uint64_t now, uint64_t then) {
+				return (seconds > 0.0 && now >= then) ? (double)(now - then) / seconds : 0.0;
+			};
+
+			std::ostringstream window;
+			window << "0x" << std::hex << handle;
+
+			out << std::left << std::setw(20) << window.str()
+				<< std::right << std::fixed << std::setprecision(1)
+				<< std::setw(10) << rate(sample.mMessages, before.mMessages)
+				<< std::setw(10) << rate(sample.mTicks, before.mTicks)
+				<< std::setw(8) << slot.mQueueDepth.load(std::memory_order_relaxed)
+				<< std::setw(8) << rate(sample.mCpuNs, before.mCpuNs) / 1e7
+				<< std::setw(12) << sample.mCpuNs / 1e6
+				<< std::setw(9) << slot.mThreads.load(std::memory_order_relaxed) << "\n";
+		}
+
+		previous = std::move(current);
+		std::cout << out.str() << std::flush;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	uint32_t pid{};
+	std::chrono::milliseconds interval{ 1000 };
+	try {
+		if (argc < 2) throw std::invalid_argument("missing pid");
+		pid = (uint32_t)std::stoul(argv[1]);
+		if (argc > 2) interval = std::chrono::milliseconds(std::stoul(argv[2]));
+	}
+	catch (const std::exception&) {
+		// std::stoul throws on anything that is not a number
+		std::cerr << "usage: WMTSMonitor <pid> [interval ms]" << std::endl;
+		return 1;
+	}
+
+	WMTS::SharedStatsRegion region;
+	if (!region.Open(pid)) {
+		std::cerr << "no WMTS stats for pid " << pid << ", is it running with WMTS_SHARED_STATS=ON?" << std::endl;
+		return 2;
+	}
+
+	std::unordered_map<uint64_t, WindowSample> previous;
+	auto last = std::chrono::steady_clock::now();
+	while (region.Block()->mHeader.mAlive.load(std::memory_order_relaxed)) {
+		auto now = std::chrono::steady_clock::now();
+		PrintView(*region.Block(), previous, std::chrono::duration<double>(now - last).count());
+		last = now;
+		std::this_thread::sleep_for(interval);
+	}
+
+	std::cout << "process " << pid << " shut down" << std::endl;
+	return 0;
+}
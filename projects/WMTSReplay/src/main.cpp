@@ -0,0 +1,202 @@
+#include "MessageRecord.hpp"
+#include "Damage.hpp"
+#include "TiledRaster.hpp"
+#include "Scene.hpp"
+#include "SurfacePool.hpp"
+#include "resource.h"
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+// WMTSReplay <stream file> [original|max] [runs]
+// replays a message stream recorded by a WMTS process built with WMTS_RECORD=ON into headless windows
+// nothing is shown and no window system is needed, so the same stream gives the same work on a CI machine
+// each recorded window gets a model of what its threads do with those messages: its first WM_SIZE creates it and
+// later ones resize its frame, input is counted, and every WMTS::LogicTick of recorded time a logic tick draws the default
+// scene with the same DrawDefaultScene() and RenderChanges() RunLogic() uses, into a framebuffer from the SurfacePool
+// WM_DESTROY frees it, and what follows for that handle (WM_NCDESTROY and the like) is ignored
+// the windows still open at the end of the stream tick up to its last message and once more, as their logic threads kept running
+// resize storms, window spam and rapid closes therefore cost here what they cost the real process, minus the OS
+
+namespace {
+	// WinUser.h values, this tool also builds where there is no Windows.h
+	constexpr uint32_t MessageDestroy = 0x0002;
+	constexpr uint32_t MessageSize = 0x0005;
+	constexpr uint32_t MessagePaint = 0x000F;
+	constexpr uint32_t MessageCommand = 0x0111;
+	constexpr bool IsInput(uint32_t message) {
+		return (message >= 0x0100 && message <= 0x0109) || (message >= 0x0200 && message <= 0x020E);
+	}
+
+	// the RunLogic() tick
+	constexpr uint64_t TickUs = (uint64_t)std::chrono::microseconds(WMTS::LogicTick).count();
+
+	struct HeadlessWindow {
+		uint32_t mWidth{};
+		uint32_t mHeight{};
+		WMTS::Framebuffer mFrame;
+		WMTS::DrawList mList;
+		WMTS::DamageTracker mDamage;
+		WMTS::DamageRegion mRedraw;
+
+		// the published frame the framebuffer holds, 0 after a resize
+		uint64_t mContentFrame{};
+		uint64_t mFrames{};
+
+		// the frame number RenderFrame() gets, one per tick like RunLogic()'s
+		uint64_t mTicks{};
+		uint64_t mInput{};
+		uint64_t mNextTickUs{};
+	};
+
+	struct ReplayTotals {
+		uint64_t mWindows{};
+		uint64_t mClosed{};
+
+		// messages for a handle with no live window, before its first WM_SIZE or after its WM_DESTROY
+		uint64_t mIgnored{};
+		uint64_t mSizes{};
+		uint64_t mPaints{};
+		uint64_t mInput{};
+		uint64_t mNewWindowCommands{};
+		uint64_t mTicks{};
+		uint64_t mFrames{};
+		uint64_t mPixelsRendered{};
+	};
+
+	// one RunLogic() tick of the window with the default RenderFrame()
+	void Tick(HeadlessWindow& window, WMTS::TiledRenderer& renderer, ReplayTotals& totals) {
+		totals.mTicks++;
+		if (window.mWidth == 0 || window.mHeight == 0) return;
+		if (window.mFrame.Width() != window.mWidth || window.mFrame.Height() != window.mHeight) {
+			window.mFrame.Resize(window.mWidth, window.mHeight);
+			window.mContentFrame = 0;
+		}
+
+		window.mList.Reset(window.mWidth, window.mHeight);
+		WMTS::DrawDefaultScene(window.mList, window.mTicks++);
+
+		// a single buffer, so it always holds the last published frame and only lacks this frame's damage
+		uint64_t published = window.mFrames + 1;
+		const WMTS::DamageRegion& damage = WMTS::RenderChanges(window.mDamage, window.mList, renderer, window.mFrame, window.mContentFrame, published, window.mRedraw);
+		if (damage.Empty()) return;
+		window.mFrames = published;
+		window.mContentFrame = published;
+		totals.mFrames++;
+		totals.mPixelsRendered += window.mRedraw.Area();
+	}
+
+	ReplayTotals RunOnce(const WMTS::MessageStream& stream, WMTS::ReplaySpeed speed, WMTS::ReplayStats& stats) {
+		ReplayTotals totals;
+		WMTS::TiledRenderer renderer;
+		std::map<uint64_t, std::unique_ptr<HeadlessWindow>> windows;
+
+		// every window's logic thread ticks on its own, catches them all up to TimeUs
+		auto catch_up = [&](uint64_t TimeUs) {
+			for (auto& [handle, window] : windows) {
+				while (window->mNextTickUs <= TimeUs) {
+					Tick(*window, renderer, totals);
+					window->mNextTickUs += TickUs;
+				}
+			}
+		};
+
+		stats = WMTS::ReplayMessages(stream, speed, [&](const WMTS::RecordedMessage& message) {
+			catch_up(message.mTimeUs);
+
+			auto found = windows.find(message.mWindow);
+			if (found == windows.end()) {
+				// WM_NCCREATE and WM_CREATE carry pointers and are not replayed, so a window starts with its first WM_SIZE
+				// anything else has no live window: it came before that or after WM_DESTROY, such as WM_NCDESTROY
+				// a handle Windows reuses for a later window starts over with that window's first WM_SIZE
+				if (message.mMessage != MessageSize) {
+					totals.mIgnored++;
+					return;
+				}
+				auto window = std::make_unique<HeadlessWindow>();
+				window->mNextTickUs = message.mTimeUs + TickUs;
+				found = windows.emplace(message.mWindow, std::move(window)).first;
+				totals.mWindows++;
+			}
+			HeadlessWindow& window = *found->second;
+
+			if (message.mMessage == MessageSize) {
+				// LOWORD and HIWORD of lParam, the new client size
+				window.mWidth = (uint32_t)(message.mLParam & 0xFFFF);
+				window.mHeight = (uint32_t)((message.mLParam >> 16) & 0xFFFF);
+				totals.mSizes++;
+			}
+			else if (message.mMessage == MessagePaint) {
+				totals.mPaints++;
+			}
+			else if (IsInput(message.mMessage)) {
+				window.mInput++;
+				totals.mInput++;
+			}
+			else if (message.mMessage == MessageCommand && (message.mWParam & 0xFFFF) == ID_NEW_WINDOW) {
+				// the window it opens shows up in the stream under its own handle
+				totals.mNewWindowCommands++;
+			}
+			else if (message.mMessage == MessageDestroy) {
+				// its framebuffer goes back to the pool for the next window
+				windows.erase(found);
+				totals.mClosed++;
+			}
+		});
+
+		// messages only tick the windows up to their own time, so the state the last ones left is not drawn yet,
+		// the windows still open get their ticks to the end of the stream and the one RunLogic() ran next
+		// the stream is sorted by time
+		if (!stream.Messages().empty()) {
+			catch_up(stream.Messages().back().mTimeUs + TickUs);
+		}
+		return totals;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::wcerr << L"usage: WMTSReplay <stream file> [original|max] [runs]" << std::endl;
+		return 1;
+	}
+
+	WMTS::ReplaySpeed speed = (argc > 2 && std::string(argv[2]) == "original") ? WMTS::ReplaySpeed::ORIGINAL : WMTS::ReplaySpeed::MAXIMUM;
+	int runs = 1;
+	try {
+		if (argc > 3) runs = std::max(std::stoi(argv[3]), 1);
+	}
+	catch (const std::exception&) {
+		// std::stoi throws on anything that is not a number
+		std::wcerr << L"usage: WMTSReplay <stream file> [original|max] [runs]" << std::endl;
+		return 1;
+	}
+
+	WMTS::MessageStream stream;
+	if (!stream.Load(argv[1])) {
+		std::wcerr << L"cannot read " << argv[1] << L" as a WMTS message stream" << std::endl;
+		return 2;
+	}
+
+	const auto& messages = stream.Messages();
+	double recorded = messages.empty() ? 0.0 : (double)(messages.back().mTimeUs - messages.front().mTimeUs) / 1e6;
+	std::wcout << L"stream of pid " << stream.Pid() << L": " << messages.size() << L" messages over " << recorded
+		<< L" s, replaying at " << (speed == WMTS::ReplaySpeed::ORIGINAL ? L"original" : L"maximum") << L" speed" << std::endl;
+
+	for (int run{}; run < runs; run++) {
+		WMTS::SurfacePool::Get().ResetStats();
+		WMTS::ReplayStats stats;
+		ReplayTotals totals = RunOnce(stream, speed, stats);
+
+		std::wcout << L"\nrun " << run + 1 << L"\n" << stats.Report()
+			<< L"  windows=" << totals.mWindows << L" closed=" << totals.mClosed << L" new window commands=" << totals.mNewWindowCommands
+			<< L" ignored=" << totals.mIgnored
+			<< L" sizes=" << totals.mSizes << L" paints=" << totals.mPaints << L" input=" << totals.mInput << L"\n"
+			<< L"  ticks=" << totals.mTicks << L" frames=" << totals.mFrames
+			<< L" pixels rendered per frame=" << (totals.mFrames ? totals.mPixelsRendered / totals.mFrames : 0) << L"\n"
+			<< WMTS::SurfacePool::Get().Read().Report();
+	}
+	std::wcout << std::flush;
+	return 0;
+}
@@ -0,0 +1,92 @@
+#include "SurfaceExport.hpp"
+#include "Histogram.hpp"
+#include <iostream>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+// WMTSSurfaceReader <pid> <window handle> [seconds] [poll us]
+// maps a window surface exported by a WMTS process built with WMTS_SURFACE_EXPORT=ON and reads every new frame
+// in place, without a lock or a copy, for as long as asked or until the window closes
+// reports how long frames took from being published to being seen, how long reading one took
+// and how often the writer overwrote a frame while it was being read
+
+int main(int argc, char* argv[]) {
+	uint32_t pid{};
+	uint64_t window{};
+	std::chrono::seconds duration{ 10 };
+	std::chrono::microseconds poll{ 100 };
+	try {
+		if (argc < 3) throw std::invalid_argument("missing pid or window handle");
+		pid = (uint32_t)std::stoul(argv[1]);
+		window = std::stoull(argv[2], nullptr, 0);
+		if (argc > 3) duration = std::chrono::seconds(std::stoul(argv[3]));
+		if (argc > 4) poll = std::chrono::microseconds(std::stoul(argv[4]));
+	}
+	catch (const std::exception&) {
+		// std::stoul throws on anything that is not a number
+		std::wcerr << L"usage: WMTSSurfaceReader <pid> <window handle> [seconds] [poll us]" << std::endl;
+		return 1;
+	}
+
+	WMTS::SharedSurface surface;
+	if (!surface.Open(pid, window)) {
+		std::wcerr << L"no exported surface for window " << window << L" of pid " << pid
+			<< L", is it running with WMTS_SURFACE_EXPORT=ON?" << std::endl;
+		return 2;
+	}
+
+	const WMTS::SharedSurfaceHeader& header = *surface.Header();
+	std::wcout << L"window " << window << L" of pid " << pid << L", up to " << header.mMaxWidth << L"x" << header.mMaxHeight
+		<< L" BGRX8, reading for " << duration.count() << L" s" << std::endl;
+
+	WMTS::LatencyHistogram latency;
+	WMTS::LatencyHistogram read_time;
+	uint64_t frames = 0, torn = 0, missed = 0, last = 0;
+	uint32_t width = 0, height = 0;
+
+	// the sum keeps the compiler from skipping the pixel reads
+	uint64_t checksum = 0;
+
+	auto end = std::chrono::steady_clock::now() + duration;
+	while (std::chrono::steady_clock::now() < end && header.mAlive.load(std::memory_order_relaxed)) {
+		uint64_t newest = header.mNewest.load(std::memory_order_acquire) / 2;
+		if (newest == 0 || newest == last) {
+			std::this_thread::sleep_for(poll);
+			continue;
+		}
+
+		uint64_t seen = WMTS::SharedSurface::SteadyNs();
+		uint64_t generation = 0, published = 0, sum = 0;
+		bool whole = surface.ReadNewest([&](const WMTS::SharedSurfaceFrame& frame) {
+			generation = frame.mGeneration;
+			published = frame.mPublishedNs;
+			width = frame.mWidth;
+			height = frame.mHeight;
+			for (uint32_t y{}; y < frame.mHeight; y++) {
+				const uint32_t* row = reinterpret_cast<const uint32_t*>(reinterpret_cast<const uint8_t*>(frame.mPixels) + (size_t)y * frame.mStride);
+				for (uint32_t x{}; x < frame.mWidth; x++) sum += row[x];
+			}
+		});
+		uint64_t done = WMTS::SharedSurface::SteadyNs();
+
+		if (!whole) {
+			// the writer reached the slot while we read it, the next poll takes the newer frame
+			torn++;
+			continue;
+		}
+		if (last && generation > last + 1) missed += generation - last - 1;
+		last = generation;
+		frames++;
+		checksum += sum;
+		if (seen >= published) latency.Record(seen - published);
+		read_time.Record(done - seen);
+	}
+
+	std::wcout << L"frames read=" << frames << L" torn reads=" << torn << L" frames missed=" << missed
+		<< L" last size=" << width << L"x" << height << L" checksum=" << checksum << L"\n"
+		<< L"  publish to seen " << latency.Read().Summary() << L"\n"
+		<< L"  read in place   " << read_time.Read().Summary() << std::endl;
+	return 0;
+}